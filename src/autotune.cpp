@@ -0,0 +1,159 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "autotune.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+constexpr int TUNE_GW_SIZES[] = {32, 64, 128, 256, 512, 1024};
+constexpr CalculationMethod TUNE_METHODS[] = {CalculationMethod::BRANCH,
+  CalculationMethod::PREDICATED};
+constexpr int TUNE_WARMUP = 1;  ///< Untimed steps per candidate
+constexpr int TUNE_REPS = 5;    ///< Timed steps per candidate
+
+struct CacheLine {
+  std::string device;
+  int sizeClass;
+  std::string accumMethod;
+  bool specialize;
+  int gwSize;
+  std::string calcMethod;
+  float stepMs;
+};
+
+std::vector<CacheLine> readCache(const std::string &path) {
+  std::vector<CacheLine> lines;
+  std::ifstream file(path);
+  std::string text;
+  while (std::getline(file, text)) {
+    if (text.empty() || text[0] == '#') continue;
+    std::stringstream fields(text);
+    CacheLine line;
+    std::string sizeClass, specialize, gwSize, stepMs;
+    if (std::getline(fields, line.device, '\t') &&
+        std::getline(fields, sizeClass, '\t') &&
+        std::getline(fields, line.accumMethod, '\t') &&
+        std::getline(fields, specialize, '\t') &&
+        std::getline(fields, gwSize, '\t') &&
+        std::getline(fields, line.calcMethod, '\t') &&
+        std::getline(fields, stepMs)) {
+      line.sizeClass = atoi(sizeClass.c_str());
+      line.specialize = atoi(specialize.c_str()) != 0;
+      line.gwSize = atoi(gwSize.c_str());
+      line.stepMs = atof(stepMs.c_str());
+      lines.push_back(line);
+    }
+  }
+  return lines;
+}
+
+bool matches(const CacheLine &line, const TuneKey &key) {
+  return line.device == key.device && line.sizeClass == key.sizeClass &&
+    line.accumMethod == accumulationMethodName(key.accumMethod) &&
+    line.specialize == key.specialize;
+}
+
+}  // namespace
+
+TuneKey makeTuneKey(const std::string &device, const SimParam &params) {
+  int sizeClass = 0;
+  while ((params.numParticles >> (sizeClass + 1)) > 0) sizeClass++;
+  // Separators can't appear in the name
+  std::string name = device;
+  std::replace(name.begin(), name.end(), '\t', ' ');
+  std::replace(name.begin(), name.end(), '\n', ' ');
+  return {name, sizeClass, params.accumMethod, params.specialize};
+}
+
+bool TuneCache::find(const TuneKey &key, TuneChoice &choice) const {
+  for (const CacheLine &line : readCache(path)) {
+    if (!matches(line, key) || line.gwSize <= 0) continue;
+    try {
+      choice = {line.gwSize, getCalculationMethod(line.calcMethod),
+        line.stepMs};
+      return true;
+    } catch (const std::invalid_argument &) {
+      // Written by a build with other methods, so tuned again
+    }
+  }
+  return false;
+}
+
+void TuneCache::store(const TuneKey &key, const TuneChoice &choice) const {
+  std::vector<CacheLine> lines = readCache(path);
+  lines.erase(std::remove_if(lines.begin(), lines.end(),
+        [&](const CacheLine &line) { return matches(line, key); }),
+      lines.end());
+  lines.push_back({key.device, key.sizeClass,
+      accumulationMethodName(key.accumMethod), key.specialize, choice.gwSize,
+      calculationMethodName(choice.calcMethod), choice.stepMs});
+
+  // Renamed into place, like the initial conditions cache, so concurrent
+  // runs never read a partial file
+  const std::string tmpPath = path + "." + std::to_string(getpid());
+  {
+    std::ofstream file(tmpPath);
+    file << "# device\tsizeClass\taccumMethod\tspecialize\tgwSize\t"
+      << "calcMethod\tstepMs\n";
+    for (const CacheLine &line : lines) {
+      file << line.device << "\t" << line.sizeClass << "\t"
+        << line.accumMethod << "\t" << line.specialize << "\t"
+        << line.gwSize << "\t" << line.calcMethod << "\t" << line.stepMs
+        << "\n";
+    }
+    if (!file.flush()) {
+      std::cerr << "Can't write autotuning cache " << tmpPath << "\n";
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::cerr << "Can't rename " << tmpPath << " to " << path << "\n";
+    std::remove(tmpPath.c_str());
+  }
+}
+
+TuneChoice tuneLaunch(int maxGwSize,
+    const std::function<void(CalculationMethod, int)> &step) {
+  TuneChoice best{0, CalculationMethod::BRANCH, 0};
+  for (CalculationMethod method : TUNE_METHODS) {
+    for (int gwSize : TUNE_GW_SIZES) {
+      if (gwSize > maxGwSize) continue;
+      std::vector<float> times;
+      try {
+        for (int i = 0; i < TUNE_WARMUP; i++) step(method, gwSize);
+        for (int i = 0; i < TUNE_REPS; i++) {
+          auto start = std::chrono::steady_clock::now();
+          step(method, gwSize);
+          times.push_back(std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+      } catch (const std::exception &e) {
+        // e.g. more registers than the work-group size allows
+        continue;
+      }
+      std::nth_element(times.begin(), times.begin() + times.size() / 2,
+          times.end());
+      const float median = times[times.size() / 2];
+      if (best.gwSize == 0 || median < best.stepMs) {
+        best = {gwSize, method, median};
+      }
+    }
+  }
+  if (best.gwSize == 0) {
+    throw std::runtime_error("No work-group size could be launched");
+  }
+  return best;
+}
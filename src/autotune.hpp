@@ -0,0 +1,67 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "sim_param.hpp"
+
+/**
+ * What a tuned launch configuration applies to: the device, the particle
+ * count rounded down to a power of two, the accumulation method & whether
+ * the kernel is specialized
+ */
+struct TuneKey {
+  std::string device;
+  int sizeClass;  ///< floor(log2(numParticles))
+  AccumulationMethod accumMethod;
+  bool specialize;
+};
+
+TuneKey makeTuneKey(const std::string &device, const SimParam &params);
+
+/**
+ * Fastest launch configuration of the all pairs interaction
+ */
+struct TuneChoice {
+  int gwSize;
+  CalculationMethod calcMethod;
+  float stepMs;  ///< Median time of one interaction step
+};
+
+/**
+ * Tuned launch configurations, persisted as a text file of one tab
+ * separated line per key:
+ *   device  sizeClass  accumMethod  specialize  gwSize  calcMethod  stepMs
+ */
+class TuneCache {
+  public:
+    explicit TuneCache(const std::string &path_) : path(path_) {}
+
+    /**
+     * @return whether key has been tuned, filling choice if so
+     */
+    bool find(const TuneKey &key, TuneChoice &choice) const;
+
+    /**
+     * Adds or replaces the choice for key. Failing to write is reported &
+     * otherwise ignored, as with the initial conditions cache.
+     */
+    void store(const TuneKey &key, const TuneChoice &choice) const;
+
+  private:
+    std::string path;
+};
+
+/**
+ * Times every candidate work-group size up to maxGwSize with each
+ * CalculationMethod & returns the fastest
+ * @param step runs one interaction step with the given method &
+ *   work-group size & waits for it, throwing if it can't be launched
+ * @throws std::runtime_error if no candidate could be launched
+ */
+TuneChoice tuneLaunch(int maxGwSize,
+    const std::function<void(CalculationMethod, int)> &step);
@@ -0,0 +1,26 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+// Headless benchmark sweeps, without the renderer. See BenchOptions for
+// the arguments.
+
+#include "benchmark.hpp"
+#include "simulator.cuh"
+
+using namespace simulation;
+
+int main(int argc, char **argv) {
+  return runBenchmarks(argc, argv, COMPILER_NAME,
+      [](const SimParam &params, int warmup, int reps) {
+        DiskGalaxySimulator nbodySim(params);
+        BenchRun run;
+        run.device = *nbodySim.getDeviceName();
+        for (int i = 0; i < warmup; i++) nbodySim.stepSim();
+        for (int i = 0; i < reps; i++) {
+          nbodySim.stepSim();
+          run.stepTime.add(nbodySim.getLastStepTime());
+        }
+        return run;
+      });
+}
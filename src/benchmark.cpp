@@ -0,0 +1,178 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "benchmark.hpp"
+#include "sweep_args.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+std::string jsonString(const std::string &s) {
+  std::string quoted = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+std::string csvString(const std::string &s) {
+  std::string quoted = "\"";
+  for (char c : s) {
+    if (c == '"') quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+}  // namespace
+
+double BenchResult::interactionsPerSecond() const {
+  const double n = params.numParticles;
+  const double mean = run.stepTime.mean();
+  return mean > 0 ?
+    n * n * params.simIterationsPerFrame / (mean * 1e-3) : 0;
+}
+
+BenchOptions::BenchOptions(int argc, char **argv)
+  : particles{16384, 65536}, gwSizes{64, 128, 256},
+  methods{CalculationMethod::BRANCH, CalculationMethod::PREDICATED},
+  iterations{1} {
+  base = parseSweepArgs(argc, argv,
+      [&](const std::string &name, const std::string &value) {
+        if (name == "particles") {
+          particles = parseList<size_t>(value, parseCount);
+        } else if (name == "gwSizes") {
+          gwSizes = parseList<int>(value, parseCount);
+        } else if (name == "methods") {
+          methods = parseList<CalculationMethod>(value, getCalculationMethod);
+        } else if (name == "iterations") {
+          iterations = parseList<int>(value, parseCount);
+        } else if (name == "warmup") {
+          warmup = atoi(value.c_str());
+        } else if (name == "reps") {
+          reps = parseCount(value);
+        } else if (name == "format") {
+          if (value != "csv" && value != "json") {
+            throw std::invalid_argument("Valid formats are csv or json");
+          }
+          json = value == "json";
+        } else if (name == "out") {
+          outFile = value;
+        } else {
+          return false;
+        }
+        return true;
+      });
+}
+
+std::vector<SimParam> BenchOptions::configurations() const {
+  std::vector<SimParam> configs;
+  for (size_t n : particles) {
+    for (int iters : iterations) {
+      for (CalculationMethod method : methods) {
+        for (int gwSize : gwSizes) {
+          SimParam params = base;
+          params.numParticles = n;
+          params.simIterationsPerFrame = iters;
+          params.calcMethod = method;
+          params.gwSize = gwSize;
+          params.autotune = false;
+          configs.push_back(params);
+        }
+      }
+    }
+  }
+  return configs;
+}
+
+void writeBenchCsv(std::ostream &out, const std::string &backend,
+    const std::vector<BenchResult> &results) {
+  out << "backend,device,particles,gw_size,method,iterations,reps,"
+    << "mean_ms,stddev_ms,min_ms,p50_ms,max_ms,interactions_per_s,gflops\n";
+  for (const BenchResult &r : results) {
+    const StreamStats &t = r.run.stepTime;
+    out << backend << "," << csvString(r.run.device) << ","
+      << r.params.numParticles << "," << r.params.gwSize << ","
+      << calculationMethodName(r.params.calcMethod) << ","
+      << r.params.simIterationsPerFrame << "," << t.count() << ","
+      << t.mean() << "," << t.stddev() << "," << t.min() << ","
+      << t.p50() << "," << t.max() << "," << r.interactionsPerSecond()
+      << "," << r.gflops() << "\n";
+  }
+}
+
+void writeBenchJson(std::ostream &out, const std::string &backend,
+    const std::vector<BenchResult> &results) {
+  out << "{\n  \"backend\": " << jsonString(backend)
+    << ",\n  \"flopsPerInteraction\": " << FLOPS_PER_INTERACTION
+    << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    const StreamStats &t = r.run.stepTime;
+    out << (i > 0 ? ",\n" : "\n") << "    {\"device\": "
+      << jsonString(r.run.device) << ", \"particles\": "
+      << r.params.numParticles << ", \"gwSize\": " << r.params.gwSize
+      << ", \"method\": \"" << calculationMethodName(r.params.calcMethod)
+      << "\", \"iterations\": " << r.params.simIterationsPerFrame
+      << ", \"reps\": " << t.count() << ", \"meanMs\": " << t.mean()
+      << ", \"stddevMs\": " << t.stddev() << ", \"minMs\": " << t.min()
+      << ", \"p50Ms\": " << t.p50() << ", \"maxMs\": " << t.max()
+      << ", \"interactionsPerSecond\": " << r.interactionsPerSecond()
+      << ", \"gflops\": " << r.gflops() << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int runBenchmarks(int argc, char **argv, const std::string &backend,
+    const BenchMeasure &measure) {
+  try {
+    BenchOptions options(argc, argv);
+    const std::vector<SimParam> configs = options.configurations();
+    if (!configs.empty() && configs.front().solver != Solver::DIRECT) {
+      std::cerr << "Interaction rates assume the DIRECT solver's all pairs "
+        << "interactions\n";
+    }
+
+    std::vector<BenchResult> results;
+    for (const SimParam &params : configs) {
+      std::cerr << "Benchmarking " << params.numParticles << " particles, "
+        << "work-group size " << params.gwSize << ", "
+        << calculationMethodName(params.calcMethod) << ", "
+        << params.simIterationsPerFrame << " iterations per step\n";
+      results.push_back({params,
+          measure(params, options.warmup, options.reps)});
+    }
+
+    std::ofstream file;
+    if (!options.outFile.empty()) {
+      file.open(options.outFile);
+      if (!file) {
+        throw std::runtime_error("Can't create " + options.outFile);
+      }
+    }
+    std::ostream &out = options.outFile.empty() ? std::cout : file;
+    if (options.json) {
+      writeBenchJson(out, backend, results);
+    } else {
+      writeBenchCsv(out, backend, results);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
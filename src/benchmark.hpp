@@ -0,0 +1,101 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "sim_param.hpp"
+#include "stream_stats.hpp"
+
+/**
+ * Floating point operations per particle pair of the all pairs
+ * interaction, by the usual convention for direct n-body codes
+ */
+constexpr double FLOPS_PER_INTERACTION = 20;
+
+/**
+ * What one benchmarked configuration measured
+ */
+struct BenchRun {
+  std::string device;
+  StreamStats stepTime;  ///< Milliseconds per step
+};
+
+/**
+ * Measures one configuration: constructs a simulator from params, takes
+ * warmup steps & then reps timed ones
+ */
+using BenchMeasure =
+  std::function<BenchRun(const SimParam &params, int warmup, int reps)>;
+
+/**
+ * A configuration of a sweep & its measurements
+ */
+struct BenchResult {
+  SimParam params;
+  BenchRun run;
+
+  /**
+   * Pair interactions per second, at the mean step time
+   */
+  double interactionsPerSecond() const;
+
+  double gflops() const {
+    return interactionsPerSecond() * FLOPS_PER_INTERACTION * 1e-9;
+  }
+};
+
+/**
+ * Command line of nbody_bench. The comma separated lists --particles,
+ * --gwSizes, --methods & --iterations give the sweep, every combination
+ * of which is measured; every other argument sets the SimParam of all of
+ * them, as for nbody.
+ */
+class BenchOptions {
+  public:
+    /**
+     * @throws std::invalid_argument for malformed arguments
+     */
+    BenchOptions(int argc, char **argv);
+
+    /**
+     * Parameters of each configuration of the sweep
+     */
+    std::vector<SimParam> configurations() const;
+
+    std::vector<size_t> particles;
+    std::vector<int> gwSizes;
+    std::vector<CalculationMethod> methods;
+    std::vector<int> iterations;  ///< Simulation iterations per step
+    int warmup = 3;               ///< Untimed steps per configuration
+    int reps = 10;                ///< Timed steps per configuration
+    bool json = false;            ///< JSON rather than CSV output
+    std::string outFile;          ///< Output (empty = stdout)
+
+  private:
+    SimParam base;
+};
+
+/**
+ * One row per result, with a header
+ */
+void writeBenchCsv(std::ostream &out, const std::string &backend,
+    const std::vector<BenchResult> &results);
+
+void writeBenchJson(std::ostream &out, const std::string &backend,
+    const std::vector<BenchResult> &results);
+
+/**
+ * Runs nbody_bench: parses the command line, measures every
+ * configuration & writes the results
+ * @param backend name of the backend, recorded in the output
+ * @return the exit status
+ */
+int runBenchmarks(int argc, char **argv, const std::string &backend,
+    const BenchMeasure &measure);
@@ -0,0 +1,217 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "cell_list.cuh"
+#include "device_util.cuh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace simulation {
+
+  namespace {
+    // Limits on grid size, beyond which cells are made wider than asked
+    constexpr int MAX_CELLS_PER_AXIS = 1024;
+    constexpr size_t MAX_CELLS = size_t(1) << 24;
+
+    constexpr int DISPLACEMENT_BLOCKS = 256;
+    constexpr int DISPLACEMENT_THREADS = 256;
+  }  // namespace
+
+  // Count particles per cell
+  __global__ void cell_count(ParticleData_d pos, size_t n, CellGrid grid,
+      uint32_t *particleCell, uint32_t *cellCount) {
+    size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n) return;
+    int c = grid.cellIndex(grid.cellCoord(pos.x[i], grid.origin.x, grid.dimX),
+        grid.cellCoord(pos.y[i], grid.origin.y, grid.dimY),
+        grid.cellCoord(pos.z[i], grid.origin.z, grid.dimZ));
+    particleCell[i] = c;
+    atomicAdd(&cellCount[c], 1u);
+  }
+
+  // Scatter particle indices into their cells. The order within a cell
+  // depends on atomic ordering, so isn't reproducible between runs.
+  __global__ void cell_scatter(size_t n, const uint32_t *particleCell,
+      uint32_t *cellCursor, uint32_t *particles) {
+    size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n) return;
+    particles[atomicAdd(&cellCursor[particleCell[i]], 1u)] = i;
+  }
+
+  // Largest squared distance between pos & from, as float bits (which
+  // order like the floats, for non-negative values) atomically maxed into
+  // *result
+  __global__ void max_displacement(ParticleData_d pos, ParticleData_d from,
+      size_t n, uint32_t *result) {
+    __shared__ float smem[DISPLACEMENT_THREADS];
+    float local = 0;
+    for (size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < n;
+        i += blockDim.x * gridDim.x) {
+      vec3 d(pos.x[i] - from.x[i], pos.y[i] - from.y[i],
+          pos.z[i] - from.z[i]);
+      local = fmaxf(local, dot(d, d));
+    }
+    smem[threadIdx.x] = local;
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+      if (threadIdx.x < stride) {
+        smem[threadIdx.x] =
+          fmaxf(smem[threadIdx.x], smem[threadIdx.x + stride]);
+      }
+      __syncthreads();
+    }
+    if (threadIdx.x == 0) atomicMax(result, __float_as_uint(smem[0]));
+  }
+
+  CellList::CellList(size_t n_) : n(n_), builtPos(n_) {
+    gpuErrchk(cudaMalloc((void **)&particleCell, sizeof(uint32_t) * n));
+    gpuErrchk(cudaMalloc((void **)&particles, sizeof(uint32_t) * n));
+    gpuErrchk(cudaMalloc((void **)&maxDispSqr, sizeof(uint32_t)));
+  }
+
+  CellList::~CellList() {
+    cudaFree(particleCell);
+    cudaFree(particles);
+    cudaFree(cellStart);
+    cudaFree(cellCursor);
+    cudaFree(scanScratch);
+    cudaFree(builtPos.x);
+    cudaFree(builtPos.y);
+    cudaFree(builtPos.z);
+    cudaFree(maxDispSqr);
+  }
+
+  void CellList::build(const ParticleData_d &pos, coords_t cellSize) {
+    Bounds b = computeBounds(pos, n);
+    vec3 extent = b.max - b.min;
+
+    // Widen the cells if the grid would be unreasonably large
+    coords_t maxExtent = std::max({extent.x, extent.y, extent.z});
+    cellSize = std::max(cellSize, maxExtent / MAX_CELLS_PER_AXIS);
+    int dims[3];
+    auto gridSize = [&]() {
+      coords_t e[3] = {extent.x, extent.y, extent.z};
+      size_t total = 1;
+      for (int a = 0; a < 3; a++) {
+        dims[a] = std::clamp<int>(std::ceil(e[a] / cellSize), 1,
+            MAX_CELLS_PER_AXIS);
+        total *= dims[a];
+      }
+      return total;
+    };
+    size_t numCells = gridSize();
+    while (numCells > MAX_CELLS) {
+      cellSize *= 1.25;
+      numCells = gridSize();
+    }
+
+    if (numCells + 1 > cellCapacity) {
+      cudaFree(cellStart);
+      cudaFree(cellCursor);
+      cudaFree(scanScratch);
+      cellCapacity = numCells + 1;
+      gpuErrchk(cudaMalloc((void **)&cellStart,
+            sizeof(uint32_t) * cellCapacity));
+      gpuErrchk(cudaMalloc((void **)&cellCursor,
+            sizeof(uint32_t) * cellCapacity));
+      gpuErrchk(cudaMalloc((void **)&scanScratch,
+            sizeof(uint32_t) * scanScratchSize(cellCapacity)));
+    }
+
+    grid.origin = b.min;
+    grid.invCellSize = coords_t(1) / cellSize;
+    grid.dimX = dims[0];
+    grid.dimY = dims[1];
+    grid.dimZ = dims[2];
+    grid.cellStart = cellStart;
+    grid.particles = particles;
+
+    const int threads = 256;
+    const int blocks = (n + threads - 1) / threads;
+    gpuErrchk(cudaMemset(cellCursor, 0, (numCells + 1) * sizeof(uint32_t)));
+    cell_count<<<blocks, threads>>>(pos, n, grid, particleCell, cellCursor);
+
+    // Offsets of each cell, with the extra last entry holding n
+    exclusiveScan(cellCursor, cellStart, numCells + 1, scanScratch);
+    gpuErrchk(cudaMemcpy(cellCursor, cellStart,
+          (numCells + 1) * sizeof(uint32_t), cudaMemcpyDeviceToDevice));
+
+    cell_scatter<<<blocks, threads>>>(n, particleCell, cellCursor,
+        particles);
+
+    const coords_t *src[3] = {pos.x, pos.y, pos.z};
+    coords_t *dst[3] = {builtPos.x, builtPos.y, builtPos.z};
+    for (int a = 0; a < 3; a++) {
+      gpuErrchk(cudaMemcpy(dst[a], src[a], n * sizeof(coords_t),
+            cudaMemcpyDeviceToDevice));
+    }
+    built = true;
+  }
+
+  coords_t CellList::maxDisplacement(const ParticleData_d &pos) {
+    if (!built) return INFINITY;
+    gpuErrchk(cudaMemset(maxDispSqr, 0, sizeof(uint32_t)));
+    max_displacement<<<DISPLACEMENT_BLOCKS, DISPLACEMENT_THREADS>>>(pos,
+        builtPos, n, maxDispSqr);
+    uint32_t bits;
+    gpuErrchk(cudaMemcpy(&bits, maxDispSqr, sizeof(bits),
+          cudaMemcpyDeviceToHost));
+    float distSqr;
+    std::memcpy(&distSqr, &bits, sizeof(distSqr));
+    return std::sqrt(distSqr);
+  }
+
+  /* Short range interaction, truncated at the cutoff radius. Only the 27
+     cells around the particle are searched.
+   */
+  template <typename accum_t>
+    __global__ void cutoff_interaction(ParticleData_d pPos,
+        ParticleData_d pNextPos, ParticleData_d pVel,
+        InteractionConstants k, CellGrid grid, coords_t cutoffSqr) {
+      int id = threadIdx.x + (blockIdx.x * blockDim.x);
+      if (id >= k.numParticles) return;
+
+      accum_t force;
+      vec3 pos(pPos.x[id], pPos.y[id], pPos.z[id]);
+      int cx = grid.cellCoord(pos.x, grid.origin.x, grid.dimX);
+      int cy = grid.cellCoord(pos.y, grid.origin.y, grid.dimY);
+      int cz = grid.cellCoord(pos.z, grid.origin.z, grid.dimZ);
+
+      for (int z = max(cz - 1, 0); z <= min(cz + 1, grid.dimZ - 1); z++) {
+        for (int y = max(cy - 1, 0); y <= min(cy + 1, grid.dimY - 1); y++) {
+          for (int x = max(cx - 1, 0); x <= min(cx + 1, grid.dimX - 1);
+              x++) {
+            int c = grid.cellIndex(x, y, z);
+            for (uint32_t s = grid.cellStart[c];
+                s < grid.cellStart[c + 1]; s++) {
+              int i = grid.particles[s];
+              vec3 other_pos{pPos.x[i], pPos.y[i], pPos.z[i]};
+              vec3 r = other_pos - pos;
+              coords_t r_sqr = dot(r, r);
+              if (i == id || r_sqr >= cutoffSqr) continue;
+              coords_t dist_sqr = r_sqr + k.distEps;
+              force.add(r * rsqrt(dist_sqr * dist_sqr * dist_sqr));
+            }
+          }
+        }
+      }
+
+      integrate(pPos, pNextPos, pVel, k, id, force.get());
+    }
+
+  void launchCutoffInteraction(ParticleData_d pos_d,
+      ParticleData_d pos_next_d, ParticleData_d vel_d,
+      const SimParam &params, const CellGrid &grid, int nblocks,
+      int wg_size) {
+    InteractionConstants k = makeInteractionConstants(params);
+    coords_t cutoffSqr = params.cutoff * params.cutoff;
+    dispatchAccumulator(params.accumMethod, [&](auto accum) {
+        cutoff_interaction<decltype(accum)><<<nblocks, wg_size>>>(pos_d,
+            pos_next_d, vel_d, k, grid, cutoffSqr);
+        });
+  }
+
+}  // namespace simulation
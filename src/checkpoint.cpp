@@ -0,0 +1,448 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+constexpr uint32_t HEADER_SIZE = 64;
+constexpr uint32_t SECTION_ENTRY_SIZE = 32;
+// A page, so sections can be mapped & pinned individually
+constexpr uint32_t SECTION_ALIGNMENT = 4096;
+
+constexpr bool hostIsLittleEndian() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return false;
+#else
+  return true;
+#endif
+}
+
+uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Writes all of data at offset, retrying short writes
+bool writeAt(int fd, const char *data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, data, size, offset);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+// Reverses the byte order of each elementSize byte element, in place
+void swapElements(char *data, size_t bytes, size_t elementSize) {
+  for (size_t i = 0; i + elementSize <= bytes; i += elementSize) {
+    std::reverse(data + i, data + i + elementSize);
+  }
+}
+
+// Appends little-endian values to a byte buffer
+class ByteWriter {
+  public:
+    template <typename T>
+    void put(T value) {
+      static_assert(std::is_arithmetic<T>::value, "put needs a number");
+      char bytes[sizeof(T)];
+      std::memcpy(bytes, &value, sizeof(T));
+      if (!hostIsLittleEndian()) std::reverse(bytes, bytes + sizeof(T));
+      buf.insert(buf.end(), bytes, bytes + sizeof(T));
+    }
+
+    void putBytes(const void *data, size_t n) {
+      const char *p = static_cast<const char *>(data);
+      buf.insert(buf.end(), p, p + n);
+    }
+
+    std::vector<char> buf;
+};
+
+// Reads little-endian values from a byte buffer
+class ByteReader {
+  public:
+    ByteReader(const char *data_, size_t size_) : data(data_), size(size_) {}
+
+    template <typename T>
+    T get() {
+      char bytes[sizeof(T)];
+      std::memcpy(bytes, take(sizeof(T)), sizeof(T));
+      if (!hostIsLittleEndian()) std::reverse(bytes, bytes + sizeof(T));
+      T value;
+      std::memcpy(&value, bytes, sizeof(T));
+      return value;
+    }
+
+    const char *take(size_t n) {
+      if (pos + n > size) throw std::runtime_error("Truncated checkpoint");
+      const char *p = data + pos;
+      pos += n;
+      return p;
+    }
+
+    bool done() const { return pos == size; }
+
+  private:
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+};
+
+/*
+   SimParam fields are stored as (name, value) records, so that fields added
+   later keep older checkpoints readable: missing names keep their default,
+   unknown names are skipped. Each record is
+     u32 name length, name, u32 value length, value
+   with enums stored as i32, bool as u8 & strings as raw bytes.
+ */
+template <typename Params, typename F>
+void forEachParam(Params &p, F &&f) {
+  f("G", p.G);
+  f("dt", p.dt);
+  f("numParticles", p.numParticles);
+  f("numFrames", p.numFrames);
+  f("simIterationsPerFrame", p.simIterationsPerFrame);
+  f("damping", p.damping);
+  f("distEps", p.distEps);
+  f("gwSize", p.gwSize);
+  f("calcMethod", p.calcMethod);
+  f("accumMethod", p.accumMethod);
+  f("specialize", p.specialize);
+  f("reorderInterval", p.reorderInterval);
+  f("solver", p.solver);
+  f("cutoff", p.cutoff);
+  f("cellSkin", p.cellSkin);
+  f("cellRebuildInterval", p.cellRebuildInterval);
+  f("boxSize", p.boxSize);
+  f("pmGrid", p.pmGrid);
+  f("pmSplit", p.pmSplit);
+  f("treeTheta", p.treeTheta);
+  f("devicePartition", p.devicePartition);
+  f("deviceExchange", p.deviceExchange);
+  f("virtualDevices", p.virtualDevices);
+  f("transport", p.transport);
+  f("rank", p.rank);
+  f("numRanks", p.numRanks);
+  f("shmName", p.shmName);
+  f("shmToken", p.shmToken);
+  f("streamTile", p.streamTile);
+  f("streamPool", p.streamPool);
+  f("checkpointFile", p.checkpointFile);
+  f("checkpointEvery", p.checkpointEvery);
+  f("restartFile", p.restartFile);
+  f("snapshotEvery", p.snapshotEvery);
+  f("snapshotPrefix", p.snapshotPrefix);
+  f("snapshotBuffers", p.snapshotBuffers);
+  f("trajectoryFile", p.trajectoryFile);
+  f("trajectoryEvery", p.trajectoryEvery);
+  f("trajPosError", p.trajPosError);
+  f("trajVelError", p.trajVelError);
+  f("trajKeyframe", p.trajKeyframe);
+  f("icFile", p.icFile);
+  f("icFormat", p.icFormat);
+  f("profile", p.profile);
+  f("seed", p.seed);
+  f("icCache", p.icCache);
+  f("model", p.model);
+  f("modelScale", p.modelScale);
+  f("concentration", p.concentration);
+  f("haloFraction", p.haloFraction);
+  f("collisionDistance", p.collisionDistance);
+  f("collisionImpact", p.collisionImpact);
+  f("timings", p.timings);
+  f("statsEvery", p.statsEvery);
+  f("traceFile", p.traceFile);
+  f("autotune", p.autotune);
+  f("tuneCache", p.tuneCache);
+  f("diagEvery", p.diagEvery);
+}
+
+template <typename T>
+void putValue(ByteWriter &w, const T &value) {
+  if constexpr (std::is_same<T, std::string>::value) {
+    w.putBytes(value.data(), value.size());
+  } else if constexpr (std::is_same<T, bool>::value) {
+    w.put<uint8_t>(value);
+  } else if constexpr (std::is_enum<T>::value) {
+    w.put<int32_t>(static_cast<int32_t>(value));
+  } else if constexpr (std::is_same<T, size_t>::value) {
+    w.put<uint64_t>(value);
+  } else {
+    w.put<T>(value);
+  }
+}
+
+template <typename T>
+void getValue(ByteReader &r, T &value) {
+  if constexpr (std::is_same<T, bool>::value) {
+    value = r.get<uint8_t>() != 0;
+  } else if constexpr (std::is_enum<T>::value) {
+    value = static_cast<T>(r.get<int32_t>());
+  } else if constexpr (std::is_same<T, size_t>::value) {
+    value = r.get<uint64_t>();
+  } else {
+    value = r.get<T>();
+  }
+}
+
+std::vector<char> encodeParams(const SimParam &params) {
+  ByteWriter w;
+  forEachParam(params, [&](const char *name, const auto &value) {
+      ByteWriter v;
+      putValue(v, value);
+      w.put<uint32_t>(std::strlen(name));
+      w.putBytes(name, std::strlen(name));
+      w.put<uint32_t>(v.buf.size());
+      w.putBytes(v.buf.data(), v.buf.size());
+      });
+  return w.buf;
+}
+
+SimParam decodeParams(const std::vector<char> &bytes) {
+  SimParam params;
+  ByteReader r(bytes.data(), bytes.size());
+  while (!r.done()) {
+    uint32_t nameSize = r.get<uint32_t>();
+    std::string name(r.take(nameSize), nameSize);
+    uint32_t valueSize = r.get<uint32_t>();
+    const char *value = r.take(valueSize);
+    forEachParam(params, [&](const char *field, auto &dst) {
+        if (name != field) return;
+        using T = std::decay_t<decltype(dst)>;
+        if constexpr (std::is_same<T, std::string>::value) {
+          dst.assign(value, valueSize);
+        } else {
+          ByteReader v(value, valueSize);
+          getValue(v, dst);
+        }
+        });
+  }
+  return params;
+}
+
+}  // namespace
+
+void writeCheckpoint(const std::string &path, const CheckpointData &data) {
+  const uint64_t n = data.params->numParticles;
+  struct Pending {
+    CheckpointSection id;
+    uint32_t elementSize;
+    const void *data;
+    uint64_t size;
+  };
+  std::vector<char> params = encodeParams(*data.params);
+  std::vector<Pending> pending = {
+    {CheckpointSection::PARAMS, 1, params.data(), params.size()},
+    {CheckpointSection::RNG, 1, data.rngState.data(), data.rngState.size()},
+    {CheckpointSection::POS_X, 4, data.pos[0], n * 4},
+    {CheckpointSection::POS_Y, 4, data.pos[1], n * 4},
+    {CheckpointSection::POS_Z, 4, data.pos[2], n * 4},
+    {CheckpointSection::VEL_X, 4, data.vel[0], n * 4},
+    {CheckpointSection::VEL_Y, 4, data.vel[1], n * 4},
+    {CheckpointSection::VEL_Z, 4, data.vel[2], n * 4}};
+  if (data.ids) {
+    pending.push_back({CheckpointSection::IDS, 4, data.ids, n * 4});
+  }
+
+  // Lay out the sections after the header & section table
+  const uint64_t tableOffset = HEADER_SIZE;
+  uint64_t offset = alignUp(tableOffset +
+      pending.size() * SECTION_ENTRY_SIZE, SECTION_ALIGNMENT);
+  std::vector<uint64_t> offsets;
+  for (const auto &s : pending) {
+    offsets.push_back(offset);
+    offset = alignUp(offset + s.size, SECTION_ALIGNMENT);
+  }
+  const uint64_t fileSize = offset;
+
+  ByteWriter head;
+  head.putBytes(MAGIC, sizeof(MAGIC));
+  head.put<uint32_t>(CHECKPOINT_VERSION);
+  head.put<uint32_t>(HEADER_SIZE);
+  head.put<uint64_t>(n);
+  head.put<uint64_t>(data.step);
+  head.put<uint32_t>(pending.size());
+  head.put<uint32_t>(SECTION_ALIGNMENT);
+  head.put<uint64_t>(tableOffset);
+  head.put<uint64_t>(fileSize);
+  head.put<uint64_t>(0);
+  for (size_t i = 0; i < pending.size(); i++) {
+    head.put<uint32_t>(static_cast<uint32_t>(pending[i].id));
+    head.put<uint32_t>(pending[i].elementSize);
+    head.put<uint64_t>(offsets[i]);
+    head.put<uint64_t>(pending[i].size);
+    head.put<uint64_t>(0);
+  }
+
+  // The header, table & each section go out in single large writes, in
+  // file order; the gaps between sections are left as holes
+  const std::string tmpPath = path + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("Can't open " + tmpPath);
+  bool ok = writeAt(fd, head.buf.data(), head.buf.size(), 0);
+  std::vector<char> swapped;
+  for (size_t i = 0; ok && i < pending.size(); i++) {
+    const char *bytes = static_cast<const char *>(pending[i].data);
+    if (!hostIsLittleEndian() && pending[i].elementSize > 1) {
+      swapped.assign(bytes, bytes + pending[i].size);
+      swapElements(swapped.data(), swapped.size(), pending[i].elementSize);
+      bytes = swapped.data();
+    }
+    ok = writeAt(fd, bytes, pending[i].size, offsets[i]);
+  }
+  // Pad the last section, so the file size matches the header
+  ok = ok && ftruncate(fd, fileSize) == 0;
+  if (close(fd) != 0 || !ok) {
+    std::remove(tmpPath.c_str());
+    throw std::runtime_error("Error writing " + tmpPath);
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Can't rename " + tmpPath + " to " + path);
+  }
+}
+
+CheckpointReader::CheckpointReader(const std::string &path_)
+  : path(path_) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st {};
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) close(fd);
+    throw std::runtime_error("Can't open checkpoint " + path);
+  }
+  mappingSize = st.st_size;
+  void *mem = mappingSize < HEADER_SIZE ? MAP_FAILED :
+    mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) throw std::runtime_error(path + " is not a checkpoint");
+  mapping = static_cast<const char *>(mem);
+
+  if (std::memcmp(mapping, MAGIC, sizeof(MAGIC)) != 0) {
+    munmap(mem, mappingSize);
+    throw std::runtime_error(path + " is not a checkpoint");
+  }
+  ByteReader r(mapping + sizeof(MAGIC), HEADER_SIZE - sizeof(MAGIC));
+  // Version 1 only differs in its smaller section alignment & version 2 in
+  // holding mt19937 state as its RNG text, which is only informative
+  uint32_t version = r.get<uint32_t>();
+  if (version < 1 || version > CHECKPOINT_VERSION) {
+    munmap(mem, mappingSize);
+    throw std::runtime_error(path + " has checkpoint version " +
+        std::to_string(version) + ", expected at most " +
+        std::to_string(CHECKPOINT_VERSION));
+  }
+  r.get<uint32_t>();  // header size
+  uint64_t n = r.get<uint64_t>();
+  savedStep = r.get<uint64_t>();
+  uint32_t numSections = r.get<uint32_t>();
+  r.get<uint32_t>();  // alignment
+  uint64_t tableOffset = r.get<uint64_t>();
+
+  try {
+    uint64_t tableSize = uint64_t(numSections) * SECTION_ENTRY_SIZE;
+    if (tableOffset + tableSize > mappingSize) {
+      throw std::runtime_error("Truncated checkpoint " + path);
+    }
+    ByteReader t(mapping + tableOffset, tableSize);
+    for (uint32_t i = 0; i < numSections; i++) {
+      Section s;
+      s.id = t.get<uint32_t>();
+      s.elementSize = t.get<uint32_t>();
+      s.offset = t.get<uint64_t>();
+      s.size = t.get<uint64_t>();
+      t.get<uint64_t>();
+      if (s.offset + s.size > mappingSize) {
+        throw std::runtime_error("Truncated checkpoint " + path);
+      }
+      sections.push_back(s);
+    }
+
+    const Section &params = find(CheckpointSection::PARAMS);
+    savedParams = decodeParams(std::vector<char>(mapping + params.offset,
+          mapping + params.offset + params.size));
+    if (savedParams.numParticles != n) {
+      throw std::runtime_error("Inconsistent particle count in " + path);
+    }
+    const Section &rng = find(CheckpointSection::RNG);
+    savedRng.assign(mapping + rng.offset, rng.size);
+  } catch (...) {
+    munmap(mem, mappingSize);
+    throw;
+  }
+}
+
+CheckpointReader::~CheckpointReader() {
+  munmap(const_cast<char *>(mapping), mappingSize);
+}
+
+bool CheckpointReader::has(CheckpointSection id) const {
+  return std::any_of(sections.begin(), sections.end(),
+      [&](const Section &s) { return s.id == static_cast<uint32_t>(id); });
+}
+
+const CheckpointReader::Section &CheckpointReader::find(
+    CheckpointSection id) const {
+  for (const auto &s : sections) {
+    if (s.id == static_cast<uint32_t>(id)) return s;
+  }
+  throw std::runtime_error("Checkpoint " + path + " has no section " +
+      std::to_string(static_cast<uint32_t>(id)));
+}
+
+const CheckpointReader::Section &CheckpointReader::findArray(
+    CheckpointSection id) const {
+  const Section &s = find(id);
+  if (s.size != numParticles() * s.elementSize) {
+    throw std::runtime_error("Unexpected section size in " + path);
+  }
+  return s;
+}
+
+void CheckpointReader::read(CheckpointSection id, void *dst) const {
+  const Section &s = findArray(id);
+  std::memcpy(dst, mapping + s.offset, s.size);
+  if (!hostIsLittleEndian()) {
+    swapElements(static_cast<char *>(dst), s.size, s.elementSize);
+  }
+}
+
+const void *CheckpointReader::data(CheckpointSection id) const {
+  const Section &s = findArray(id);
+  return hostIsLittleEndian() ? mapping + s.offset : nullptr;
+}
+
+SimParam withRestartParams(const SimParam &params) {
+  if (params.restartFile.empty()) return params;
+  const SimParam saved = CheckpointReader(params.restartFile).params();
+  SimParam result = params;
+  result.numParticles = saved.numParticles;
+  result.G = saved.G;
+  result.dt = saved.dt;
+  result.damping = saved.damping;
+  result.distEps = saved.distEps;
+  result.solver = saved.solver;
+  result.cutoff = saved.cutoff;
+  result.boxSize = saved.boxSize;
+  result.pmGrid = saved.pmGrid;
+  result.pmSplit = saved.pmSplit;
+  result.treeTheta = saved.treeTheta;
+  result.seed = saved.seed;
+  return result;
+}
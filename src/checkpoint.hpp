@@ -0,0 +1,130 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sim_param.hpp"
+
+/**
+ * Binary checkpoint of the simulation state. All values are little-endian.
+ *
+ * The file starts with a 64 byte header:
+ *   0  char[8] magic "NBODYCKP"
+ *   8  u32     format version (CHECKPOINT_VERSION)
+ *   12 u32     header size (64)
+ *   16 u64     number of particles
+ *   24 u64     integration step
+ *   32 u32     number of sections
+ *   36 u32     section alignment
+ *   40 u64     offset of the section table
+ *   48 u64     file size
+ *   56 u64     reserved (0)
+ * followed by a table of 32 byte section entries
+ *   0  u32     section id (CheckpointSection)
+ *   4  u32     element size in bytes
+ *   8  u64     offset from the start of the file
+ *   16 u64     size in bytes
+ *   24 u64     reserved (0)
+ * Every section starts at a multiple of the section alignment, a page
+ * since version 2, so the particle arrays can be mapped & used in place as
+ * SoA arrays (or registered as pinned memory for device copies).
+ */
+
+constexpr uint32_t CHECKPOINT_VERSION = 3;
+
+enum class CheckpointSection : uint32_t {
+  PARAMS = 1,  ///< SimParam, as (name, value) records
+  RNG = 2,     ///< Initial condition generator & seed, as text
+  POS_X = 3,
+  POS_Y = 4,
+  POS_Z = 5,
+  VEL_X = 6,
+  VEL_Y = 7,
+  VEL_Z = 8,
+  IDS = 9      ///< uint32 original index of each particle slot
+};
+
+/**
+ * Simulation state to checkpoint. The arrays hold numParticles elements.
+ */
+struct CheckpointData {
+  const SimParam *params;
+  uint64_t step;
+  std::string rngState;
+  const float *pos[3];
+  const float *vel[3];
+  const uint32_t *ids;  ///< May be nullptr
+};
+
+/**
+ * Writes a checkpoint to path. The file is written under a temporary name
+ * & renamed over path, so an interrupted write never replaces a good
+ * checkpoint.
+ */
+void writeCheckpoint(const std::string &path, const CheckpointData &data);
+
+/**
+ * Reads a checkpoint written by writeCheckpoint, by mapping the file into
+ * memory. The constructor checks the header & decodes the parameters &
+ * RNG state, the particle arrays are only paged in when used.
+ */
+class CheckpointReader {
+  public:
+    explicit CheckpointReader(const std::string &path);
+    ~CheckpointReader();
+
+    CheckpointReader(const CheckpointReader &) = delete;
+    CheckpointReader &operator=(const CheckpointReader &) = delete;
+
+    const SimParam &params() const { return savedParams; }
+    uint64_t step() const { return savedStep; }
+    const std::string &rngState() const { return savedRng; }
+    size_t numParticles() const { return savedParams.numParticles; }
+    bool has(CheckpointSection id) const;
+
+    /**
+     * Copies a particle array section into dst, which must hold
+     * numParticles elements of the section's type
+     */
+    void read(CheckpointSection id, void *dst) const;
+
+    /**
+     * A particle array section in place in the mapping, valid while the
+     * reader lives
+     * @return nullptr on big-endian hosts, where the data needs swapping
+     */
+    const void *data(CheckpointSection id) const;
+
+  private:
+    struct Section {
+      uint32_t id;
+      uint32_t elementSize;
+      uint64_t offset;
+      uint64_t size;
+    };
+
+    const Section &find(CheckpointSection id) const;
+    const Section &findArray(CheckpointSection id) const;
+
+    std::string path;
+    const char *mapping = nullptr;
+    size_t mappingSize = 0;
+    SimParam savedParams;
+    uint64_t savedStep;
+    std::string savedRng;
+    std::vector<Section> sections;
+};
+
+/**
+ * params with the physical parameters (particle count, G, dt, damping,
+ * distEps & solver settings) replaced by those saved in
+ * params.restartFile, if set. Run controls such as the frame count, work
+ * group size & kernel variants still come from params.
+ */
+SimParam withRestartParams(const SimParam &params);
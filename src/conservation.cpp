@@ -0,0 +1,79 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "conservation.hpp"
+#include "parallel.hpp"
+
+#include <cmath>
+#include <vector>
+
+namespace {
+
+double norm(const double v[3]) {
+  return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+double distance(const double a[3], const double b[3]) {
+  const double d[3] = {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+  return norm(d);
+}
+
+// Relative to the initial magnitude, or absolute if that is zero
+double drift(double now, double initial) {
+  return initial != 0 ? (now - initial) / std::fabs(initial) : now - initial;
+}
+
+}  // namespace
+
+Conserved conservedOnHost(const float *const pos[3], const float *const vel[3],
+    size_t n, float G, float distEps) {
+  std::vector<Conserved> partial(numHostThreads());
+  parallelRanges(n, [&](size_t begin, size_t end, size_t chunk) {
+      Conserved &c = partial[chunk];
+      for (size_t i = begin; i < end; i++) {
+        const double p[3] = {pos[0][i], pos[1][i], pos[2][i]};
+        const double v[3] = {vel[0][i], vel[1][i], vel[2][i]};
+        // Each pair is visited from both ends, so counts half each time
+        double phi = 0;
+        for (size_t j = 0; j < n; j++) {
+          if (j == i) continue;
+          const double r[3] = {pos[0][j] - p[0], pos[1][j] - p[1],
+            pos[2][j] - p[2]};
+          phi += 1 / std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2] +
+              distEps);
+        }
+        c.kinetic += 0.5 * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        c.potential -= 0.5 * G * phi;
+        for (int a = 0; a < 3; a++) c.momentum[a] += v[a];
+        c.angularMomentum[0] += p[1] * v[2] - p[2] * v[1];
+        c.angularMomentum[1] += p[2] * v[0] - p[0] * v[2];
+        c.angularMomentum[2] += p[0] * v[1] - p[1] * v[0];
+      }
+      });
+
+  Conserved total;
+  for (const Conserved &c : partial) {
+    total.kinetic += c.kinetic;
+    total.potential += c.potential;
+    for (int a = 0; a < 3; a++) {
+      total.momentum[a] += c.momentum[a];
+      total.angularMomentum[a] += c.angularMomentum[a];
+    }
+  }
+  return total;
+}
+
+void ConservationMonitor::report(std::ostream &out, size_t step,
+    const Conserved &now) const {
+  const double angular = norm(initial.angularMomentum);
+  out << "At step " << step << " energy is " << now.energy()
+    << " (kinetic " << now.kinetic << ", potential " << now.potential
+    << "), drift " << drift(now.energy(), initial.energy())
+    << "; momentum drift " << distance(now.momentum, initial.momentum)
+    << "; angular momentum drift "
+    << (angular > 0 ?
+        distance(now.angularMomentum, initial.angularMomentum) / angular :
+        distance(now.angularMomentum, initial.angularMomentum))
+    << "\n";
+}
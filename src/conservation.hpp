@@ -0,0 +1,50 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+/**
+ * Quantities the integrator should conserve, for unit masses. The
+ * potential is the softened pairwise sum -G / sqrt(r^2 + distEps) that
+ * particle_interaction takes the gradient of, over every pair.
+ */
+struct Conserved {
+  double kinetic = 0;
+  double potential = 0;
+  double momentum[3] = {0, 0, 0};
+  double angularMomentum[3] = {0, 0, 0};  ///< About the origin
+
+  double energy() const { return kinetic + potential; }
+};
+
+/**
+ * Conserved quantities of n particles in host memory, summed in double
+ * precision on host threads. O(n^2), for layouts without every particle
+ * on one device.
+ */
+Conserved conservedOnHost(const float *const pos[3], const float *const vel[3],
+    size_t n, float G, float distEps);
+
+/**
+ * Reports how far the conserved quantities have drifted from their
+ * initial values
+ */
+class ConservationMonitor {
+  public:
+    explicit ConservationMonitor(const Conserved &initial_)
+      : initial(initial_) {}
+
+    /**
+     * Prints energy & angular momentum drift relative to the initial
+     * values, & momentum drift as an absolute value (the initial momentum
+     * is typically near zero)
+     */
+    void report(std::ostream &out, size_t step, const Conserved &now) const;
+
+  private:
+    Conserved initial;
+};
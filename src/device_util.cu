@@ -0,0 +1,215 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "device_util.cuh"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace simulation {
+
+  namespace {
+    constexpr int RADIX_BITS = 4;
+    constexpr uint32_t RADIX = 1u << RADIX_BITS;
+
+    // Elements handled serially by one thread in the sort & scan
+    constexpr size_t SORT_TILE = 256;
+    constexpr size_t SCAN_CHUNK = 1024;
+
+    constexpr int BOUNDS_BLOCKS = 256;
+    constexpr int BOUNDS_THREADS = 256;
+
+    inline int numBlocks(size_t n, int threads) {
+      return static_cast<int>((n + threads - 1) / threads);
+    }
+  }  // namespace
+
+  // Per block bounds, written as 6 values (min xyz, max xyz) per block
+  __global__ void bounds_kernel(ParticleData_d pos, size_t n,
+      coords_t *partial) {
+    __shared__ coords_t smem[6][BOUNDS_THREADS];
+    coords_t lo[3] = {3.4e38f, 3.4e38f, 3.4e38f};
+    coords_t hi[3] = {-3.4e38f, -3.4e38f, -3.4e38f};
+    for (size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < n;
+        i += blockDim.x * gridDim.x) {
+      lo[0] = fminf(lo[0], pos.x[i]);
+      lo[1] = fminf(lo[1], pos.y[i]);
+      lo[2] = fminf(lo[2], pos.z[i]);
+      hi[0] = fmaxf(hi[0], pos.x[i]);
+      hi[1] = fmaxf(hi[1], pos.y[i]);
+      hi[2] = fmaxf(hi[2], pos.z[i]);
+    }
+    for (int a = 0; a < 3; a++) {
+      smem[a][threadIdx.x] = lo[a];
+      smem[a + 3][threadIdx.x] = hi[a];
+    }
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+      if (threadIdx.x < stride) {
+        for (int a = 0; a < 3; a++) {
+          smem[a][threadIdx.x] =
+            fminf(smem[a][threadIdx.x], smem[a][threadIdx.x + stride]);
+          smem[a + 3][threadIdx.x] = fmaxf(smem[a + 3][threadIdx.x],
+              smem[a + 3][threadIdx.x + stride]);
+        }
+      }
+      __syncthreads();
+    }
+    if (threadIdx.x < 6) {
+      partial[blockIdx.x * 6 + threadIdx.x] = smem[threadIdx.x][0];
+    }
+  }
+
+  __global__ void scan_chunk_totals(const uint32_t *in, size_t n,
+      size_t chunks, uint32_t *scratch) {
+    size_t c = blockIdx.x * blockDim.x + threadIdx.x;
+    if (c >= chunks) return;
+    size_t begin = c * SCAN_CHUNK;
+    size_t end = min(begin + SCAN_CHUNK, n);
+    uint32_t sum = 0;
+    for (size_t i = begin; i < end; i++) sum += in[i];
+    scratch[c] = sum;
+  }
+
+  __global__ void scan_chunk_offsets(size_t chunks, uint32_t *scratch) {
+    uint32_t sum = 0;
+    for (size_t c = 0; c < chunks; c++) {
+      uint32_t total = scratch[c];
+      scratch[c] = sum;
+      sum += total;
+    }
+  }
+
+  __global__ void scan_chunks(const uint32_t *in, uint32_t *out, size_t n,
+      size_t chunks, const uint32_t *scratch) {
+    size_t c = blockIdx.x * blockDim.x + threadIdx.x;
+    if (c >= chunks) return;
+    size_t begin = c * SCAN_CHUNK;
+    size_t end = min(begin + SCAN_CHUNK, n);
+    uint32_t sum = scratch[c];
+    for (size_t i = begin; i < end; i++) {
+      uint32_t v = in[i];
+      out[i] = sum;
+      sum += v;
+    }
+  }
+
+  // Per tile digit counts, stored digit major so that a single exclusive
+  // scan yields every tile's output offset per digit
+  __global__ void radix_histogram(const uint32_t *keys, size_t n,
+      size_t tiles, int shift, uint32_t *hist) {
+    size_t t = blockIdx.x * blockDim.x + threadIdx.x;
+    if (t >= tiles) return;
+    uint32_t counts[RADIX] = {};
+    size_t begin = t * SORT_TILE;
+    size_t end = min(begin + SORT_TILE, n);
+    for (size_t i = begin; i < end; i++) {
+      counts[(keys[i] >> shift) & (RADIX - 1)]++;
+    }
+    for (uint32_t d = 0; d < RADIX; d++) hist[d * tiles + t] = counts[d];
+  }
+
+  // Scatter, in order within each tile
+  __global__ void radix_scatter(const uint32_t *keysIn,
+      const uint32_t *valsIn, uint32_t *keysOut, uint32_t *valsOut,
+      size_t n, size_t tiles, int shift, const uint32_t *hist) {
+    size_t t = blockIdx.x * blockDim.x + threadIdx.x;
+    if (t >= tiles) return;
+    uint32_t offsets[RADIX];
+    for (uint32_t d = 0; d < RADIX; d++) offsets[d] = hist[d * tiles + t];
+    size_t begin = t * SORT_TILE;
+    size_t end = min(begin + SORT_TILE, n);
+    for (size_t i = begin; i < end; i++) {
+      uint32_t key = keysIn[i];
+      uint32_t dst = offsets[(key >> shift) & (RADIX - 1)]++;
+      keysOut[dst] = key;
+      valsOut[dst] = valsIn[i];
+    }
+  }
+
+  Bounds computeBounds(const ParticleData_d &pos, size_t n) {
+    coords_t *partial_d;
+    gpuErrchk(cudaMalloc((void **)&partial_d,
+          sizeof(coords_t) * 6 * BOUNDS_BLOCKS));
+    bounds_kernel<<<BOUNDS_BLOCKS, BOUNDS_THREADS>>>(pos, n, partial_d);
+    std::vector<coords_t> partial(6 * BOUNDS_BLOCKS);
+    gpuErrchk(cudaMemcpy(partial.data(), partial_d,
+          sizeof(coords_t) * partial.size(), cudaMemcpyDeviceToHost));
+    gpuErrchk(cudaFree(partial_d));
+
+    Bounds b{{partial[0], partial[1], partial[2]},
+      {partial[3], partial[4], partial[5]}};
+    for (int blk = 1; blk < BOUNDS_BLOCKS; blk++) {
+      const coords_t *p = &partial[blk * 6];
+      b.min = {std::min(b.min.x, p[0]), std::min(b.min.y, p[1]),
+        std::min(b.min.z, p[2])};
+      b.max = {std::max(b.max.x, p[3]), std::max(b.max.y, p[4]),
+        std::max(b.max.z, p[5])};
+    }
+    return b;
+  }
+
+  size_t scanScratchSize(size_t n) {
+    return (n + SCAN_CHUNK - 1) / SCAN_CHUNK;
+  }
+
+  void exclusiveScan(const uint32_t *in, uint32_t *out, size_t n,
+      uint32_t *scratch) {
+    if (n == 0) return;
+    const size_t chunks = scanScratchSize(n);
+    scan_chunk_totals<<<numBlocks(chunks, 128), 128>>>(in, n, chunks,
+        scratch);
+    scan_chunk_offsets<<<1, 1>>>(chunks, scratch);
+    scan_chunks<<<numBlocks(chunks, 128), 128>>>(in, out, n, chunks,
+        scratch);
+  }
+
+  RadixSorter::RadixSorter(size_t capacity_) : capacity(capacity_) {
+    const size_t tiles = (capacity + SORT_TILE - 1) / SORT_TILE;
+    gpuErrchk(cudaMalloc((void **)&keysAlt, sizeof(uint32_t) * capacity));
+    gpuErrchk(cudaMalloc((void **)&valsAlt, sizeof(uint32_t) * capacity));
+    gpuErrchk(cudaMalloc((void **)&hist, sizeof(uint32_t) * RADIX * tiles));
+    gpuErrchk(cudaMalloc((void **)&scanScratch,
+          sizeof(uint32_t) * scanScratchSize(RADIX * tiles)));
+  }
+
+  RadixSorter::~RadixSorter() {
+    cudaFree(keysAlt);
+    cudaFree(valsAlt);
+    cudaFree(hist);
+    cudaFree(scanScratch);
+  }
+
+  void RadixSorter::sort(uint32_t *keys, uint32_t *vals, size_t n,
+      int keyBits) {
+    if (n == 0) return;
+    const size_t tiles = (n + SORT_TILE - 1) / SORT_TILE;
+
+    uint32_t *keysIn = keys;
+    uint32_t *valsIn = vals;
+    uint32_t *keysOut = keysAlt;
+    uint32_t *valsOut = valsAlt;
+
+    for (int shift = 0; shift < keyBits; shift += RADIX_BITS) {
+      radix_histogram<<<numBlocks(tiles, 128), 128>>>(keysIn, n, tiles,
+          shift, hist);
+      exclusiveScan(hist, hist, RADIX * tiles, scanScratch);
+      radix_scatter<<<numBlocks(tiles, 128), 128>>>(keysIn, valsIn, keysOut,
+          valsOut, n, tiles, shift, hist);
+      std::swap(keysIn, keysOut);
+      std::swap(valsIn, valsOut);
+    }
+
+    // Odd number of passes leaves the result in the alternate buffers
+    if (keysIn != keys) {
+      gpuErrchk(cudaMemcpy(keys, keysIn, n * sizeof(uint32_t),
+            cudaMemcpyDeviceToDevice));
+      gpuErrchk(cudaMemcpy(vals, valsIn, n * sizeof(uint32_t),
+            cudaMemcpyDeviceToDevice));
+    }
+  }
+
+}  // namespace simulation
@@ -0,0 +1,60 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include "simulator.cuh"
+
+/*
+   Device primitives (reduction, scan & sort) shared by the particle
+   reordering & neighbour search code. All work is issued to the default
+   stream.
+ */
+
+namespace simulation {
+
+  // Axis aligned bounding box
+  struct Bounds {
+    vec3 min;
+    vec3 max;
+  };
+
+  // Bounding box of the first n particles in pos (blocks until complete)
+  Bounds computeBounds(const ParticleData_d &pos, size_t n);
+
+  // Number of uint32_t of scratch space exclusiveScan needs for n elements
+  size_t scanScratchSize(size_t n);
+
+  // Exclusive prefix sum of in[0, n) into out. in & out may alias.
+  void exclusiveScan(const uint32_t *in, uint32_t *out, size_t n,
+      uint32_t *scratch);
+
+  /*
+     Stable LSD radix sort of (key, value) pairs in device memory. Each
+     thread serially handles a fixed size tile, which keeps the scatter
+     stable without needing block level ranking.
+   */
+  class RadixSorter {
+    public:
+      RadixSorter(size_t capacity_);
+      ~RadixSorter();
+
+      RadixSorter(const RadixSorter &) = delete;
+      RadixSorter &operator=(const RadixSorter &) = delete;
+
+      // Sorts keys[0, n) by their low keyBits bits, permuting vals
+      // alongside. n must not exceed the capacity.
+      void sort(uint32_t *keys, uint32_t *vals, size_t n, int keyBits);
+
+    private:
+      size_t capacity;
+      uint32_t *keysAlt = nullptr;
+      uint32_t *valsAlt = nullptr;
+      uint32_t *hist = nullptr;
+      uint32_t *scanScratch = nullptr;
+  };
+
+}  // namespace simulation
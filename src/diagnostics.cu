@@ -0,0 +1,89 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "diagnostics.cuh"
+
+#include <vector>
+
+namespace simulation {
+
+  namespace {
+    constexpr int CONSERVED_BLOCKS = 256;
+    constexpr int CONSERVED_THREADS = 128;
+    // Kinetic & potential energy, momentum xyz, angular momentum xyz
+    constexpr int CONSERVED_TERMS = 8;
+  }  // namespace
+
+  // Per block sums of each particle's conserved terms, written as
+  // CONSERVED_TERMS values per block. The potential is left to be scaled
+  // by G.
+  __global__ void conserved_kernel(ParticleData_d pos, ParticleData_d vel,
+      int n, coords_t distEps, double *partial) {
+    __shared__ double smem[CONSERVED_TERMS][CONSERVED_THREADS];
+    double sum[CONSERVED_TERMS] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < n;
+        i += blockDim.x * gridDim.x) {
+      vec3 p(pos.x[i], pos.y[i], pos.z[i]);
+      vec3 v(vel.x[i], vel.y[i], vel.z[i]);
+      // Each pair is visited from both ends, so counts half each time
+      double phi = 0;
+      for (int j = 0; j < n; j++) {
+        if (j == i) continue;
+        vec3 r = vec3(pos.x[j], pos.y[j], pos.z[j]) - p;
+        phi += rsqrt(dot(r, r) + distEps);
+      }
+      sum[0] += 0.5 * dot(v, v);
+      sum[1] -= 0.5 * phi;
+      sum[2] += v.x;
+      sum[3] += v.y;
+      sum[4] += v.z;
+      sum[5] += p.y * v.z - p.z * v.y;
+      sum[6] += p.z * v.x - p.x * v.z;
+      sum[7] += p.x * v.y - p.y * v.x;
+    }
+    for (int t = 0; t < CONSERVED_TERMS; t++) smem[t][threadIdx.x] = sum[t];
+    __syncthreads();
+    for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+      if (threadIdx.x < stride) {
+        for (int t = 0; t < CONSERVED_TERMS; t++) {
+          smem[t][threadIdx.x] += smem[t][threadIdx.x + stride];
+        }
+      }
+      __syncthreads();
+    }
+    if (threadIdx.x < CONSERVED_TERMS) {
+      partial[blockIdx.x * CONSERVED_TERMS + threadIdx.x] =
+        smem[threadIdx.x][0];
+    }
+  }
+
+  Conserved computeConserved(const ParticleData_d &pos,
+      const ParticleData_d &vel, size_t n, coords_t G, coords_t distEps) {
+    double *partial_d;
+    gpuErrchk(cudaMalloc((void **)&partial_d,
+          sizeof(double) * CONSERVED_TERMS * CONSERVED_BLOCKS));
+    conserved_kernel<<<CONSERVED_BLOCKS, CONSERVED_THREADS>>>(pos, vel, n,
+        distEps, partial_d);
+    std::vector<double> partial(CONSERVED_TERMS * CONSERVED_BLOCKS);
+    gpuErrchk(cudaMemcpy(partial.data(), partial_d,
+          sizeof(double) * partial.size(), cudaMemcpyDeviceToHost));
+    cudaFree(partial_d);
+
+    double sum[CONSERVED_TERMS] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (int b = 0; b < CONSERVED_BLOCKS; b++) {
+      for (int t = 0; t < CONSERVED_TERMS; t++) {
+        sum[t] += partial[b * CONSERVED_TERMS + t];
+      }
+    }
+    Conserved c;
+    c.kinetic = sum[0];
+    c.potential = G * sum[1];
+    for (int a = 0; a < 3; a++) {
+      c.momentum[a] = sum[2 + a];
+      c.angularMomentum[a] = sum[5 + a];
+    }
+    return c;
+  }
+
+}  // namespace simulation
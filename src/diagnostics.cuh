@@ -0,0 +1,19 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include "conservation.hpp"
+#include "simulator.cuh"
+
+namespace simulation {
+
+  // Conserved quantities of the first n particles on the device, summed in
+  // double precision. The potential visits every pair like the DIRECT
+  // interaction, so this costs about one interaction step (blocks until
+  // complete).
+  Conserved computeConserved(const ParticleData_d &pos,
+      const ParticleData_d &vel, size_t n, coords_t G, coords_t distEps);
+
+}  // namespace simulation
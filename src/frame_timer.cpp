@@ -0,0 +1,75 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "frame_timer.hpp"
+
+#include <cstring>
+#include <iomanip>
+
+FrameTimer &FrameTimer::get() {
+  static FrameTimer timer;
+  return timer;
+}
+
+void FrameTimer::add(const char *name, PhaseTrack track, double start,
+    double end) {
+  const int thread = track == PhaseTrack::HOST ? threadIndex() : 0;
+  std::lock_guard<std::mutex> lock(mutex);
+  phases.push_back({name, track, thread, start, end});
+}
+
+int FrameTimer::threadIndex() {
+  static std::atomic<int> count{0};
+  thread_local const int index = count.fetch_add(1);
+  return index;
+}
+
+void FrameTimer::nameThread(const char *name) {
+  const size_t index = threadIndex();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (names.size() <= index) names.resize(index + 1, nullptr);
+  names[index] = name;
+}
+
+std::vector<const char *> FrameTimer::threadNames() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return names;
+}
+
+std::vector<FramePhase> FrameTimer::endFrame() {
+  std::vector<FramePhase> frame;
+  std::lock_guard<std::mutex> lock(mutex);
+  frame.swap(phases);
+  return frame;
+}
+
+void FrameTimer::print(std::ostream &out, size_t frame,
+    const std::vector<FramePhase> &phases) {
+  // Totals per (track, name), in order of first appearance
+  struct Total {
+    const char *name;
+    PhaseTrack track;
+    double time;
+  };
+  std::vector<Total> totals;
+  for (const FramePhase &phase : phases) {
+    auto it = totals.begin();
+    while (it != totals.end() && (it->track != phase.track ||
+          std::strcmp(it->name, phase.name) != 0)) {
+      ++it;
+    }
+    if (it == totals.end()) {
+      totals.push_back({phase.name, phase.track, 0});
+      it = totals.end() - 1;
+    }
+    it->time += phase.end - phase.start;
+  }
+  out << "Frame " << frame << " ms:" << std::fixed << std::setprecision(3);
+  for (const Total &total : totals) {
+    const char *suffix = total.track == PhaseTrack::DEVICE ? "[device]" :
+      total.track == PhaseTrack::GL ? "[gl]" : "";
+    out << " " << total.name << suffix << " " << total.time / 1000;
+  }
+  out << std::defaultfloat << "\n";
+}
@@ -0,0 +1,134 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+ * Where a timed phase ran
+ */
+enum class PhaseTrack {
+  HOST,    ///< Host code, timed by ScopedTimer
+  DEVICE,  ///< Simulation device work, from DeviceInterval (--profile=1)
+  GL       ///< Render pass on the GPU, from GL timer queries
+};
+
+/**
+ * A phase of a frame, in microseconds since the FrameTimer was created
+ */
+struct FramePhase {
+  const char *name;
+  PhaseTrack track;
+  int thread;  ///< FrameTimer::threadIndex of a PhaseTrack::HOST phase
+  double start;
+  double end;
+};
+
+/**
+ * Per-frame breakdown of where the time goes. Code is instrumented with
+ * ScopedTimer, & device & GL times are added as they are read back; the
+ * phases collect until endFrame. Disabled (& then next to free) until
+ * enable is called.
+ */
+class FrameTimer {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * The process-wide timer
+     */
+    static FrameTimer &get();
+
+    void enable() { on.store(true, std::memory_order_relaxed); }
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    /**
+     * Microseconds since the timer was created
+     */
+    double now() const {
+      return std::chrono::duration<double, std::micro>(Clock::now() - origin)
+        .count();
+    }
+
+    /**
+     * Adds a phase to the current frame, from any thread
+     * @param name a string literal, or otherwise outliving the timer
+     */
+    void add(const char *name, PhaseTrack track, double start, double end);
+
+    /**
+     * Small number identifying the calling thread, from 0 in the order
+     * threads first ask
+     */
+    static int threadIndex();
+
+    /**
+     * Names the calling thread in traces
+     * @param name a string literal
+     */
+    void nameThread(const char *name);
+
+    /**
+     * Names from nameThread by threadIndex, nullptr for unnamed threads
+     */
+    std::vector<const char *> threadNames();
+
+    /**
+     * The phases added since the last call, in the order they were added
+     */
+    std::vector<FramePhase> endFrame();
+
+    /**
+     * Prints the total time of each phase in milliseconds, on one line
+     */
+    static void print(std::ostream &out, size_t frame,
+        const std::vector<FramePhase> &phases);
+
+  private:
+    FrameTimer() : origin(Clock::now()) {}
+
+    const Clock::time_point origin;
+    std::atomic<bool> on{false};
+    std::mutex mutex;
+    std::vector<FramePhase> phases;
+    std::vector<const char *> names;
+};
+
+/**
+ * Times the enclosing scope on the host, if the FrameTimer is enabled
+ */
+class ScopedTimer {
+  public:
+    /**
+     * @param name_ a string literal
+     */
+    explicit ScopedTimer(const char *name_)
+      : name(name_),
+      start(FrameTimer::get().enabled() ? FrameTimer::get().now() : -1) {}
+
+    ~ScopedTimer() { stop(); }
+
+    /**
+     * Ends the phase before the end of the scope
+     */
+    void stop() {
+      if (start >= 0) {
+        FrameTimer &timer = FrameTimer::get();
+        timer.add(name, PhaseTrack::HOST, start, timer.now());
+        start = -1;
+      }
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  private:
+    const char *name;
+    double start;
+};
@@ -0,0 +1,448 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "philox.hpp"
+#include "sim_param.hpp"
+
+#ifdef __CUDACC__
+#define GALAXY_HOSTDEV __host__ __device__
+#else
+#define GALAXY_HOSTDEV
+#endif
+
+/**
+ * Initial conditions generated per particle, from its index & the seed
+ * alone, so they can be generated on the device or on any number of host
+ * threads with the same result. Every particle has unit mass, as in the
+ * force kernels, so a model of n particles has mass n. GalaxyModel lists
+ * the models:
+ *   DISK       thick disk of radius 100 with circular velocities, out of
+ *              equilibrium
+ *   PLUMMER    Plummer sphere of scale radius `scale`, with velocities drawn
+ *              from its distribution function
+ *   HERNQUIST  Hernquist sphere of scale radius `scale`
+ *   NFW        NFW halo of scale radius `scale`, truncated at its virial
+ *              radius, `concentration` scale radii
+ *   EXPDISK    exponential disk of scale length `scale` in a Hernquist halo
+ *              holding `haloFraction` of the particles
+ *   COLLISION  two EXPDISK galaxies `collisionDistance` apart, falling
+ *              towards each other on a parabolic orbit
+ * The Hernquist & NFW velocities are Gaussian, with the isotropic dispersion
+ * solving the Jeans equation. The exponential disk has the vertical
+ * dispersion of an isothermal sheet, an equal radial dispersion & the
+ * azimuthal dispersion & asymmetric drift of the epicyclic approximation.
+ */
+struct GalaxyModelParams {
+  GalaxyModel model;
+  uint64_t seed;
+  uint64_t numParticles;
+  float G;
+  float scale;
+  float concentration;
+  float haloFraction;
+  float collisionDistance;
+  float collisionImpact;
+};
+
+inline GalaxyModelParams makeGalaxyModelParams(const SimParam &params) {
+  return {params.model, params.seed, params.numParticles, params.G,
+    params.modelScale, params.concentration, params.haloFraction,
+    params.collisionDistance, params.collisionImpact};
+}
+
+namespace galaxy_detail {
+  constexpr float PI = 3.14159265358979323846f;
+  constexpr float TWO_PI = 6.28318530717958647692f;
+  // Mass fraction of the (untruncated) Plummer & Hernquist spheres sampled
+  constexpr float PLUMMER_MAX_MASS = 0.999f;
+  constexpr float HERNQUIST_MAX_MASS = 0.95f;
+  // Exponential disk: truncation radius & sech^2 scale height, in scale
+  // lengths, & scale radius of its Hernquist halo, in disk scale lengths
+  constexpr float DISK_MAX_RADIUS = 10.0f;
+  constexpr float DISK_HEIGHT = 0.2f;
+  constexpr float DISK_HALO_SCALE = 3.0f;
+  // Inclination of the second galaxy of a collision to the orbital plane
+  constexpr float COLLISION_TILT = PI / 3;
+  // Simpson intervals of the Jeans equation integral
+  constexpr int JEANS_STEPS = 64;
+
+  /**
+   * Uniform & normal variates of one particle: successive Philox blocks,
+   * with the particle index as the low counter words & the block number
+   * as the third
+   */
+  struct ParticleRng {
+    uint64_t seed;
+    uint64_t index;
+    uint32_t block = 0;
+    int used = 4;
+    Philox4x32 bits;
+
+    GALAXY_HOSTDEV ParticleRng(uint64_t seed_, uint64_t index_)
+      : seed(seed_), index(index_) {}
+
+    /** Uniform in [0, 1) */
+    GALAXY_HOSTDEV float uniform() {
+      if (used == 4) {
+        bits = philox4x32({{uint32_t(index), uint32_t(index >> 32), block++,
+            0}}, seed);
+        used = 0;
+      }
+      return uniformFloat(bits.v[used++]);
+    }
+
+    /** Standard normal, by Box-Muller */
+    GALAXY_HOSTDEV float normal() {
+      float r = std::sqrt(-2.0f * std::log(1.0f - uniform()));
+      return r * std::cos(TWO_PI * uniform());
+    }
+  };
+
+  /** Isotropic vector of length r */
+  GALAXY_HOSTDEV inline void isotropic(ParticleRng &rng, float r,
+      float out[3]) {
+    float c = 2 * rng.uniform() - 1;
+    float s = std::sqrt(1 - c * c > 0 ? 1 - c * c : 0.0f);
+    float phi = TWO_PI * rng.uniform();
+    out[0] = r * s * std::cos(phi);
+    out[1] = r * s * std::sin(phi);
+    out[2] = r * c;
+  }
+
+  /** x in [lo, hi] where the increasing f(x) reaches target */
+  template <class F>
+  GALAXY_HOSTDEV inline float bisect(const F &f, float target, float lo,
+      float hi) {
+    for (int i = 0; i < 32; i++) {
+      float mid = 0.5f * (lo + hi);
+      if (f(mid) < target) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    return 0.5f * (lo + hi);
+  }
+
+  // Modified Bessel functions, by the polynomial approximations of
+  // Abramowitz & Stegun 9.8.1 - 9.8.8
+  GALAXY_HOSTDEV inline float besselI0(float x) {
+    if (x < 3.75f) {
+      float y = (x / 3.75f) * (x / 3.75f);
+      return 1 + y * (3.5156229f + y * (3.0899424f + y * (1.2067492f +
+              y * (0.2659732f + y * (0.0360768f + y * 0.0045813f)))));
+    }
+    float y = 3.75f / x;
+    return std::exp(x) / std::sqrt(x) * (0.39894228f + y * (0.01328592f +
+          y * (0.00225319f + y * (-0.00157565f + y * (0.00916281f +
+          y * (-0.02057706f + y * (0.02635537f + y * (-0.01647633f +
+          y * 0.00392377f))))))));
+  }
+
+  GALAXY_HOSTDEV inline float besselI1(float x) {
+    if (x < 3.75f) {
+      float y = (x / 3.75f) * (x / 3.75f);
+      return x * (0.5f + y * (0.87890594f + y * (0.51498869f +
+              y * (0.15084934f + y * (0.02658733f + y * (0.00301532f +
+              y * 0.00032411f))))));
+    }
+    float y = 3.75f / x;
+    return std::exp(x) / std::sqrt(x) * (0.39894228f + y * (-0.03988024f +
+          y * (-0.00362018f + y * (0.00163801f + y * (-0.01031555f +
+          y * (0.02282967f + y * (-0.02895312f + y * (0.01787654f -
+          y * 0.00420059f))))))));
+  }
+
+  GALAXY_HOSTDEV inline float besselK0(float x) {
+    if (x <= 2) {
+      float y = x * x / 4;
+      return -std::log(x / 2) * besselI0(x) + (-0.57721566f +
+          y * (0.42278420f + y * (0.23069756f + y * (0.03488590f +
+          y * (0.00262698f + y * (0.00010750f + y * 0.0000074f))))));
+    }
+    float y = 2 / x;
+    return std::exp(-x) / std::sqrt(x) * (1.25331414f + y * (-0.07832358f +
+          y * (0.02189568f + y * (-0.01062446f + y * (0.00587872f +
+          y * (-0.00251540f + y * 0.00053208f))))));
+  }
+
+  GALAXY_HOSTDEV inline float besselK1(float x) {
+    if (x <= 2) {
+      float y = x * x / 4;
+      return std::log(x / 2) * besselI1(x) + (1 / x) * (1 +
+          y * (0.15443144f + y * (-0.67278579f + y * (-0.18156897f +
+          y * (-0.01919402f + y * (-0.00110404f + y * -0.00004686f))))));
+    }
+    float y = 2 / x;
+    return std::exp(-x) / std::sqrt(x) * (1.25331414f + y * (0.23498619f +
+          y * (-0.03655620f + y * (0.01504268f + y * (-0.00780353f +
+          y * (0.00325614f + y * -0.00068245f))))));
+  }
+
+  /** Spherical Hernquist or NFW halo, truncated at rMax */
+  struct Halo {
+    bool nfw;
+    float mass;   ///< Mass within rMax
+    float scale;
+    float rMax;
+    float norm;   ///< Untruncated mass fraction within rMax (Hernquist), or
+                  ///< ln(1 + c) - c / (1 + c) (NFW)
+  };
+
+  /** Exponential disk with a sech^2 vertical profile, truncated at rMax */
+  struct Disk {
+    float mass;   ///< Mass within rMax
+    float scale;
+    float height;
+    float rMax;
+    float norm;   ///< Untruncated mass fraction within rMax
+  };
+
+  GALAXY_HOSTDEV inline float nfwMass(float x) {
+    return std::log(1 + x) - x / (1 + x);
+  }
+
+  GALAXY_HOSTDEV inline float diskMassFraction(float x) {
+    return 1 - (1 + x) * std::exp(-x);
+  }
+
+  struct NfwMassFn {
+    GALAXY_HOSTDEV float operator()(float x) const { return nfwMass(x); }
+  };
+
+  struct DiskMassFn {
+    GALAXY_HOSTDEV float operator()(float x) const {
+      return diskMassFraction(x);
+    }
+  };
+
+  GALAXY_HOSTDEV inline Halo hernquistHalo(float mass, float scale) {
+    float s = std::sqrt(HERNQUIST_MAX_MASS);
+    return {false, mass, scale, scale * s / (1 - s), HERNQUIST_MAX_MASS};
+  }
+
+  GALAXY_HOSTDEV inline Halo nfwHalo(float mass, float scale, float concentration) {
+    return {true, mass, scale, scale * concentration, nfwMass(concentration)};
+  }
+
+  GALAXY_HOSTDEV inline Disk expDisk(float mass, float scale) {
+    return {mass, scale, DISK_HEIGHT * scale, DISK_MAX_RADIUS * scale,
+      diskMassFraction(DISK_MAX_RADIUS)};
+  }
+
+  /** Halo density, up to a constant factor */
+  GALAXY_HOSTDEV inline float haloDensityShape(const Halo &h, float r) {
+    float x = r / h.scale;
+    return h.nfw ? 1 / (x * (1 + x) * (1 + x)) :
+      1 / (x * (1 + x) * (1 + x) * (1 + x));
+  }
+
+  GALAXY_HOSTDEV inline float haloMass(const Halo &h, float r) {
+    if (h.mass == 0) return 0;
+    if (r >= h.rMax) return h.mass;
+    float x = r / h.scale;
+    float fraction = h.nfw ? nfwMass(x) : x * x / ((1 + x) * (1 + x));
+    return h.mass * fraction / h.norm;
+  }
+
+  /** d haloMass / dr */
+  GALAXY_HOSTDEV inline float haloMassSlope(const Halo &h, float r) {
+    if (h.mass == 0 || r >= h.rMax) return 0;
+    float x = r / h.scale;
+    float slope = h.nfw ? x / ((1 + x) * (1 + x)) :
+      2 * x / ((1 + x) * (1 + x) * (1 + x));
+    return h.mass * slope / (h.norm * h.scale);
+  }
+
+  /** Disk mass within cylindrical radius R */
+  GALAXY_HOSTDEV inline float diskMass(const Disk &d, float R) {
+    if (d.mass == 0) return 0;
+    if (R >= d.rMax) return d.mass;
+    return d.mass * diskMassFraction(R / d.scale) / d.norm;
+  }
+
+  /**
+   * Isotropic velocity dispersion squared of the halo at r, from the Jeans
+   * equation, integrated in log r out to the truncation radius. The disk
+   * is included as the spherically averaged mass within r.
+   */
+  GALAXY_HOSTDEV inline float jeansDispersion2(const Halo &h, const Disk &d,
+      float G, float r) {
+    if (r >= h.rMax) return 0;
+    float dt = std::log(h.rMax / r) / JEANS_STEPS;
+    float sum = 0;
+    for (int k = 0; k <= JEANS_STEPS; k++) {
+      float s = r * std::exp(k * dt);
+      float w = (k == 0 || k == JEANS_STEPS) ? 1 : (k % 2 ? 4 : 2);
+      sum += w * haloDensityShape(h, s) * (haloMass(h, s) + diskMass(d, s)) /
+        s;
+    }
+    return G * sum * dt / 3 / haloDensityShape(h, r);
+  }
+
+  GALAXY_HOSTDEV inline void haloParticle(ParticleRng &rng, const Halo &h,
+      const Disk &d, float G, float p[3], float v[3]) {
+    float u = rng.uniform();
+    float r;
+    if (h.nfw) {
+      r = h.scale * bisect(NfwMassFn(), u * h.norm, 0, h.rMax / h.scale);
+    } else {
+      float s = std::sqrt(u * h.norm);
+      r = h.scale * s / (1 - s);
+    }
+    isotropic(rng, r, p);
+    float sigma = std::sqrt(jeansDispersion2(h, d, G, r));
+    v[0] = sigma * rng.normal();
+    v[1] = sigma * rng.normal();
+    v[2] = sigma * rng.normal();
+  }
+
+  GALAXY_HOSTDEV inline void diskParticle(ParticleRng &rng, const Disk &d,
+      const Halo &h, float G, float p[3], float v[3]) {
+    float x = bisect(DiskMassFn(), rng.uniform() * d.norm, 0,
+        DISK_MAX_RADIUS);
+    float R = d.scale * (x > 1e-4f ? x : 1e-4f);
+    float w = 2 * rng.uniform() - 1;
+    w = w < -0.999f ? -0.999f : (w > 0.999f ? 0.999f : w);
+    float z = 0.5f * d.height * std::log((1 + w) / (1 - w));
+    float phi = TWO_PI * rng.uniform();
+
+    // Circular velocity of the disk (Freeman 1970) & halo, & its slope
+    float sigma0 = d.mass / (TWO_PI * d.scale * d.scale * d.norm);
+    float y = R / (2 * d.scale);
+    float i0 = besselI0(y), i1 = besselI1(y);
+    float k0 = besselK0(y), k1 = besselK1(y);
+    float diskFactor = 4 * PI * G * sigma0 * d.scale;
+    float vc2 = diskFactor * y * y * (i0 * k0 - i1 * k1) +
+      G * haloMass(h, R) / R;
+    float vc2Slope = diskFactor * (2 * y * i0 * k0 +
+        2 * y * y * (i1 * k0 - i0 * k1)) / (2 * d.scale) +
+      G * (haloMassSlope(h, R) / R - haloMass(h, R) / (R * R));
+
+    // Epicyclic approximation
+    float omega2 = vc2 / (R * R);
+    float kappa2 = vc2Slope / R + 2 * omega2;
+    float ratio = kappa2 > 0 ? kappa2 / (4 * omega2) : 0;
+    float sigmaZ2 = PI * G * sigma0 * std::exp(-x) * d.height;
+    float sigmaR2 = sigmaZ2;
+    float vPhi2 = vc2 + sigmaR2 * (1 - ratio - 2 * x);
+    float vPhi = std::sqrt(vPhi2 > 0 ? vPhi2 : 0.0f) +
+      std::sqrt(sigmaR2 * ratio) * rng.normal();
+    float vR = std::sqrt(sigmaR2) * rng.normal();
+
+    float c = std::cos(phi), s = std::sin(phi);
+    p[0] = R * c;
+    p[1] = R * s;
+    p[2] = z;
+    v[0] = vR * c - vPhi * s;
+    v[1] = vR * s + vPhi * c;
+    v[2] = std::sqrt(sigmaZ2) * rng.normal();
+  }
+
+  /** Particle i of an EXPDISK galaxy of n particles */
+  GALAXY_HOSTDEV inline void galaxyParticle(ParticleRng &rng,
+      const GalaxyModelParams &m, uint64_t i, uint64_t n, float p[3],
+      float v[3]) {
+    uint64_t numHalo = uint64_t(m.haloFraction * n + 0.5f);
+    numHalo = numHalo > n ? n : numHalo;
+    Disk d = expDisk(float(n - numHalo), m.scale);
+    Halo h = hernquistHalo(float(numHalo), DISK_HALO_SCALE * m.scale);
+    if (i < n - numHalo) {
+      diskParticle(rng, d, h, m.G, p, v);
+    } else {
+      haloParticle(rng, h, d, m.G, p, v);
+    }
+  }
+
+  GALAXY_HOSTDEV inline void plummerParticle(ParticleRng &rng,
+      const GalaxyModelParams &m, float p[3], float v[3]) {
+    float a = m.scale;
+    float u = rng.uniform() * PLUMMER_MAX_MASS;
+    float r = a / std::sqrt(std::pow(u, -2.0f / 3.0f) - 1);
+    isotropic(rng, r, p);
+    // Speed as a fraction q of the escape speed, by rejection from
+    // q^2 (1 - q^2)^3.5 (Aarseth, Henon & Wielen 1974)
+    float q = 0;
+    for (int attempt = 0; attempt < 64; attempt++) {
+      float x = rng.uniform();
+      if (0.1f * rng.uniform() < x * x * std::pow(1 - x * x, 3.5f)) {
+        q = x;
+        break;
+      }
+    }
+    float escape = std::sqrt(2 * m.G * m.numParticles / a) *
+      std::pow(1 + r * r / (a * a), -0.25f);
+    isotropic(rng, q * escape, v);
+  }
+
+  GALAXY_HOSTDEV inline void thickDiskParticle(ParticleRng &rng, float p[3],
+      float v[3]) {
+    float t = rng.uniform() * TWO_PI;
+    float s = rng.uniform() * 100;
+    p[0] = std::cos(t) * s;
+    p[1] = std::sin(t) * s;
+    p[2] = 4 * rng.uniform();
+    // Along p x (0, 0, 1), with speed sqrt(2 |p x (0, 0, 1)|)
+    float len = std::sqrt(p[0] * p[0] + p[1] * p[1]);
+    float speed = std::sqrt(2 * len);
+    v[0] = p[1] / len * speed;
+    v[1] = -p[0] / len * speed;
+    v[2] = 0;
+  }
+}
+
+/**
+ * Position & velocity of particle i of the model
+ */
+GALAXY_HOSTDEV inline void galaxyModelParticle(const GalaxyModelParams &m,
+    uint64_t i, float p[3], float v[3]) {
+  using namespace galaxy_detail;
+  ParticleRng rng(m.seed, i);
+  const uint64_t n = m.numParticles;
+  switch (m.model) {
+    case GalaxyModel::DISK:
+      thickDiskParticle(rng, p, v);
+      break;
+    case GalaxyModel::PLUMMER:
+      plummerParticle(rng, m, p, v);
+      break;
+    case GalaxyModel::HERNQUIST:
+      haloParticle(rng, hernquistHalo(float(n), m.scale), Disk{}, m.G, p, v);
+      break;
+    case GalaxyModel::NFW:
+      haloParticle(rng, nfwHalo(float(n), m.scale, m.concentration), Disk{},
+          m.G, p, v);
+      break;
+    case GalaxyModel::EXPDISK:
+      galaxyParticle(rng, m, i, n, p, v);
+      break;
+    case GalaxyModel::COLLISION: {
+      // Galaxies of n / 2 & n - n / 2 particles approaching along x, offset
+      // by collisionImpact in y, at the parabolic relative speed
+      const uint64_t half = n / 2;
+      const bool second = i >= half;
+      galaxyParticle(rng, m, second ? i - half : i, second ? n - half : half,
+          p, v);
+      if (second) {
+        float c = std::cos(COLLISION_TILT), s = std::sin(COLLISION_TILT);
+        float py = p[1], vy = v[1];
+        p[1] = c * py - s * p[2];
+        p[2] = s * py + c * p[2];
+        v[1] = c * vy - s * v[2];
+        v[2] = s * vy + c * v[2];
+      }
+      float sign = second ? 1.0f : -1.0f;
+      float speed = std::sqrt(2 * m.G * n / m.collisionDistance);
+      p[0] += sign * 0.5f * m.collisionDistance;
+      p[1] += sign * 0.5f * m.collisionImpact;
+      v[0] -= sign * 0.5f * speed;
+      break;
+    }
+  }
+}
@@ -0,0 +1,98 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "ic_cache.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+template <class T>
+void append(std::string &key, const T &value) {
+  key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// The parameters the generated initial conditions depend on, as bytes
+std::string cacheKey(const SimParam &params, const std::string &generator) {
+  std::string key;
+  append(key, IC_CACHE_VERSION);
+  append(key, uint32_t(generator.size()));
+  key += generator;
+  append(key, params.model);
+  append(key, uint64_t(params.numParticles));
+  append(key, params.G);
+  append(key, params.modelScale);
+  append(key, params.concentration);
+  append(key, params.haloFraction);
+  append(key, params.collisionDistance);
+  append(key, params.collisionImpact);
+  return key;
+}
+
+uint64_t fnv1a(const std::string &bytes) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : bytes) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+}  // namespace
+
+InitialConditionCache::InitialConditionCache(const SimParam &params_,
+    const std::string &generator_)
+  : params(params_), generator(generator_),
+  key(cacheKey(params_, generator_)) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "ic_%016" PRIx64 ".ckpt", fnv1a(key));
+  file = params.icCache + "/" + name;
+}
+
+std::unique_ptr<CheckpointReader> InitialConditionCache::open() const {
+  if (access(file.c_str(), R_OK) != 0) return nullptr;
+  std::unique_ptr<CheckpointReader> reader;
+  try {
+    reader = std::make_unique<CheckpointReader>(file);
+  } catch (const std::exception &e) {
+    std::cerr << "Ignoring initial conditions cache " << file << ": "
+      << e.what() << "\n";
+    return nullptr;
+  }
+  if (cacheKey(reader->params(), reader->rngState()) != key) {
+    std::cerr << "Initial conditions cache " << file
+      << " holds other parameters, regenerating\n";
+    return nullptr;
+  }
+  return reader;
+}
+
+void InitialConditionCache::store(const float *const pos[3],
+    const float *const vel[3]) const {
+  if (mkdir(params.icCache.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "Can't create initial conditions cache " << params.icCache
+      << "\n";
+    return;
+  }
+  // Written under a name of this process & renamed into place, so runs
+  // filling the same entry concurrently never see a partial file
+  const std::string tmpPath = file + "." + std::to_string(getpid());
+  try {
+    writeCheckpoint(tmpPath, {&params, 0, generator, {pos[0], pos[1], pos[2]},
+        {vel[0], vel[1], vel[2]}, nullptr});
+    if (std::rename(tmpPath.c_str(), file.c_str()) != 0) {
+      throw std::runtime_error("Can't rename " + tmpPath + " to " + file);
+    }
+  } catch (const std::exception &e) {
+    std::remove(tmpPath.c_str());
+    std::cerr << "Not caching initial conditions: " << e.what() << "\n";
+  }
+}
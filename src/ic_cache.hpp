@@ -0,0 +1,54 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "checkpoint.hpp"
+#include "sim_param.hpp"
+
+/**
+ * Bumped whenever the generated initial conditions change for the same
+ * parameters, which invalidates every cached file
+ */
+constexpr uint32_t IC_CACHE_VERSION = 1;
+
+/**
+ * On-disk cache of generated initial conditions, in params.icCache. Each
+ * entry is a checkpoint at step 0, named after the FNV-1a hash of the
+ * generator & the parameters its output depends on (model, seed, particle
+ * count, G & the model parameters), so a hit is mapped & copied straight
+ * to the device like a restart.
+ */
+class InitialConditionCache {
+  public:
+    /**
+     * @param generator generator name & seed, as stored in checkpoints
+     */
+    InitialConditionCache(const SimParam &params, const std::string &generator);
+
+    const std::string &path() const { return file; }
+
+    /**
+     * The cached initial conditions, or nullptr if there are none (or the
+     * file holds those of other parameters with the same hash)
+     */
+    std::unique_ptr<CheckpointReader> open() const;
+
+    /**
+     * Adds generated initial conditions to the cache. Failing to write is
+     * reported & otherwise ignored, as the cache is only an optimization.
+     * @param pos, vel params.numParticles elements per component
+     */
+    void store(const float *const pos[3], const float *const vel[3]) const;
+
+  private:
+    SimParam params;
+    std::string generator;
+    std::string key;   ///< The hashed bytes
+    std::string file;
+};
@@ -0,0 +1,378 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "initial_conditions.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t GADGET_HEADER_SIZE = 256;
+
+constexpr bool hostIsLittleEndian() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return false;
+#else
+  return true;
+#endif
+}
+
+// Read only mapping of a whole file
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string &path) {
+      int fd = open(path.c_str(), O_RDONLY);
+      struct stat st {};
+      if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("Can't open initial conditions " + path);
+      }
+      size = st.st_size;
+      void *mem = size == 0 ? nullptr :
+        mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (mem == MAP_FAILED) {
+        throw std::runtime_error("Can't map initial conditions " + path);
+      }
+      data = static_cast<const char *>(mem);
+    }
+
+    ~MappedFile() {
+      if (data) munmap(const_cast<char *>(data), size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data = nullptr;
+    size_t size = 0;
+};
+
+bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+    s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+uint32_t swap32(uint32_t v) {
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+ICFormat resolveFormat(const std::string &path, ICFormat format) {
+  if (format != ICFormat::AUTO) return format;
+  if (endsWith(path, ".bin") || endsWith(path, ".soa")) {
+    return ICFormat::BINARY;
+  }
+  if (endsWith(path, ".csv") || endsWith(path, ".txt")) return ICFormat::CSV;
+  uint32_t marker = 0;
+  std::ifstream in(path, std::ios::binary);
+  in.read(reinterpret_cast<char *>(&marker), sizeof(marker));
+  if (in && (marker == GADGET_HEADER_SIZE ||
+        swap32(marker) == GADGET_HEADER_SIZE)) {
+    return ICFormat::GADGET;
+  }
+  throw std::invalid_argument("Can't tell the format of " + path +
+      ", use --icFormat");
+}
+
+// --- BINARY ---
+
+size_t binaryCount(const std::string &path, const MappedFile &file) {
+  if (file.size % (6 * sizeof(float)) != 0) {
+    throw std::runtime_error(path + " isn't a whole number of particles");
+  }
+  return file.size / (6 * sizeof(float));
+}
+
+void loadBinary(const std::string &path, float *const dst[6]) {
+  MappedFile file(path);
+  const size_t n = binaryCount(path, file);
+  const float *src = reinterpret_cast<const float *>(file.data);
+  parallelChunks(numHostThreads(), [&](size_t chunk, size_t numChunks) {
+      size_t begin = n * chunk / numChunks;
+      size_t end = n * (chunk + 1) / numChunks;
+      for (int c = 0; c < 6; c++) {
+        std::memcpy(dst[c] + begin, src + c * n + begin,
+            (end - begin) * sizeof(float));
+        if (!hostIsLittleEndian()) {
+          for (size_t i = begin; i < end; i++) {
+            uint32_t v;
+            std::memcpy(&v, dst[c] + i, sizeof(v));
+            v = swap32(v);
+            std::memcpy(dst[c] + i, &v, sizeof(v));
+          }
+        }
+      }
+      });
+}
+
+// --- GADGET ---
+
+// Format 1 snapshot: Fortran records of a 256 byte header, then the
+// positions & velocities (as xyz triples), ids & masses
+class GadgetFile {
+  public:
+    explicit GadgetFile(const std::string &path_)
+      : path(path_), file(path_) {
+      if (file.size < 8 + GADGET_HEADER_SIZE) {
+        throw std::runtime_error(path + " is not a GADGET snapshot");
+      }
+      uint32_t marker = raw32(0);
+      swapped = marker != GADGET_HEADER_SIZE;
+      if (get32(0) != GADGET_HEADER_SIZE ||
+          get32(4 + GADGET_HEADER_SIZE) != GADGET_HEADER_SIZE) {
+        throw std::runtime_error(path + " is not a GADGET snapshot");
+      }
+      // int npart[6] at the start of the header, int num_files at 124
+      for (int t = 0; t < 6; t++) count += get32(4 + 4 * t);
+      if (int32_t(get32(4 + 124)) > 1) {
+        throw std::runtime_error(path + " is one file of a multi-file "
+            "snapshot, which isn't supported");
+      }
+    }
+
+    size_t numParticles() const { return count; }
+
+    // Reads block (0 = positions, 1 = velocities) into x, y & z arrays
+    void readBlock(int block, float *const dst[3]) const {
+      size_t offset = 8 + GADGET_HEADER_SIZE;
+      for (int b = 0; b <= block; b++) {
+        if (offset + 4 > file.size) throw truncated();
+        uint64_t bytes = get32(offset);
+        if (b == block) {
+          if (offset + 8 + bytes > file.size || get32(offset + 4 + bytes) !=
+              bytes) {
+            throw truncated();
+          }
+          convert(file.data + offset + 4, bytes, dst);
+          return;
+        }
+        offset += 8 + bytes;
+      }
+    }
+
+  private:
+    uint32_t raw32(size_t offset) const {
+      uint32_t v;
+      std::memcpy(&v, file.data + offset, sizeof(v));
+      return v;
+    }
+
+    uint32_t get32(size_t offset) const {
+      uint32_t v = raw32(offset);
+      return swapped ? swap32(v) : v;
+    }
+
+    std::runtime_error truncated() const {
+      return std::runtime_error("Truncated GADGET snapshot " + path);
+    }
+
+    // Splits xyz triples of float or double into SoA arrays, in parallel
+    void convert(const char *src, uint64_t bytes, float *const dst[3]) const {
+      if (count == 0) return;
+      const size_t elementSize = bytes / (3 * count);
+      if (bytes != 3 * count * elementSize ||
+          (elementSize != 4 && elementSize != 8)) {
+        throw std::runtime_error("Unexpected block size in " + path);
+      }
+      parallelChunks(numHostThreads(), [&](size_t chunk, size_t numChunks) {
+          size_t begin = count * chunk / numChunks;
+          size_t end = count * (chunk + 1) / numChunks;
+          for (size_t i = begin; i < end; i++) {
+            for (int c = 0; c < 3; c++) {
+              char bytes[8];
+              std::memcpy(bytes, src + (3 * i + c) * elementSize, elementSize);
+              if (swapped) std::reverse(bytes, bytes + elementSize);
+              if (elementSize == 4) {
+                std::memcpy(&dst[c][i], bytes, 4);
+              } else {
+                double v;
+                std::memcpy(&v, bytes, 8);
+                dst[c][i] = float(v);
+              }
+            }
+          }
+          });
+    }
+
+    std::string path;
+    MappedFile file;
+    bool swapped = false;
+    size_t count = 0;
+};
+
+}  // namespace
+
+// --- CSV ---
+
+// The file's text, null terminated so strtof stops at its end, split into
+// chunks of whole lines
+class InitialConditionFile::CsvText {
+  public:
+    explicit CsvText(const std::string &path) {
+      std::ifstream in(path, std::ios::binary | std::ios::ate);
+      if (!in) {
+        throw std::runtime_error("Can't open initial conditions " + path);
+      }
+      text.resize(size_t(in.tellg()) + 1);
+      in.seekg(0);
+      in.read(text.data(), text.size() - 1);
+      if (!in) throw std::runtime_error("Error reading " + path);
+      text.back() = '\0';
+
+      // A first line which doesn't start with a number is a header
+      size_t start = 0;
+      const char *first = text.data();
+      while (*first == ' ' || *first == '\t') first++;
+      if (*first != '\0' && !std::isdigit(uchar(*first)) &&
+          !std::strchr("+-.#\r\n", *first)) {
+        const char *eol = std::strchr(first, '\n');
+        start = eol ? eol + 1 - text.data() : text.size() - 1;
+      }
+
+      // Chunk boundaries, moved on to the start of a line
+      const size_t end = text.size() - 1;
+      const size_t numChunks = std::min(numHostThreads(), end - start + 1);
+      for (size_t c = 0; c <= numChunks; c++) {
+        size_t b = start + (end - start) * c / numChunks;
+        if (c > 0 && c < numChunks) {
+          const void *eol = std::memchr(text.data() + b, '\n', end - b);
+          b = eol ? static_cast<const char *>(eol) + 1 - text.data() : end;
+        }
+        bounds.push_back(std::max(b, bounds.empty() ? b : bounds.back()));
+      }
+
+      // Count the particles in each chunk, in parallel
+      rowOffsets.assign(numChunks + 1, 0);
+      parallelChunks(numChunks, [&](size_t chunk, size_t) {
+          size_t rows = 0;
+          forEachRow(chunk, [&](const char *) { rows++; });
+          rowOffsets[chunk + 1] = rows;
+          });
+      for (size_t c = 0; c < numChunks; c++) {
+        rowOffsets[c + 1] += rowOffsets[c];
+      }
+    }
+
+    size_t numChunks() const { return bounds.size() - 1; }
+    size_t numRows() const { return rowOffsets.back(); }
+
+    // Calls f with the start of each particle line of a chunk
+    template <typename F>
+    void forEachRow(size_t chunk, F &&f) const {
+      const char *p = text.data() + bounds[chunk];
+      const char *end = text.data() + bounds[chunk + 1];
+      while (p < end) {
+        const char *line = p;
+        while (p < end && *p != '\n') p++;
+        p++;
+        while (*line == ' ' || *line == '\t') line++;
+        if (line < end && *line != '\n' && *line != '\r' && *line != '#') {
+          f(line);
+        }
+      }
+    }
+
+    // Parses every row into the x, y, z, vx, vy & vz arrays of dst
+    void read(const std::string &path, float *const dst[6]) const;
+
+    std::vector<size_t> rowOffsets;
+
+  private:
+    using uchar = unsigned char;
+
+    std::vector<char> text;
+    std::vector<size_t> bounds;
+};
+
+void InitialConditionFile::CsvText::read(const std::string &path,
+    float *const dst[6]) const {
+  std::atomic<size_t> badRow{SIZE_MAX};
+  parallelChunks(numChunks(), [&](size_t chunk, size_t) {
+      size_t row = rowOffsets[chunk];
+      forEachRow(chunk, [&](const char *p) {
+          for (int c = 0; c < 6; c++) {
+            while (*p == ' ' || *p == '\t' || (c > 0 &&
+                  (*p == ',' || *p == ';'))) {
+              p++;
+            }
+            char *next;
+            float v = std::strtof(p, &next);
+            if (next == p || *p == '\n' || *p == '\r') {
+              // Keep the first bad row, for the error message
+              size_t seen = badRow.load();
+              while (row < seen && !badRow.compare_exchange_weak(seen, row)) {
+              }
+              return;
+            }
+            dst[c][row] = v;
+            p = next;
+          }
+          row++;
+          });
+      });
+  if (badRow != SIZE_MAX) {
+    throw std::runtime_error("Particle " + std::to_string(badRow + 1) +
+        " of " + path + " doesn't have 6 values");
+  }
+}
+
+InitialConditionFile::InitialConditionFile(const std::string &path_,
+    ICFormat format_)
+  : path(path_), format(resolveFormat(path_, format_)) {
+  switch (format) {
+    case ICFormat::BINARY:
+      numParticles = binaryCount(path, MappedFile(path));
+      break;
+    case ICFormat::CSV:
+      csv = std::make_unique<CsvText>(path);
+      numParticles = csv->numRows();
+      break;
+    default:
+      numParticles = GadgetFile(path).numParticles();
+  }
+}
+
+InitialConditionFile::~InitialConditionFile() = default;
+
+void InitialConditionFile::load(float *const pos[3],
+    float *const vel[3]) const {
+  float *const dst[6] = {pos[0], pos[1], pos[2], vel[0], vel[1], vel[2]};
+  switch (format) {
+    case ICFormat::BINARY:
+      loadBinary(path, dst);
+      break;
+    case ICFormat::CSV:
+      csv->read(path, dst);
+      break;
+    default: {
+      GadgetFile gadget(path);
+      gadget.readBlock(0, pos);
+      gadget.readBlock(1, vel);
+    }
+  }
+}
+
+SimParam withInitialConditionParams(const SimParam &params,
+    std::unique_ptr<InitialConditionFile> &file) {
+  if (params.icFile.empty() || !params.restartFile.empty()) return params;
+  file = std::make_unique<InitialConditionFile>(params.icFile,
+      params.icFormat);
+  SimParam result = params;
+  result.numParticles = file->count();
+  return result;
+}
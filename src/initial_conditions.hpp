@@ -0,0 +1,66 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "sim_param.hpp"
+
+/**
+ * Initial conditions read from a file produced by another tool, in one of
+ * the formats of ICFormat:
+ *   BINARY  headerless little-endian float32 SoA: the x, y, z, vx, vy & vz
+ *           arrays one after another, so the file holds 24 bytes a particle
+ *   CSV     one particle a line, x, y, z, vx, vy & vz separated by commas,
+ *           semicolons or blanks. Further columns are ignored, as are a
+ *           header line, blank lines & lines starting with #.
+ *   GADGET  single file GADGET-2 snapshot in format 1 (SnapFormat=1), of
+ *           either byte order & float or double precision. The positions &
+ *           velocities of every particle type are read, in type order.
+ *           Masses are ignored, as every particle has the same mass here.
+ * ICFormat::AUTO picks BINARY for .bin & .soa files, CSV for .csv & .txt
+ * files & otherwise GADGET, if the file starts like one.
+ */
+
+/**
+ * An initial conditions file, opened to count its particles & then
+ * loaded. A CSV file is read & split into rows once, when opened, & held
+ * until the InitialConditionFile is destroyed.
+ */
+class InitialConditionFile {
+  public:
+    InitialConditionFile(const std::string &path, ICFormat format);
+    ~InitialConditionFile();
+
+    size_t count() const { return numParticles; }
+
+    /**
+     * Reads the particles into pos & vel, which hold count() elements per
+     * component
+     */
+    void load(float *const pos[3], float *const vel[3]) const;
+
+    InitialConditionFile(const InitialConditionFile &) = delete;
+    InitialConditionFile &operator=(const InitialConditionFile &) = delete;
+
+  private:
+    class CsvText;
+
+    std::string path;
+    ICFormat format;  ///< Resolved, never ICFormat::AUTO
+    size_t numParticles = 0;
+    std::unique_ptr<CsvText> csv;  ///< The parsed text of a CSV file
+};
+
+/**
+ * params with numParticles set from params.icFile, if set & not restarting
+ * from a checkpoint (which takes precedence)
+ * @param file set to the opened params.icFile, for loading (else left
+ * empty)
+ */
+SimParam withInitialConditionParams(const SimParam &params,
+    std::unique_ptr<InitialConditionFile> &file);
@@ -0,0 +1,72 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "morton.cuh"
+
+#include <utility>
+
+namespace simulation {
+
+  __global__ void morton_keys(ParticleData_d pos, size_t n, vec3 origin,
+      coords_t invExtent, uint32_t *keys, uint32_t *perm) {
+    size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n) return;
+    keys[i] = mortonKey((pos.x[i] - origin.x) * invExtent,
+        (pos.y[i] - origin.y) * invExtent, (pos.z[i] - origin.z) * invExtent);
+    perm[i] = i;
+  }
+
+  // Gather every array through the sorted permutation
+  __global__ void morton_gather(const uint32_t *perm, size_t n,
+      ParticleData_d pos, ParticleData_d posOut, ParticleData_d vel,
+      ParticleData_d velOut, const uint32_t *ids, uint32_t *idsOut) {
+    size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n) return;
+    uint32_t src = perm[i];
+    posOut.x[i] = pos.x[src];
+    posOut.y[i] = pos.y[src];
+    posOut.z[i] = pos.z[src];
+    velOut.x[i] = vel.x[src];
+    velOut.y[i] = vel.y[src];
+    velOut.z[i] = vel.z[src];
+    idsOut[i] = ids[src];
+  }
+
+  MortonReorder::MortonReorder(size_t n_)
+    : n(n_), sorter(n_), velAlt(n_) {
+      gpuErrchk(cudaMalloc((void **)&keys, sizeof(uint32_t) * n));
+      gpuErrchk(cudaMalloc((void **)&perm, sizeof(uint32_t) * n));
+      gpuErrchk(cudaMalloc((void **)&idsAlt, sizeof(uint32_t) * n));
+    }
+
+  MortonReorder::~MortonReorder() {
+    cudaFree(keys);
+    cudaFree(perm);
+    cudaFree(idsAlt);
+    cudaFree(velAlt.x);
+    cudaFree(velAlt.y);
+    cudaFree(velAlt.z);
+  }
+
+  void MortonReorder::apply(ParticleData_d &pos, ParticleData_d &posAlt,
+      ParticleData_d &vel, uint32_t *&ids) {
+    Bounds b = computeBounds(pos, n);
+    // Cubic cell so the curve isn't stretched along the longest axis
+    coords_t extent = fmaxf(b.max.x - b.min.x,
+        fmaxf(b.max.y - b.min.y, b.max.z - b.min.z));
+    coords_t invExtent = extent > 0 ? coords_t(1) / extent : coords_t(0);
+
+    const int threads = 256;
+    const int blocks = (n + threads - 1) / threads;
+    morton_keys<<<blocks, threads>>>(pos, n, b.min, invExtent, keys, perm);
+    sorter.sort(keys, perm, n, 3 * MORTON_BITS);
+    morton_gather<<<blocks, threads>>>(perm, n, pos, posAlt, vel, velAlt,
+        ids, idsAlt);
+
+    std::swap(pos, posAlt);
+    std::swap(vel, velAlt);
+    std::swap(ids, idsAlt);
+  }
+
+}  // namespace simulation
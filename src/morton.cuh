@@ -0,0 +1,70 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "device_util.cuh"
+#include "simulator.cuh"
+
+namespace simulation {
+
+  // Bits per axis in a Morton key
+  constexpr int MORTON_BITS = 10;
+
+  // Spreads the low 10 bits of v so that there are two zero bits between
+  // each of them
+  HOSTDEV inline uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+  }
+
+  // 30 bit Morton key of a point, given its position scaled to the unit
+  // cube. Points outside the cube are clamped to its faces.
+  HOSTDEV inline uint32_t mortonKey(coords_t x, coords_t y, coords_t z) {
+    const coords_t scale = 1 << MORTON_BITS;
+    const coords_t top = scale - 1;
+    uint32_t xi = fminf(fmaxf(x * scale, coords_t(0)), top);
+    uint32_t yi = fminf(fmaxf(y * scale, coords_t(0)), top);
+    uint32_t zi = fminf(fmaxf(z * scale, coords_t(0)), top);
+    return (expandBits(xi) << 2) | (expandBits(yi) << 1) | expandBits(zi);
+  }
+
+  /*
+     Reorders the particle SoA arrays along a Z-order (Morton) curve, so
+     that particles which are close in space are also close in memory.
+
+     The original index of the particle held in each slot is carried along
+     in an id array, so that results can be mapped back to the order the
+     particles were generated in.
+   */
+  class MortonReorder {
+    public:
+      MortonReorder(size_t n_);
+      ~MortonReorder();
+
+      MortonReorder(const MortonReorder &) = delete;
+      MortonReorder &operator=(const MortonReorder &) = delete;
+
+      // Sorts pos, vel & ids by Morton key. pos is gathered into posAlt &
+      // the two are swapped, while vel & ids are swapped with buffers held
+      // by this object.
+      void apply(ParticleData_d &pos, ParticleData_d &posAlt,
+          ParticleData_d &vel, uint32_t *&ids);
+
+    private:
+      size_t n;
+      RadixSorter sorter;
+      uint32_t *keys = nullptr;
+      uint32_t *perm = nullptr;
+      uint32_t *idsAlt = nullptr;
+      ParticleData_d velAlt;
+  };
+
+}  // namespace simulation
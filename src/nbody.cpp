@@ -4,6 +4,7 @@
 #include <iostream>
 #include <chrono>
 #include <cstdlib>
+#include <csignal>
 
 #ifndef DISABLE_GL
 #include <GL/glew.h>
@@ -17,23 +18,73 @@
 #include <cmath>
 #endif
 
+#include <map>
+#include <memory>
 #include <thread>
+#include <string>
 #include <vector>
-#include <numeric>
 #include <algorithm>
 
+#include "conservation.hpp"
+#include "frame_timer.hpp"
 #include "sim_param.hpp"
+#include "stream_stats.hpp"
+#include "trace_writer.hpp"
+#include "trajectory.hpp"
 #include "simulator.cuh"
 
 using namespace std;
 using namespace simulation;
 
+// Set by SIGTERM, e.g. when a preemptible node is reclaimed
+static volatile std::sig_atomic_t terminateRequested = 0;
+
+// Mean, spread & tail of the step times so far
+static void printStepStats(const StreamStats &stats) {
+  std::cout << "mean is " << stats.mean() << " and stddev is: "
+    << stats.stddev() << " (min " << stats.min() << " p50 " << stats.p50()
+    << " p95 " << stats.p95() << " p99 " << stats.p99() << " max "
+    << stats.max() << ")\n";
+}
+
 int main(int argc, char **argv) {
 
   SimParam params;
   params.parseArgs(argc, argv);
+  if (params.timings || !params.traceFile.empty()) {
+    FrameTimer::get().enable();
+    FrameTimer::get().nameThread("main");
+  }
 
   DiskGalaxySimulator nbodySim(params);
+  std::signal(SIGTERM, [](int) { terminateRequested = 1; });
+
+  // Written by one process of a distributed run
+  std::unique_ptr<TrajectoryWriter> trajectory;
+  if (!params.trajectoryFile.empty() && nbodySim.getRank() == 0) {
+    trajectory = std::make_unique<TrajectoryWriter>(params.trajectoryFile,
+      nbodySim.getNumParticles(), params.trajPosError,
+      params.trajVelError, params.trajKeyframe);
+  }
+
+  std::unique_ptr<TraceWriter> trace;
+  if (!params.traceFile.empty() && nbodySim.getRank() == 0) {
+    trace = std::make_unique<TraceWriter>(params.traceFile);
+  }
+
+  // Drift from the conserved quantities at the start
+  std::unique_ptr<ConservationMonitor> conservation;
+  if (params.diagEvery > 0 && nbodySim.getRank() == 0) {
+    conservation =
+      std::make_unique<ConservationMonitor>(nbodySim.getConserved());
+  }
+
+  // Written on a background thread, from a pool of host buffers
+  std::unique_ptr<SnapshotWriter> snapshots;
+  if (params.snapshotEvery > 0) {
+    snapshots = std::make_unique<SnapshotWriter>(nbodySim.getParams(),
+      params.snapshotBuffers);
+  }
 
 #ifndef DISABLE_GL
   // Window initialization
@@ -80,7 +131,7 @@ int main(int argc, char **argv) {
   float last_fps{0};
 #endif
 
-  std::vector<float> stepTimes;
+  StreamStats stepStats;
   int step{0};
 
   // Main loop
@@ -94,6 +145,7 @@ int main(int argc, char **argv) {
 #else
     while ( step < params.numFrames) {
 #endif
+      const double frameStart = FrameTimer::get().now();
       nbodySim.stepSim();
 #ifndef DISABLE_GL
       renderer.updateParticles();
@@ -107,23 +159,65 @@ int main(int argc, char **argv) {
       step++;
       int warmSteps{2};
       if (step > warmSteps) {
-        stepTimes.push_back(nbodySim.getLastStepTime());
-        float cumStepTime =
-          std::accumulate(stepTimes.begin(), stepTimes.end(), 0.0);
-        float meanTime = cumStepTime / stepTimes.size();
-        float accum{0.0};
-        std::for_each(stepTimes.begin(), stepTimes.end(),
-            [&](const float time) {
-            accum += std::pow((time - meanTime), 2);
-            });
-        float stdDev = std::pow(accum / stepTimes.size(), 0.5);
-        std::cout << "At step " << step << " kernel time is "
-          << stepTimes.back() << " and mean is " << meanTime
-          << " and stddev is: " << stdDev << "\n";
+        stepStats.add(nbodySim.getLastStepTime());
+        if ((step - warmSteps) % params.statsEvery == 0) {
+          std::cout << "At step " << step << " kernel time is "
+            << nbodySim.getLastStepTime() << " and ";
+          printStepStats(stepStats);
+        }
+      }
+      // Empty where --profile doesn't apply, e.g. with --streamTile
+      if (!nbodySim.getDeviceIntervals().empty()) {
+        // Device time of each phase, summed over the step's iterations
+        std::map<std::string, float> phaseTimes;
+        for (const DeviceInterval &interval : nbodySim.getDeviceIntervals()) {
+          phaseTimes[interval.name] += interval.end - interval.start;
+        }
+        std::cout << "At step " << step << " device time is";
+        for (const auto &[phase, time] : phaseTimes) {
+          std::cout << " " << phase << " " << time;
+        }
+        std::cout << "\n";
+      }
+      if (conservation && step % params.diagEvery == 0) {
+        conservation->report(std::cout, step, nbodySim.getConserved());
+      }
+      if (trajectory && step % params.trajectoryEvery == 0) {
+        const ParticleData &p = nbodySim.getParticlePos();
+        const ParticleData &v = nbodySim.getParticleVel();
+        const float *pos[3] = {p.x.data(), p.y.data(), p.z.data()};
+        const float *vel[3] = {v.x.data(), v.y.data(), v.z.data()};
+        trajectory->write(step, pos, vel, nbodySim.getParticleIds().data());
+      }
+      // Only blocks if every snapshot buffer is still waiting to be written
+      if (snapshots && step % params.snapshotEvery == 0) {
+        Snapshot *snapshot = snapshots->acquire();
+        if (nbodySim.takeSnapshot(*snapshot)) {
+          snapshots->submit(snapshot,
+              snapshotPath(params.snapshotPrefix, snapshot->step));
+        } else {
+          snapshots->release(snapshot);
+        }
+      }
+      // Checkpoint periodically & before exiting on SIGTERM. The ranks of
+      // a distributed run may receive it at different steps, so they stop
+      // together, or those left would block on the next exchange.
+      bool terminating = nbodySim.anyRank(terminateRequested != 0);
+      if (terminating || (params.checkpointEvery > 0 &&
+            step % params.checkpointEvery == 0)) {
+        nbodySim.saveCheckpoint(params.checkpointFile);
+      }
+      if (terminating) {
+        std::cout << "Terminated at step " << step << ", checkpoint written to "
+          << params.checkpointFile << "\n";
+        break;
       }
 #ifndef DISABLE_GL
       // Window refresh
-      glfwSwapBuffers(window);
+      {
+        ScopedTimer timer("swapBuffers");
+        glfwSwapBuffers(window);
+      }
       glfwPollEvents();
 
       // Thread sleep to match min frame time
@@ -131,11 +225,23 @@ int main(int argc, char **argv) {
       double elapsed = frame_end - frame_start;
       last_fps = 1.0 / elapsed;
 #endif
+      if (FrameTimer::get().enabled()) {
+        FrameTimer &frameTimer = FrameTimer::get();
+        frameTimer.add("frame", PhaseTrack::HOST, frameStart, frameTimer.now());
+        const std::vector<FramePhase> phases = frameTimer.endFrame();
+        if (params.timings) FrameTimer::print(std::cout, step, phases);
+        if (trace) trace->write(step, phases);
+      }
     }
 #ifndef DISABLE_GL
     renderer.destroy();
     glfwDestroyWindow(window);
     glfwTerminate();
 #endif
+    if (stepStats.count() > 0) {
+      std::cout << "Over " << stepStats.count() << " steps kernel time ";
+      printStepStats(stepStats);
+    }
+    if (snapshots) snapshots->flush();
     return 0;
   }
@@ -0,0 +1,40 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * Threads host work is split between, one per hardware thread
+ */
+inline size_t numHostThreads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * Runs f(chunk, numChunks) for every chunk, one thread each, the calling
+ * thread taking chunk 0
+ */
+template <typename F>
+void parallelChunks(size_t numChunks, F &&f) {
+  std::vector<std::thread> threads;
+  for (size_t c = 1; c < numChunks; c++) threads.emplace_back(f, c, numChunks);
+  f(0, numChunks);
+  for (auto &t : threads) t.join();
+}
+
+/**
+ * Runs f(begin, end, chunk) over numHostThreads() contiguous slices of
+ * [0, n), in parallel
+ */
+template <typename F>
+void parallelRanges(size_t n, F &&f) {
+  parallelChunks(numHostThreads(), [&](size_t chunk, size_t numChunks) {
+      f(n * chunk / numChunks, n * (chunk + 1) / numChunks, chunk);
+      });
+}
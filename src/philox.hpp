@@ -0,0 +1,52 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef __CUDACC__
+#define PHILOX_HOSTDEV __host__ __device__
+#else
+#define PHILOX_HOSTDEV
+#endif
+
+/**
+ * Philox4x32-10 counter-based random number generator (Salmon et al.,
+ * "Parallel Random Numbers: As Easy as 1, 2, 3", SC11). Each (counter,
+ * key) pair maps to four independent 32 bit values with no state carried
+ * between calls, so values can be drawn for any particle, on any thread &
+ * in any order, with the same result.
+ */
+struct Philox4x32 {
+  uint32_t v[4];
+};
+
+PHILOX_HOSTDEV inline Philox4x32 philox4x32(Philox4x32 counter,
+    uint64_t key) {
+  const uint32_t M0 = 0xD2511F53;
+  const uint32_t M1 = 0xCD9E8D57;
+  const uint32_t W0 = 0x9E3779B9;
+  const uint32_t W1 = 0xBB67AE85;
+  uint32_t k0 = uint32_t(key);
+  uint32_t k1 = uint32_t(key >> 32);
+  uint32_t *c = counter.v;
+  for (int round = 0; round < 10; round++) {
+    uint64_t p0 = uint64_t(M0) * c[0];
+    uint64_t p1 = uint64_t(M1) * c[2];
+    uint32_t next[4] = {uint32_t(p1 >> 32) ^ c[1] ^ k0, uint32_t(p1),
+      uint32_t(p0 >> 32) ^ c[3] ^ k1, uint32_t(p0)};
+    for (int i = 0; i < 4; i++) c[i] = next[i];
+    k0 += W0;
+    k1 += W1;
+  }
+  return counter;
+}
+
+/**
+ * Uniform float in [0, 1), from the top 24 bits of x
+ */
+PHILOX_HOSTDEV inline float uniformFloat(uint32_t x) {
+  return (x >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,47 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "profiler.cuh"
+
+namespace simulation {
+
+  DeviceProfiler::~DeviceProfiler() {
+    for (cudaEvent_t event : events) cudaEventDestroy(event);
+  }
+
+  cudaEvent_t DeviceProfiler::nextEvent() {
+    if (used == events.size()) {
+      cudaEvent_t event;
+      gpuErrchk(cudaEventCreate(&event));
+      events.push_back(event);
+    }
+    return events[used++];
+  }
+
+  void DeviceProfiler::start() {
+    used = 0;
+    phases.clear();
+    gpuErrchk(cudaEventRecord(nextEvent()));
+  }
+
+  void DeviceProfiler::mark(const char *phase) {
+    phases.push_back(phase);
+    gpuErrchk(cudaEventRecord(nextEvent()));
+  }
+
+  float DeviceProfiler::collect(std::vector<DeviceInterval> &intervals) {
+    intervals.clear();
+    if (phases.empty()) return 0;
+    gpuErrchk(cudaEventSynchronize(events[used - 1]));
+    float begin = 0;
+    for (size_t i = 0; i < phases.size(); i++) {
+      float end;
+      gpuErrchk(cudaEventElapsedTime(&end, events[0], events[i + 1]));
+      intervals.push_back({phases[i], begin, end});
+      begin = end;
+    }
+    return begin;
+  }
+
+}  // namespace simulation
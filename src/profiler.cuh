@@ -0,0 +1,45 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <vector>
+
+#include "simulator.cuh"
+
+namespace simulation {
+
+  /*
+     Times the phases of a step on the device, from events recorded on the
+     default stream between them. A phase lasts from the previous event to
+     its own, so it includes any time the device waited for the host to
+     launch its kernels, but not launch overhead or host synchronization.
+   */
+  class DeviceProfiler {
+    public:
+      DeviceProfiler() = default;
+      ~DeviceProfiler();
+
+      DeviceProfiler(const DeviceProfiler &) = delete;
+      DeviceProfiler &operator=(const DeviceProfiler &) = delete;
+
+      // Starts a step
+      void start();
+      // Ends the phase of the work launched since the previous mark (or
+      // the start)
+      void mark(const char *phase);
+      // Phases marked since start, once the device has finished them
+      // @return device time from the start to the last mark, in ms
+      float collect(std::vector<DeviceInterval> &intervals);
+
+    private:
+      cudaEvent_t nextEvent();
+
+      // Reused from step to step, events[0] is the start
+      std::vector<cudaEvent_t> events;
+      std::vector<const char *> phases;
+      size_t used = 0;
+  };
+
+}  // namespace simulation
@@ -14,6 +14,7 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include "gen.hpp"
+#include "frame_timer.hpp"
 
 const int FBO_MARGIN = 50;
 
@@ -43,6 +44,7 @@ void RendererGL::init(GLFWwindow *window, int width, int height,
   initShaders();
   initFbos();
   setUniforms();
+  glGenQueries(2 * NUM_PASS_QUERIES, &passQueries[0][0]);
 }
 
 void RendererGL::setWindowDimensions(int width, int height) {
@@ -155,6 +157,7 @@ void RendererGL::printKernelTime(float kernelTime) {
 
 void RendererGL::setParticleData(const GLuint buffer,
     const ParticleData &data) {
+  ScopedTimer timer("setParticleData");
   void *particle_ptr = glMapNamedBufferRange(
       buffer, 0, numParticles * sizeof(glm::vec4), GL_MAP_WRITE_BIT);
 
@@ -249,6 +252,12 @@ void RendererGL::setUniforms() {
 }
 
 void RendererGL::render(glm::mat4 proj_mat, glm::mat4 view_mat) {
+  ScopedTimer timer("render");
+  // GPU timestamps between the passes, with --timings=1
+  const bool timing = FrameTimer::get().enabled();
+  const GLuint *queries = passQueries[renderedFrames % 2];
+  if (timing) glQueryCounter(queries[0], GL_TIMESTAMP);
+
   // Particle HDR rendering
   glViewport(0, 0, width_ + 2 * FBO_MARGIN, height_ + 2 * FBO_MARGIN);
   glBindVertexArray(vaoParticles);
@@ -264,6 +273,7 @@ void RendererGL::render(glm::mat4 proj_mat, glm::mat4 view_mat) {
   glBindTextureUnit(0, flareTex);
   glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
   glDrawArrays(GL_POINTS, 0, numParticles);
+  if (timing) glQueryCounter(queries[1], GL_TIMESTAMP);
 
   glBindVertexArray(vaoDeferred);
   glDisable(GL_BLEND);
@@ -290,6 +300,7 @@ void RendererGL::render(glm::mat4 proj_mat, glm::mat4 view_mat) {
       loop++;
     }
   }
+  if (timing) glQueryCounter(queries[2], GL_TIMESTAMP);
 
   // Average luminance
   glViewport(0, 0, (width_ + 2 * FBO_MARGIN) / 2,
@@ -299,6 +310,7 @@ void RendererGL::render(glm::mat4 proj_mat, glm::mat4 view_mat) {
   glBindTextureUnit(0, attachs[0]);
   glDrawArrays(GL_TRIANGLES, 0, 3);
   glGenerateTextureMipmap(attachs[3]);
+  if (timing) glQueryCounter(queries[3], GL_TIMESTAMP);
 
   // Tonemapping step (direct to screen)
   glViewport(0, 0, width_, height_);
@@ -309,6 +321,36 @@ void RendererGL::render(glm::mat4 proj_mat, glm::mat4 view_mat) {
   glBindTextureUnit(1, attachs[2]);
   glBindTextureUnit(2, attachs[3]);
   glDrawArrays(GL_TRIANGLES, 0, 3);
+  if (timing) {
+    glQueryCounter(queries[4], GL_TIMESTAMP);
+    // The previous frame's queries, which have had a frame to complete
+    if (renderedFrames > 0) {
+      readPassTimes(passQueries[(renderedFrames - 1) % 2]);
+    }
+    renderedFrames++;
+  }
+}
+
+void RendererGL::readPassTimes(const GLuint *queries) {
+  static const char *const passes[NUM_PASS_QUERIES - 1] = {"hdr", "blur",
+    "luminance", "tonemap"};
+  GLuint64 stamps[NUM_PASS_QUERIES];
+  for (int i = 0; i < NUM_PASS_QUERIES; i++) {
+    glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &stamps[i]);
+  }
+  // From nanoseconds on the GPU clock to the host's, by the current time of
+  // each
+  GLint64 gpuNow;
+  glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+  FrameTimer &frameTimer = FrameTimer::get();
+  const double hostNow = frameTimer.now();
+  auto hostTime = [&](GLuint64 stamp) {
+    return hostNow - (gpuNow - GLint64(stamp)) / 1000.0;
+  };
+  for (int i = 0; i < NUM_PASS_QUERIES - 1; i++) {
+    frameTimer.add(passes[i], PhaseTrack::GL, hostTime(stamps[i]),
+        hostTime(stamps[i + 1]));
+  }
 }
 
 std::vector<float> RendererGL::gaussKernel(const float sigma,
@@ -47,6 +47,10 @@ class RendererGL : public Renderer {
     // Send data obtained from simulation to a buffer
     void setParticleData(const GLuint buffer, const ParticleData &data);
 
+    // Adds the GPU time of each render pass to the FrameTimer, from a
+    // frame's timestamp queries
+    void readPassTimes(const GLuint *queries);
+
     // Compute the 1D gaussian kernel for given sigma & halfwidth
     static std::vector<float> gaussKernel(const float sigma,
         const int halfwidth);
@@ -82,4 +86,9 @@ class RendererGL : public Renderer {
 
     size_t numParticles;
     size_t computeIterations;
+
+    /** Render pass timing, with --timings=1 **/
+    static constexpr int NUM_PASS_QUERIES = 5;  ///< Timestamps around 4 passes
+    GLuint passQueries[2][NUM_PASS_QUERIES];    ///< Double buffered by frame
+    size_t renderedFrames = 0;  ///< Frames rendered with timing queries
 };
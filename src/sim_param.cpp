@@ -6,8 +6,11 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <algorithm>
 #include <cstdlib>
 #include <cstdint>
+#include <stdexcept>
+#include <vector>
 
 SimParam::SimParam() {
   G = 2.0;
@@ -19,6 +22,50 @@ SimParam::SimParam() {
   distEps = 1.0e-7;
   gwSize = 64;
   calcMethod = CalculationMethod::BRANCH;
+  accumMethod = AccumulationMethod::FLOAT;
+  specialize = false;
+  reorderInterval = 0;
+  solver = Solver::DIRECT;
+  cutoff = 10.0;
+  cellSkin = 1.0;
+  cellRebuildInterval = 4;
+  boxSize = 256.0;
+  pmGrid = 64;
+  pmSplit = 1.25;
+  treeTheta = 0.5;
+  devicePartition = DevicePartition::SINGLE;
+  deviceExchange = DeviceExchange::ALLGATHER;
+  virtualDevices = 0;
+  transport = TransportKind::NONE;
+  rank = 0;
+  numRanks = 1;
+  shmName = "/nbody";
+  shmToken = "";
+  streamTile = 0;
+  streamPool = 3;
+  checkpointFile = "nbody.ckpt";
+  checkpointEvery = 0;
+  snapshotEvery = 0;
+  snapshotPrefix = "snapshot";
+  snapshotBuffers = 2;
+  trajectoryEvery = 1;
+  trajPosError = 1e-3;
+  trajVelError = 1e-3;
+  trajKeyframe = 32;
+  icFormat = ICFormat::AUTO;
+  profile = false;
+  seed = 0;
+  model = GalaxyModel::DISK;
+  modelScale = 10.0;
+  concentration = 10.0;
+  haloFraction = 0.8;
+  collisionDistance = 200.0;
+  collisionImpact = 20.0;
+  timings = false;
+  statsEvery = 1;
+  autotune = true;
+  tuneCache = "nbody_tune.txt";
+  diagEvery = 0;
 }
 
 // Set the calculation method from the given string
@@ -37,31 +84,295 @@ CalculationMethod getCalculationMethod(const std::string& method) {
   }
 }
 
+const char *calculationMethodName(CalculationMethod method) {
+  return method == CalculationMethod::BRANCH ? "BRANCH" : "PREDICATED";
+}
+
+// Set the force accumulation method from the given string
+AccumulationMethod getAccumulationMethod(const std::string& method) {
+
+  static const std::map<std::string, AccumulationMethod> methodMap = {
+    {"FLOAT", AccumulationMethod::FLOAT},
+    {"KAHAN", AccumulationMethod::KAHAN},
+    {"DOUBLE", AccumulationMethod::DOUBLE}
+  };
+
+  auto it = methodMap.find(method);
+  if (it != methodMap.end()) {
+    return it->second;
+  } else {
+    throw std::invalid_argument("Valid accumulation methods are FLOAT, KAHAN or DOUBLE");
+  }
+}
+
+const char *accumulationMethodName(AccumulationMethod method) {
+  switch (method) {
+    case AccumulationMethod::KAHAN:
+      return "KAHAN";
+    case AccumulationMethod::DOUBLE:
+      return "DOUBLE";
+    default:
+      return "FLOAT";
+  }
+}
+
+// Set the force solver from the given string
+Solver getSolver(const std::string& solver) {
+
+  static const std::map<std::string, Solver> solverMap = {
+    {"DIRECT", Solver::DIRECT},
+    {"CUTOFF", Solver::CUTOFF},
+    {"TREEPM", Solver::TREEPM}
+  };
+
+  auto it = solverMap.find(solver);
+  if (it != solverMap.end()) {
+    return it->second;
+  } else {
+    throw std::invalid_argument("Valid solvers are DIRECT, CUTOFF or TREEPM");
+  }
+}
+
+// Set the device partitioning from the given string
+DevicePartition getDevicePartition(const std::string& partition) {
+
+  static const std::map<std::string, DevicePartition> partitionMap = {
+    {"SINGLE", DevicePartition::SINGLE},
+    {"PLATFORM", DevicePartition::PLATFORM},
+    {"NUMA", DevicePartition::NUMA}
+  };
+
+  auto it = partitionMap.find(partition);
+  if (it != partitionMap.end()) {
+    return it->second;
+  } else {
+    throw std::invalid_argument("Valid device partitions are SINGLE, PLATFORM or NUMA");
+  }
+}
+
+// Set the multi-device exchange scheme from the given string
+DeviceExchange getDeviceExchange(const std::string& exchange) {
+
+  static const std::map<std::string, DeviceExchange> exchangeMap = {
+    {"ALLGATHER", DeviceExchange::ALLGATHER},
+    {"RING", DeviceExchange::RING}
+  };
+
+  auto it = exchangeMap.find(exchange);
+  if (it != exchangeMap.end()) {
+    return it->second;
+  } else {
+    throw std::invalid_argument("Valid device exchanges are ALLGATHER or RING");
+  }
+}
+
+// Set the inter-process transport from the given string
+TransportKind getTransportKind(const std::string& transport) {
+
+  static const std::map<std::string, TransportKind> transportMap = {
+    {"NONE", TransportKind::NONE},
+    {"SHM", TransportKind::SHM},
+    {"MPI", TransportKind::MPI}
+  };
+
+  auto it = transportMap.find(transport);
+  if (it != transportMap.end()) {
+    return it->second;
+  } else {
+    throw std::invalid_argument("Valid transports are NONE, SHM or MPI");
+  }
+}
+
+// Set the initial conditions file format from the given string
+ICFormat getICFormat(const std::string& format) {
+
+  static const std::map<std::string, ICFormat> formatMap = {
+    {"AUTO", ICFormat::AUTO},
+    {"BINARY", ICFormat::BINARY},
+    {"CSV", ICFormat::CSV},
+    {"GADGET", ICFormat::GADGET}
+  };
+
+  auto it = formatMap.find(format);
+  if (it != formatMap.end()) {
+    return it->second;
+  } else {
+    throw std::invalid_argument("Valid initial condition formats are AUTO, "
+        "BINARY, CSV or GADGET");
+  }
+}
+
+// Set the generated galaxy model from the given string
+GalaxyModel getGalaxyModel(const std::string& model) {
+
+  static const std::map<std::string, GalaxyModel> modelMap = {
+    {"DISK", GalaxyModel::DISK},
+    {"PLUMMER", GalaxyModel::PLUMMER},
+    {"HERNQUIST", GalaxyModel::HERNQUIST},
+    {"NFW", GalaxyModel::NFW},
+    {"EXPDISK", GalaxyModel::EXPDISK},
+    {"COLLISION", GalaxyModel::COLLISION}
+  };
+
+  auto it = modelMap.find(model);
+  if (it != modelMap.end()) {
+    return it->second;
+  } else {
+    throw std::invalid_argument("Valid models are DISK, PLUMMER, HERNQUIST, "
+        "NFW, EXPDISK or COLLISION");
+  }
+}
+
 void SimParam::parseArgs(int argc, char **argv) {
+  // Split named (--name=value) arguments from the positional ones
+  std::vector<char *> args;
+  std::map<std::string, std::string> named;
+  for (int i = 0; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (i > 0 && arg.rfind("--", 0) == 0) {
+      size_t eq = arg.find('=');
+      if (eq == std::string::npos) {
+        throw std::invalid_argument("Expected --name=value, got " + arg);
+      }
+      named[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  argc = args.size();
+
   // First argument if existing = number of particle batches (256 per batch)
-  if (argc >= 2) numParticles = 256 * atoi(argv[1]);
+  if (argc >= 2) numParticles = 256 * atoi(args[1]);
 
   // Second argument if existing = number of iterations per frame
-  if (argc >= 3) simIterationsPerFrame = atoi(argv[2]);
+  if (argc >= 3) simIterationsPerFrame = atoi(args[2]);
 
   // Third argument if existing = damping parameter
-  if (argc >= 4) damping = atof(argv[3]);
+  if (argc >= 4) damping = atof(args[3]);
 
   // Fourth argument if existing = dt (timestep size) parameter
-  if (argc >= 5) dt = atof(argv[4]);
+  if (argc >= 5) dt = atof(args[4]);
 
   // Fifth argument if existing = distEps (minimum inter-particle distance) parameter
-  if (argc >= 6) distEps = atof(argv[5]);
+  if (argc >= 6) distEps = atof(args[5]);
 
   // Sixth argument if existing = G (gravity) parameter
-  if (argc >= 7) G = atof(argv[6]);
+  if (argc >= 7) G = atof(args[6]);
 
   // Seventh argument if existing = number of frames to simulate
-  if (argc >= 8) numFrames = atoi(argv[7]);
+  if (argc >= 8) numFrames = atoi(args[7]);
 
   // Eighth argument if existing = the work group size
-  if (argc >= 9) gwSize = atoi(argv[8]);
+  if (argc >= 9) gwSize = atoi(args[8]);
 
   // Ninth argument if existing = the calculation method
-  if (argc >= 10) calcMethod = getCalculationMethod(argv[9]);
+  if (argc >= 10) calcMethod = getCalculationMethod(args[9]);
+
+  // An explicit launch configuration isn't tuned
+  if (argc >= 9) autotune = false;
+
+  // Named arguments
+  for (const auto &[name, value] : named) {
+    if (name == "accum") {
+      accumMethod = getAccumulationMethod(value);
+    } else if (name == "specialize") {
+      specialize = atoi(value.c_str()) != 0;
+    } else if (name == "reorder") {
+      reorderInterval = atoi(value.c_str());
+    } else if (name == "solver") {
+      solver = getSolver(value);
+    } else if (name == "cutoff") {
+      cutoff = atof(value.c_str());
+    } else if (name == "skin") {
+      cellSkin = atof(value.c_str());
+    } else if (name == "cellRebuild") {
+      cellRebuildInterval = std::max(1, atoi(value.c_str()));
+    } else if (name == "box") {
+      boxSize = atof(value.c_str());
+    } else if (name == "pmGrid") {
+      pmGrid = atoi(value.c_str());
+    } else if (name == "pmSplit") {
+      pmSplit = atof(value.c_str());
+    } else if (name == "theta") {
+      treeTheta = atof(value.c_str());
+    } else if (name == "devices") {
+      devicePartition = getDevicePartition(value);
+    } else if (name == "exchange") {
+      deviceExchange = getDeviceExchange(value);
+    } else if (name == "virtualDevices") {
+      virtualDevices = std::max(0, atoi(value.c_str()));
+    } else if (name == "transport") {
+      transport = getTransportKind(value);
+    } else if (name == "rank") {
+      rank = atoi(value.c_str());
+    } else if (name == "ranks") {
+      numRanks = atoi(value.c_str());
+    } else if (name == "shmName") {
+      shmName = value;
+    } else if (name == "shmToken") {
+      shmToken = value;
+    } else if (name == "streamTile") {
+      streamTile = std::max(0, atoi(value.c_str()));
+    } else if (name == "streamPool") {
+      streamPool = std::max(2, atoi(value.c_str()));
+    } else if (name == "checkpoint") {
+      checkpointFile = value;
+    } else if (name == "checkpointEvery") {
+      checkpointEvery = std::max(0, atoi(value.c_str()));
+    } else if (name == "restart") {
+      restartFile = value;
+    } else if (name == "snapshotEvery") {
+      snapshotEvery = std::max(0, atoi(value.c_str()));
+    } else if (name == "snapshot") {
+      snapshotPrefix = value;
+    } else if (name == "snapshotBuffers") {
+      snapshotBuffers = std::max(1, atoi(value.c_str()));
+    } else if (name == "trajectory") {
+      trajectoryFile = value;
+    } else if (name == "trajectoryEvery") {
+      trajectoryEvery = std::max(1, atoi(value.c_str()));
+    } else if (name == "trajPosError") {
+      trajPosError = atof(value.c_str());
+    } else if (name == "trajVelError") {
+      trajVelError = atof(value.c_str());
+    } else if (name == "trajKeyframe") {
+      trajKeyframe = std::max(1, atoi(value.c_str()));
+    } else if (name == "ic") {
+      icFile = value;
+    } else if (name == "icFormat") {
+      icFormat = getICFormat(value);
+    } else if (name == "profile") {
+      profile = atoi(value.c_str()) != 0;
+    } else if (name == "seed") {
+      seed = std::strtoull(value.c_str(), nullptr, 0);
+    } else if (name == "icCache") {
+      icCache = value;
+    } else if (name == "model") {
+      model = getGalaxyModel(value);
+    } else if (name == "modelScale") {
+      modelScale = atof(value.c_str());
+    } else if (name == "concentration") {
+      concentration = atof(value.c_str());
+    } else if (name == "haloFraction") {
+      haloFraction = std::min(1.0, std::max(0.0, atof(value.c_str())));
+    } else if (name == "collisionDistance") {
+      collisionDistance = atof(value.c_str());
+    } else if (name == "collisionImpact") {
+      collisionImpact = atof(value.c_str());
+    } else if (name == "timings") {
+      timings = atoi(value.c_str()) != 0;
+    } else if (name == "statsEvery") {
+      statsEvery = std::max(1, atoi(value.c_str()));
+    } else if (name == "trace") {
+      traceFile = value;
+    } else if (name == "autotune") {
+      autotune = atoi(value.c_str()) != 0;
+    } else if (name == "tuneCache") {
+      tuneCache = value;
+    } else if (name == "diagEvery") {
+      diagEvery = std::max(0, atoi(value.c_str()));
+    } else {
+      throw std::invalid_argument("Unknown argument --" + name);
+    }
+  }
 }
@@ -3,13 +3,82 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
+#include <string>
 
 enum class CalculationMethod {
   BRANCH,
   PREDICATED
 };
 
+enum class Solver {
+  DIRECT,  ///< All pairs interaction
+  CUTOFF,  ///< Interactions truncated at a cutoff radius, via cell lists
+  TREEPM   ///< Periodic box: particle-mesh long range + tree short range
+};
+
+enum class AccumulationMethod {
+  FLOAT,   ///< Accumulate forces directly in coords_t
+  KAHAN,   ///< coords_t accumulation with compensated (two-sum) error term
+  DOUBLE   ///< coords_t pair terms, double precision accumulator
+};
+
+enum class DevicePartition {
+  SINGLE,    ///< Default device only
+  PLATFORM,  ///< Every device of the default device's platform
+  NUMA       ///< Sub-devices of the default device, one per NUMA node
+};
+
+enum class DeviceExchange {
+  ALLGATHER,  ///< Every device holds all positions, gathered each step
+  RING        ///< Devices hold their own slice, source tiles pass around
+};
+
+enum class TransportKind {
+  NONE,  ///< Single process
+  SHM,   ///< Processes on one machine, over POSIX shared memory
+  MPI    ///< MPI ranks (needs a build with USE_MPI)
+};
+
+enum class ICFormat {
+  AUTO,    ///< From the file name or contents
+  BINARY,  ///< Headerless float32 SoA
+  CSV,     ///< x, y, z, vx, vy, vz text columns
+  GADGET   ///< GADGET-2 snapshot, format 1
+};
+
+enum class GalaxyModel {
+  DISK,       ///< Thick disk with circular velocities (not in equilibrium)
+  PLUMMER,    ///< Plummer sphere
+  HERNQUIST,  ///< Hernquist sphere
+  NFW,        ///< NFW halo
+  EXPDISK,    ///< Exponential disk in a Hernquist halo
+  COLLISION   ///< Two EXPDISK galaxies on a collision course
+};
+
+/**
+ * The CalculationMethod named method
+ * @throws std::invalid_argument for an unknown name
+ */
+CalculationMethod getCalculationMethod(const std::string &method);
+
+/**
+ * Name of method, as getCalculationMethod takes it
+ */
+const char *calculationMethodName(CalculationMethod method);
+
+/**
+ * The AccumulationMethod named method
+ * @throws std::invalid_argument for an unknown name
+ */
+AccumulationMethod getAccumulationMethod(const std::string &method);
+
+/**
+ * Name of method, as getAccumulationMethod takes it
+ */
+const char *accumulationMethodName(AccumulationMethod method);
+
 /**
  * Simulation parameters
  */
@@ -21,7 +90,9 @@ class SimParam {
     SimParam();
 
     /**
-     * Provides user-defined simulation parameters
+     * Provides user-defined simulation parameters. Positional arguments
+     * come first, optionally followed by named arguments of the form
+     * --name=value
      * @param argc number of arguments
      * @param argv arguments
      */
@@ -37,4 +108,70 @@ class SimParam {
     float distEps;  ///< Minimum distance to limit gravity of very close particles
     int gwSize;                  ///< Work group size
     CalculationMethod calcMethod;              /// Use or not branch instruction in kernel
+    AccumulationMethod accumMethod;  ///< Precision of the force accumulator
+    bool specialize;  ///< Bake numParticles, distEps, dt, G & damping into
+                      ///< the kernel at JIT/compile time
+    int reorderInterval;  ///< Steps between Morton reordering of particles
+                          ///< in memory (0 = never)
+    Solver solver;               ///< Force calculation algorithm
+    float cutoff;                ///< Interaction radius for Solver::CUTOFF
+    float cellSkin;  ///< Extra cell width covering particle movement between
+                     ///< cell list rebuilds
+    int cellRebuildInterval;     ///< Most steps between cell list rebuilds
+    float boxSize;   ///< Side of the periodic box for Solver::TREEPM
+    int pmGrid;      ///< PM mesh cells per side (power of two)
+    float pmSplit;   ///< Long/short range split scale, in mesh cells
+    float treeTheta; ///< Barnes-Hut opening angle
+    DevicePartition devicePartition;  ///< Devices sharing Solver::DIRECT
+    DeviceExchange deviceExchange;    ///< How positions move between them
+    int virtualDevices;  ///< Queues on the default device standing in for
+                         ///< separate devices (0 = use devicePartition)
+    TransportKind transport;     ///< Exchange between processes of a run
+    int rank;                    ///< This process, for TransportKind::SHM
+    int numRanks;                ///< Processes, for TransportKind::SHM
+    std::string shmName;         ///< Shared memory object for TransportKind::SHM
+    std::string shmToken;  ///< Identifies the run to its SHM ranks (empty =
+                           ///< any segment whose rank 0 is still running)
+    size_t streamTile;  ///< Particles per tile streamed through the device
+                        ///< (0 = keep every particle in device memory)
+    int streamPool;              ///< Source tiles in the streaming buffer pool
+    std::string checkpointFile;  ///< Where checkpoints are written
+    int checkpointEvery;  ///< Frames between checkpoints (0 = only when
+                          ///< terminated by SIGTERM)
+    std::string restartFile;     ///< Checkpoint to resume from (empty = none)
+    int snapshotEvery;  ///< Frames between snapshots written in the
+                        ///< background (0 = none)
+    std::string snapshotPrefix;  ///< Snapshot file names, before _step.ckpt
+    int snapshotBuffers;  ///< Host buffers for snapshots waiting to be
+                          ///< written
+    std::string trajectoryFile;  ///< Compressed trajectory (empty = none)
+    int trajectoryEvery;         ///< Frames between trajectory frames
+    float trajPosError;  ///< Maximum error of the trajectory positions
+    float trajVelError;  ///< Maximum error of the trajectory velocities
+    int trajKeyframe;            ///< Trajectory frames between key frames
+    std::string icFile;  ///< Initial conditions to read instead of
+                         ///< generating a disk (empty = generate)
+    ICFormat icFormat;           ///< Format of icFile
+    bool profile;  ///< Time the phases of each step on the device, rather
+                   ///< than the whole step on the host
+    uint64_t seed;               ///< Key of the initial condition generator
+    std::string icCache;  ///< Directory caching generated initial
+                          ///< conditions (empty = none)
+    GalaxyModel model;           ///< Generated initial conditions
+    float modelScale;            ///< Scale radius (or length) of the model
+    float concentration;         ///< Virial / scale radius of GalaxyModel::NFW
+    float haloFraction;  ///< Particles in the halo of GalaxyModel::EXPDISK
+    float collisionDistance;     ///< Initial separation of the galaxies of
+                                 ///< GalaxyModel::COLLISION
+    float collisionImpact;       ///< Their impact parameter
+    bool timings;  ///< Print where each frame's time goes, by phase on the
+                   ///< host, device (with profile) & GL
+    int statsEvery;              ///< Steps between step time summaries
+    std::string traceFile;  ///< Chrome trace of the frame phases (empty =
+                            ///< none)
+    bool autotune;  ///< Pick gwSize & calcMethod by timing them, unless
+                    ///< given as positional arguments
+    std::string tuneCache;       ///< File of tuned launch configurations
+    int diagEvery;  ///< Steps between reports of energy & momentum drift
+                    ///< (0 = none)
 };
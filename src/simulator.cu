@@ -3,6 +3,18 @@
 // For a copy, see https://opensource.org/licenses/MIT.
 
 #include "simulator.cuh"
+#include "morton.cuh"
+#include "cell_list.cuh"
+#include "treepm.cuh"
+#include "streaming.cuh"
+#include "initial_conditions.hpp"
+#include "galaxy_models.hpp"
+#include "parallel.hpp"
+#include "ic_cache.hpp"
+#include "frame_timer.hpp"
+#include "autotune.hpp"
+#include "diagnostics.cuh"
+#include "profiler.cuh"
 //#include <cstddef>
 #include <stdio.h>
 
@@ -12,27 +24,145 @@
 #include <tuple>
 #include <chrono>
 #include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
 
 namespace simulation {
 
   // Forward decl
-  template <CalculationMethod ct>
+  template <CalculationMethod ct, typename accum_t, int fixedN = 0>
   __global__ void particle_interaction(ParticleData_d pPos,
       ParticleData_d pNextPos,
-      ParticleData_d pVel, SimParam params);
+      ParticleData_d pVel, InteractionConstants k);
+
+  // Particles kept in device memory (none when streaming)
+  static size_t residentParticles(const SimParam &params) {
+    return params.streamTile > 0 ? 0 : params.numParticles;
+  }
+
+  // Every particle in the default device's memory, which can then be
+  // initialized without staging on the host
+  static bool deviceResident(const SimParam &params) {
+    return params.streamTile == 0 &&
+      params.devicePartition == DevicePartition::SINGLE &&
+      params.virtualDevices == 0 &&
+      params.transport == TransportKind::NONE;
+  }
 
   DiskGalaxySimulator::DiskGalaxySimulator(SimParam params_)
-    : params(params_),
-    pos(params_.numParticles),
-    vel(params_.numParticles),
-    pos_d(params_.numParticles),
-    vel_d(params_.numParticles),
-    pos_next_d(params_.numParticles) {
-      randomParticlePos();
-      initialParticleVel();
+    : params(withInitialConditionParams(withRestartParams(params_),
+          initialConditions)),
+    pos(params.numParticles),
+    vel(params.numParticles),
+    pos_d(residentParticles(params)),
+    vel_d(residentParticles(params)),
+    pos_next_d(residentParticles(params)) {
+#ifdef NBODY_FIXED_NUM_PARTICLES
+      const bool haveSpecialization =
+        params.numParticles == NBODY_FIXED_NUM_PARTICLES;
+#else
+      const bool haveSpecialization = false;
+#endif
+      if (params.specialize && !haveSpecialization) {
+        std::cerr << "No particle_interaction specialization compiled for "
+          << params.numParticles << " particles (see FIXED_NUM_PARTICLES), "
+          << "using the generic kernel\n";
+      }
+      if (params.devicePartition != DevicePartition::SINGLE ||
+          params.virtualDevices > 0) {
+        std::cerr << "--devices is only supported by the SYCL backend, "
+          << "using one device\n";
+      }
+      if (!params.restartFile.empty()) {
+        loadCheckpoint(
+            std::make_unique<CheckpointReader>(params.restartFile));
+      } else if (initialConditions) {
+        float *icPos[3] = {pos.x.data(), pos.y.data(), pos.z.data()};
+        float *icVel[3] = {vel.x.data(), vel.y.data(), vel.z.data()};
+        initialConditions->load(icPos, icVel);
+        initialConditions.reset();
+      } else if (!params.icCache.empty()) {
+        InitialConditionCache cache(params, generatorState());
+        if (auto cached = cache.open()) {
+          loadCheckpoint(std::move(cached));
+        } else {
+          generateParticles();
+          if (hostStale) recvFromDevice();
+          const float *icPos[3] = {pos.x.data(), pos.y.data(), pos.z.data()};
+          const float *icVel[3] = {vel.x.data(), vel.y.data(), vel.z.data()};
+          cache.store(icPos, icVel);
+        }
+      } else {
+        generateParticles();
+      }
+      if (params.streamTile > 0) {
+        if (params.solver != Solver::DIRECT || params.reorderInterval > 0 ||
+            params.transport != TransportKind::NONE) {
+          throw std::invalid_argument("--streamTile needs the DIRECT solver "
+              "without --reorder or --transport");
+        }
+        stream = std::make_unique<StreamingSolver>(params.numParticles,
+            params.streamTile, params.streamPool);
+      }
       sendToDevice();
+
+      if (ids.empty()) {
+        ids.resize(params.numParticles);
+        std::iota(ids.begin(), ids.end(), 0);
+      }
+      gpuErrchk(cudaMalloc((void **)&ids_d,
+            sizeof(uint32_t) * residentParticles(params)));
+      gpuErrchk(cudaMemcpy(ids_d, ids.data(),
+            residentParticles(params) * sizeof(uint32_t),
+            cudaMemcpyHostToDevice));
+      if (params.reorderInterval > 0) {
+        reorder = std::make_unique<MortonReorder>(params.numParticles);
+      }
+      if (params.solver == Solver::CUTOFF) {
+        cells = std::make_unique<CellList>(params.numParticles);
+      }
+      if (params.solver == Solver::TREEPM) {
+        treepm = std::make_unique<TreePM>(params);
+      }
+
+      if (params.transport != TransportKind::NONE &&
+          (params.solver != Solver::DIRECT || reorder)) {
+        throw std::invalid_argument("--transport needs the DIRECT solver "
+            "without --reorder");
+      }
+      rankCount = params.numParticles;
+      transport = makeTransport(params);
+      if (transport) {
+        auto range = rankRange(params.numParticles, transport->rank(),
+            transport->size());
+        rankBegin = range.first;
+        rankCount = range.second - range.first;
+      }
+      if (params.profile) {
+        if (stream) {
+          std::cerr << "--profile doesn't cover --streamTile, timing steps "
+            << "on the host\n";
+        } else {
+          profiler = std::make_unique<DeviceProfiler>();
+        }
+      }
+      if (params.autotune && params.solver == Solver::DIRECT && !stream &&
+          !transport) {
+        autotune();
+      }
     };
 
+  DiskGalaxySimulator::~DiskGalaxySimulator() {
+    cudaDeviceSynchronize();
+    for (ParticleData_d *p : {&pos_d, &pos_next_d, &vel_d}) {
+      cudaFree(p->x);
+      cudaFree(p->y);
+      cudaFree(p->z);
+    }
+    cudaFree(ids_d);
+  }
+
   const std::string* DiskGalaxySimulator::getDeviceName() {
     // Query the device first time only
     if(devName.empty()){
@@ -44,66 +174,288 @@ namespace simulation {
     return &devName;
   }
 
+  // Launch one step of the particle_interaction variant selected by
+  // ct & accum_t. With --specialize=1, a build configured with
+  // FIXED_NUM_PARTICLES matching numParticles uses a kernel instantiated
+  // for that count, so the trip count is a compile time constant.
+  template <CalculationMethod ct, typename accum_t>
+  void launch_interaction(ParticleData_d pos_d, ParticleData_d pos_next_d,
+      ParticleData_d vel_d, const SimParam &params,
+      const InteractionConstants &k, int nblocks, int wg_size) {
+#ifdef NBODY_FIXED_NUM_PARTICLES
+    if (params.specialize && k.numParticles == NBODY_FIXED_NUM_PARTICLES) {
+      particle_interaction<ct, accum_t, NBODY_FIXED_NUM_PARTICLES>
+        <<<nblocks, wg_size>>>(pos_d, pos_next_d, vel_d, k);
+      return;
+    }
+#endif
+    particle_interaction<ct, accum_t><<<nblocks, wg_size>>>(pos_d,
+        pos_next_d, vel_d, k);
+  }
+
+  template <CalculationMethod ct>
+  void launch_interaction(ParticleData_d pos_d, ParticleData_d pos_next_d,
+      ParticleData_d vel_d, const SimParam &params,
+      const InteractionConstants &k, int nblocks, int wg_size) {
+    dispatchAccumulator(params.accumMethod, [&](auto accum) {
+        launch_interaction<ct, decltype(accum)>(pos_d, pos_next_d, vel_d,
+            params, k, nblocks, wg_size);
+        });
+  }
+
   void DiskGalaxySimulator::stepSim() {
     // Compute updated positions
     int wg_size = getGwSize();
     int nblocks = ((getNumParticles() - 1) / wg_size) + 1;
 
-    // Profiling info - rather than using the CUDA event recording
-    // approach, we are instead measuring the time from before kernel
-    // submission until host synchronization. This is more portable via
-    // dpct.
+    // Profiling info - by default, rather than using the CUDA event
+    // recording approach, we are instead measuring the time from before
+    // kernel submission until host synchronization. This is more portable
+    // via dpct. With --profile=1, events recorded between the phases of
+    // each step time them on the device instead.
     auto start = std::chrono::steady_clock::now();
+    ScopedTimer submitTimer("submit");
+    const double submitStart = FrameTimer::get().now();
+    auto mark = [&](const char *phase) {
+      if (profiler) profiler->mark(phase);
+    };
+    if (profiler) profiler->start();
     for (size_t i = 0; i < params.simIterationsPerFrame; i++) {
-      if ( getCM() == CalculationMethod::BRANCH ) {
-        particle_interaction<CalculationMethod::BRANCH><<<nblocks, wg_size>>>(pos_d, pos_next_d, vel_d,
-            params);
+      bool reordered = false;
+      if (reorder && simStep % params.reorderInterval == 0) {
+        reorder->apply(pos_d, pos_next_d, vel_d, ids_d);
+        reordered = true;
+        mark("reorder");
+      }
+      if (params.solver == Solver::CUTOFF) {
+        // Particle indices in the cell list are stale after a reorder, &
+        // it misses pairs once a particle has moved over half the skin
+        if (reordered || simStep % params.cellRebuildInterval == 0 ||
+            cells->maxDisplacement(pos_d) > params.cellSkin / 2) {
+          cells->build(pos_d, params.cutoff + params.cellSkin);
+          mark("cells");
+        }
+        launchCutoffInteraction(pos_d, pos_next_d, vel_d, params,
+            cells->getGrid(), nblocks, wg_size);
+        mark("interaction");
+      } else if (params.solver == Solver::TREEPM) {
+        treepm->step(pos_d, pos_next_d, vel_d, params, nblocks, wg_size);
+        mark("interaction");
+      } else if (stream) {
+        stream->step(params, wg_size);
       } else {
-        particle_interaction<CalculationMethod::PREDICATED><<<nblocks, wg_size>>>(pos_d, pos_next_d, vel_d,
-            params);
+        // A distributed run only updates this rank's particles
+        InteractionConstants k = makeInteractionConstants(params);
+        k.targetOffset = rankBegin;
+        k.targetCount = rankCount;
+        int rankBlocks = std::max<int>(1, (rankCount + wg_size - 1) / wg_size);
+        if ( getCM() == CalculationMethod::BRANCH ) {
+          launch_interaction<CalculationMethod::BRANCH>(pos_d, pos_next_d,
+              vel_d, params, k, rankBlocks, wg_size);
+        } else {
+          launch_interaction<CalculationMethod::PREDICATED>(pos_d,
+              pos_next_d, vel_d, params, k, rankBlocks, wg_size);
+        }
+        mark("interaction");
+        if (transport) {
+          exchangePositions(pos_next_d);
+          mark("exchange");
+        }
       }
       std::swap(pos_d, pos_next_d);
+      simStep++;
     }
+    submitTimer.stop();
+    ScopedTimer syncTimer("sync");
     gpuErrchk(cudaDeviceSynchronize());
     auto stop = std::chrono::steady_clock::now();
-    lastStepTime =
-      std::chrono::duration<float, std::milli>(stop - start)
-      .count();
+    syncTimer.stop();
+    if (profiler) {
+      lastStepTime = profiler->collect(deviceIntervals);
+      // On the host timeline, from when the step was submitted
+      if (FrameTimer::get().enabled()) {
+        for (const DeviceInterval &interval : deviceIntervals) {
+          FrameTimer::get().add(interval.name, PhaseTrack::DEVICE,
+              submitStart + interval.start * 1000,
+              submitStart + interval.end * 1000);
+        }
+      }
+    } else {
+      lastStepTime =
+        std::chrono::duration<float, std::milli>(stop - start)
+        .count();
+    }
 
     // Sync data
     recvFromDevice();
   }
 
-  // Only necessary because we can't initialize data on device yet, in a
-  // dpct-friendly way
+  Conserved DiskGalaxySimulator::getConserved() {
+    if (deviceResident(params)) {
+      return computeConserved(pos_d, vel_d, params.numParticles, params.G,
+          params.distEps);
+    }
+    // Otherwise the host arrays are complete after every step
+    const ParticleData &p = getParticlePos();
+    const ParticleData &v = getParticleVel();
+    const float *posArrays[3] = {p.x.data(), p.y.data(), p.z.data()};
+    const float *velArrays[3] = {v.x.data(), v.y.data(), v.z.data()};
+    return conservedOnHost(posArrays, velArrays, params.numParticles,
+        params.G, params.distEps);
+  }
+
+  void DiskGalaxySimulator::autotune() {
+    TuneCache cache(params.tuneCache);
+    const TuneKey key = makeTuneKey(*getDeviceName(), params);
+    TuneChoice choice;
+    if (cache.find(key, choice)) {
+      std::cout << "Using work-group size " << choice.gwSize << " and "
+        << calculationMethodName(choice.calcMethod) << " tuned in "
+        << params.tuneCache << "\n";
+    } else {
+      // The interaction only reads pos_d, so writing pos_next_d & a copy of
+      // the velocities leaves the state untouched
+      const size_t n = params.numParticles;
+      ParticleData_d velScratch(n);
+      try {
+        gpuErrchk(cudaMemcpy(velScratch.x, vel_d.x, n * sizeof(coords_t),
+              cudaMemcpyDeviceToDevice));
+        gpuErrchk(cudaMemcpy(velScratch.y, vel_d.y, n * sizeof(coords_t),
+              cudaMemcpyDeviceToDevice));
+        gpuErrchk(cudaMemcpy(velScratch.z, vel_d.z, n * sizeof(coords_t),
+              cudaMemcpyDeviceToDevice));
+        int maxGwSize;
+        gpuErrchk(cudaDeviceGetAttribute(&maxGwSize,
+              cudaDevAttrMaxThreadsPerBlock, 0));
+        const InteractionConstants k = makeInteractionConstants(params);
+        choice = tuneLaunch(maxGwSize,
+            [&](CalculationMethod method, int wg_size) {
+            int nblocks = (n + wg_size - 1) / wg_size;
+            if (method == CalculationMethod::BRANCH) {
+              launch_interaction<CalculationMethod::BRANCH>(pos_d,
+                  pos_next_d, velScratch, params, k, nblocks, wg_size);
+            } else {
+              launch_interaction<CalculationMethod::PREDICATED>(pos_d,
+                  pos_next_d, velScratch, params, k, nblocks, wg_size);
+            }
+            cudaError_t error = cudaGetLastError();
+            if (error == cudaSuccess) error = cudaDeviceSynchronize();
+            if (error != cudaSuccess) {
+              throw std::runtime_error(cudaGetErrorString(error));
+            }
+            });
+      } catch (...) {
+        cudaFree(velScratch.x);
+        cudaFree(velScratch.y);
+        cudaFree(velScratch.z);
+        throw;
+      }
+      cudaFree(velScratch.x);
+      cudaFree(velScratch.y);
+      cudaFree(velScratch.z);
+      cache.store(key, choice);
+      std::cout << "Tuned work-group size " << choice.gwSize << " and "
+        << calculationMethodName(choice.calcMethod) << " ("
+        << choice.stepMs << " ms per interaction step)\n";
+    }
+    params.gwSize = choice.gwSize;
+    params.calcMethod = choice.calcMethod;
+  }
+
+  void DiskGalaxySimulator::exchangePositions(ParticleData_d p) {
+    const size_t n = params.numParticles;
+    const size_t bytes = rankCount * sizeof(coords_t);
+    // The host positions are only staging here, recvFromDevice refreshes
+    // them at the end of the frame
+    gpuErrchk(cudaMemcpy(pos.x.data() + rankBegin, p.x + rankBegin, bytes,
+          cudaMemcpyDeviceToHost));
+    gpuErrchk(cudaMemcpy(pos.y.data() + rankBegin, p.y + rankBegin, bytes,
+          cudaMemcpyDeviceToHost));
+    gpuErrchk(cudaMemcpy(pos.z.data() + rankBegin, p.z + rankBegin, bytes,
+          cudaMemcpyDeviceToHost));
+    transport->allGather(pos.x.data(), n);
+    transport->allGather(pos.y.data(), n);
+    transport->allGather(pos.z.data(), n);
+    gpuErrchk(cudaMemcpy(p.x, pos.x.data(), n * sizeof(coords_t),
+          cudaMemcpyHostToDevice));
+    gpuErrchk(cudaMemcpy(p.y, pos.y.data(), n * sizeof(coords_t),
+          cudaMemcpyHostToDevice));
+    gpuErrchk(cudaMemcpy(p.z, pos.z.data(), n * sizeof(coords_t),
+          cudaMemcpyHostToDevice));
+  }
+
+  // Position & velocity arrays in place in a mapped checkpoint
+  static void mappedArrays(const CheckpointReader &reader,
+      const coords_t *(&src)[6]) {
+    const CheckpointSection sections[6] = {CheckpointSection::POS_X,
+      CheckpointSection::POS_Y, CheckpointSection::POS_Z,
+      CheckpointSection::VEL_X, CheckpointSection::VEL_Y,
+      CheckpointSection::VEL_Z};
+    for (int i = 0; i < 6; i++) {
+      src[i] = static_cast<const coords_t *>(reader.data(sections[i]));
+    }
+  }
+
+  // Copy the initial state to the device, unless generated there
   void DiskGalaxySimulator::sendToDevice() {
+    if (hostStale && !restart) return;
+    if (stream) {
+      stream->upload(pos, vel);
+      return;
+    }
+    const coords_t *src[6] = {pos.x.data(), pos.y.data(), pos.z.data(),
+      vel.x.data(), vel.y.data(), vel.z.data()};
+    bool pinned[6] = {};
+    if (restart) {
+      // Copy straight from the mapped checkpoint, pinned where the driver
+      // allows it (pageable copies still work otherwise)
+      mappedArrays(*restart, src);
+      for (int i = 0; i < 6; i++) {
+        pinned[i] = cudaHostRegister(const_cast<coords_t *>(src[i]),
+            params.numParticles * sizeof(coords_t),
+            cudaHostRegisterReadOnly) == cudaSuccess;
+      }
+      cudaGetLastError();
+    }
     gpuErrchk(cudaDeviceSynchronize());
 
-    gpuErrchk(cudaMemcpy(pos_d.x, pos.x.data(),
+    gpuErrchk(cudaMemcpy(pos_d.x, src[0],
           params.numParticles * sizeof(coords_t),
           cudaMemcpyHostToDevice));
-    gpuErrchk(cudaMemcpy(pos_d.y, pos.y.data(),
+    gpuErrchk(cudaMemcpy(pos_d.y, src[1],
           params.numParticles * sizeof(coords_t),
           cudaMemcpyHostToDevice));
-    gpuErrchk(cudaMemcpy(pos_d.z, pos.z.data(),
+    gpuErrchk(cudaMemcpy(pos_d.z, src[2],
           params.numParticles * sizeof(coords_t),
           cudaMemcpyHostToDevice));
 
-    gpuErrchk(cudaMemcpy(vel_d.x, vel.x.data(),
+    gpuErrchk(cudaMemcpy(vel_d.x, src[3],
           params.numParticles * sizeof(coords_t),
           cudaMemcpyHostToDevice));
-    gpuErrchk(cudaMemcpy(vel_d.y, vel.y.data(),
+    gpuErrchk(cudaMemcpy(vel_d.y, src[4],
           params.numParticles * sizeof(coords_t),
           cudaMemcpyHostToDevice));
-    gpuErrchk(cudaMemcpy(vel_d.z, vel.z.data(),
+    gpuErrchk(cudaMemcpy(vel_d.z, src[5],
           params.numParticles * sizeof(coords_t),
           cudaMemcpyHostToDevice));
 
     gpuErrchk(cudaDeviceSynchronize());
+    if (restart) {
+      for (int i = 0; i < 6; i++) {
+        if (pinned[i]) cudaHostUnregister(const_cast<coords_t *>(src[i]));
+      }
+      restart.reset();
+    }
   }
 
   // Receive particle positions & velocity from device
   void DiskGalaxySimulator::recvFromDevice() {
+    ScopedTimer timer("recvFromDevice");
+    hostStale = false;
+    if (stream) {
+      stream->download(pos, vel);
+      return;
+    }
     gpuErrchk(cudaDeviceSynchronize());
 
     gpuErrchk(cudaMemcpy(pos.x.data(), pos_d.x,
@@ -125,41 +477,127 @@ namespace simulation {
     gpuErrchk(cudaMemcpy(vel.z.data(), vel_d.z,
           params.numParticles * sizeof(coords_t),
           cudaMemcpyDeviceToHost));
+    if (transport) {
+      // Only this rank's velocities are up to date on the device
+      transport->allGather(vel.x.data(), params.numParticles);
+      transport->allGather(vel.y.data(), params.numParticles);
+      transport->allGather(vel.z.data(), params.numParticles);
+    }
+    if (reorder) {
+      gpuErrchk(cudaMemcpy(ids.data(), ids_d,
+            params.numParticles * sizeof(uint32_t), cudaMemcpyDeviceToHost));
+    }
     gpuErrchk(cudaDeviceSynchronize());
   }
 
-  void DiskGalaxySimulator::randomParticlePos() {
-    // deterministic - default seed
-    std::mt19937 gen;
-    std::uniform_real_distribution<> dis(0.0, 1.0);
+  __global__ void generate_model(ParticleData_d pPos, ParticleData_d pVel,
+      GalaxyModelParams model) {
+    int id = threadIdx.x + (blockIdx.x * blockDim.x);
+    if (uint64_t(id) >= model.numParticles) return;
+    float p[3], v[3];
+    galaxyModelParticle(model, id, p, v);
+    pPos.x[id] = p[0];
+    pPos.y[id] = p[1];
+    pPos.z[id] = p[2];
+    pVel.x[id] = v[0];
+    pVel.y[id] = v[1];
+    pVel.z[id] = v[2];
+  }
 
-    // Disk shape in x-y plane
-    for (int i = 0; i < params.numParticles; i++) {
-      float t = dis(gen) * 2 * PI;
-      float s = dis(gen) * 100;
-      pos.x[i] = cos(t) * s;
-      pos.y[i] = sin(t) * s;
+  // Generates params.model, whose particles are independent of each other
+  void DiskGalaxySimulator::generateParticles() {
+    const size_t n = params.numParticles;
+    const GalaxyModelParams model = makeGalaxyModelParams(params);
+    if (deviceResident(params)) {
+      // Straight into device memory, leaving the host arrays to be filled
+      // by the first recvFromDevice
+      int wg_size = getGwSize();
+      int nblocks = std::max<int>(1, (n + wg_size - 1) / wg_size);
+      generate_model<<<nblocks, wg_size>>>(pos_d, vel_d, model);
+      gpuErrchk(cudaGetLastError());
+      hostStale = true;
+      return;
     }
+    // Layouts which upload from the host arrays generate them there
+    parallelRanges(n, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; i++) {
+          float p[3], v[3];
+          galaxyModelParticle(model, i, p, v);
+          pos.x[i] = p[0];
+          pos.y[i] = p[1];
+          pos.z[i] = p[2];
+          vel.x[i] = v[0];
+          vel.y[i] = v[1];
+          vel.z[i] = v[2];
+        }
+        });
+  }
+
+  std::string DiskGalaxySimulator::generatorState() const {
+    return "philox4x32-10 seed " + std::to_string(params.seed);
+  }
 
-    // Z component is independent (uniform range 0-4)
-    std::generate(begin(pos.z), end(pos.z),
-        [&gen, &dis]() { return 4.0 * dis(gen); });
+  void DiskGalaxySimulator::saveCheckpoint(const std::string &path) {
+    // Every rank holds the whole state, so one copy is enough
+    if (transport && transport->rank() != 0) return;
+    if (hostStale) recvFromDevice();
+    writeCheckpoint(path, {&params, simStep, generatorState(),
+        {pos.x.data(), pos.y.data(), pos.z.data()},
+        {vel.x.data(), vel.y.data(), vel.z.data()}, ids.data()});
   }
 
-  void DiskGalaxySimulator::initialParticleVel() {
-    for (int i = 0; i < params.numParticles; i++) {
-      vec3 vel = cross({pos.x[i], pos.y[i], pos.z[i]}, {0.0, 0.0, 1.0});
-      coords_t orbital_vel = std::sqrt(2.0 * length(vel));
-      vel = normalize(vel) * orbital_vel;
-      this->vel.x[i] = vel.x;
-      this->vel.y[i] = vel.y;
-      this->vel.z[i] = vel.z;
+  bool DiskGalaxySimulator::takeSnapshot(Snapshot &snapshot) {
+    if (transport && transport->rank() != 0) return false;
+    // stepSim has already copied the state to the host, so this is a
+    // host copy into the pooled buffer
+    if (hostStale) recvFromDevice();
+    snapshot.step = simStep;
+    snapshot.rngState = generatorState();
+    const std::vector<coords_t> *src[6] = {&pos.x, &pos.y, &pos.z,
+      &vel.x, &vel.y, &vel.z};
+    float *dst[6] = {snapshot.pos[0], snapshot.pos[1], snapshot.pos[2],
+      snapshot.vel[0], snapshot.vel[1], snapshot.vel[2]};
+    for (int i = 0; i < 6; i++) {
+      std::copy(src[i]->begin(), src[i]->end(), dst[i]);
     }
+    std::copy(ids.begin(), ids.end(), snapshot.ids);
+    return true;
   }
 
-  const ParticleData& DiskGalaxySimulator::getParticlePos() { return pos; };
+  void DiskGalaxySimulator::loadCheckpoint(
+      std::unique_ptr<CheckpointReader> reader) {
+    restart = std::move(reader);
+    if (restart->has(CheckpointSection::IDS)) {
+      ids.resize(params.numParticles);
+      restart->read(CheckpointSection::IDS, ids.data());
+    }
+    simStep = restart->step();
+
+    // sendToDevice copies straight from the mapping, leaving the host
+    // arrays to be filled by the first recvFromDevice. Layouts which
+    // upload from the host arrays, & big-endian hosts, read into them.
+    if (restart->data(CheckpointSection::POS_X) && deviceResident(params)) {
+      hostStale = true;
+      return;
+    }
+    restart->read(CheckpointSection::POS_X, pos.x.data());
+    restart->read(CheckpointSection::POS_Y, pos.y.data());
+    restart->read(CheckpointSection::POS_Z, pos.z.data());
+    restart->read(CheckpointSection::VEL_X, vel.x.data());
+    restart->read(CheckpointSection::VEL_Y, vel.y.data());
+    restart->read(CheckpointSection::VEL_Z, vel.z.data());
+    restart.reset();
+  }
+
+  const ParticleData& DiskGalaxySimulator::getParticlePos() {
+    if (hostStale) recvFromDevice();
+    return pos;
+  };
 
-  const ParticleData& DiskGalaxySimulator::getParticleVel() { return vel; };
+  const ParticleData& DiskGalaxySimulator::getParticleVel() {
+    if (hostStale) recvFromDevice();
+    return vel;
+  };
 
   // Linear Algebra functions (not yet exposed in header)
   HOSTDEV vec3 cross(const vec3 v0, const vec3 v1) {
@@ -183,49 +621,36 @@ namespace simulation {
   /* O(n^2) implementation (no distance threshold), with no shared
      memory etc.
    */
-  template <CalculationMethod ct>
+  template <CalculationMethod ct, typename accum_t, int fixedN>
     __global__ void particle_interaction(ParticleData_d pPos,
         ParticleData_d pNextPos,
-        ParticleData_d pVel, SimParam params) {
+        ParticleData_d pVel, InteractionConstants k) {
+      const int numParticles = fixedN ? fixedN : k.numParticles;
       int id = threadIdx.x + (blockIdx.x * blockDim.x);
-      if (id >= params.numParticles) return;
+      if (id >= k.targetCount) return;
+      id += k.targetOffset;
 
-      vec3 force(0.0f, 0.0f, 0.0f);
+      accum_t force;
       vec3 pos(pPos.x[id], pPos.y[id], pPos.z[id]);
 
 #pragma unroll 4
-      for (int i = 0; i < params.numParticles; i++) {
+      for (int i = 0; i < numParticles; i++) {
         vec3 other_pos{pPos.x[i], pPos.y[i], pPos.z[i]};
         vec3 r = other_pos - pos;
         // Fast computation of 1/(|r|^3)
-        coords_t dist_sqr = dot(r, r) + params.distEps;
+        coords_t dist_sqr = dot(r, r) + k.distEps;
         coords_t inv_dist_cube = rsqrt(dist_sqr * dist_sqr * dist_sqr);
 
         // assume uniform unit mass
         if  constexpr(ct == CalculationMethod::BRANCH) {
           if ( i == id ) continue;
-          force += r * inv_dist_cube;
+          force.add(r * inv_dist_cube);
         } else  if constexpr (ct == CalculationMethod::PREDICATED) {
-          force += r * inv_dist_cube * (i == id);
+          force.add(r * inv_dist_cube * (i != id));
         }
       }
 
-      // Update velocity
-      vec3 curr_vel(pVel.x[id], pVel.y[id], pVel.z[id]);
-      curr_vel *= params.damping;
-      curr_vel += force * params.dt * params.G;
-
-      pVel.x[id] = curr_vel.x;
-      pVel.y[id] = curr_vel.y;
-      pVel.z[id] = curr_vel.z;
-
-      // Update position (integration)
-      vec3 curr_pos(pPos.x[id], pPos.y[id], pPos.z[id]);
-
-      curr_pos += curr_vel * params.dt;
-      pNextPos.x[id] = curr_pos.x;
-      pNextPos.y[id] = curr_pos.y;
-      pNextPos.z[id] = curr_pos.z;
+      integrate(pPos, pNextPos, pVel, k, id, force.get());
     }
 
 }  // namespace simulation
@@ -8,10 +8,17 @@
 #include <cuda_runtime_api.h>
 #include <stdio.h>
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "sim_param.hpp"
+#include "transport.hpp"
+#include "checkpoint.hpp"
+#include "conservation.hpp"
+#include "initial_conditions.hpp"
+#include "snapshot_writer.hpp"
 
 #ifdef __CUDACC__
 #define HOSTDEV __host__ __device__
@@ -72,6 +79,102 @@ namespace simulation {
     return vec1.x * vec2.x + vec1.y * vec2.y + vec1.z * vec2.z;
   }
 
+  /*
+     Force accumulators for particle_interaction. Pair terms are always
+     computed in coords_t, these only change how the running sum is held.
+   */
+
+  // Plain coords_t sum
+  struct FloatAccumulator {
+    vec3 sum;
+
+    HOSTDEV inline void add(const vec3 &term) { sum += term; }
+    HOSTDEV inline vec3 get() const { return sum; }
+  };
+
+  // coords_t sum carrying the rounding error of each add (Knuth two-sum)
+  struct KahanAccumulator {
+    vec3 sum;
+    vec3 comp;
+
+    HOSTDEV inline void add(const vec3 &term) {
+      two_sum(sum.x, comp.x, term.x);
+      two_sum(sum.y, comp.y, term.y);
+      two_sum(sum.z, comp.z, term.z);
+    }
+    HOSTDEV inline vec3 get() const {
+      return {sum.x + comp.x, sum.y + comp.y, sum.z + comp.z};
+    }
+
+    // nvcc does not reassociate floating point adds, even with
+    // -use_fast_math, so no extra care is needed to keep c alive
+    HOSTDEV static inline void two_sum(coords_t &s, coords_t &c,
+        const coords_t v) {
+      coords_t t = s + v;
+      coords_t bp = t - s;
+      c += (s - (t - bp)) + (v - bp);
+      s = t;
+    }
+  };
+
+  // double precision sum of coords_t terms
+  struct DoubleAccumulator {
+    double x = 0.0;
+    double y = 0.0;
+    double z = 0.0;
+
+    HOSTDEV inline void add(const vec3 &term) {
+      x += term.x;
+      y += term.y;
+      z += term.z;
+    }
+    HOSTDEV inline vec3 get() const {
+      return {coords_t(x), coords_t(y), coords_t(z)};
+    }
+  };
+
+  // Invokes f with a default constructed accumulator of the selected type
+  template <typename F>
+  void dispatchAccumulator(AccumulationMethod method, F &&f) {
+    switch (method) {
+      case AccumulationMethod::FLOAT:
+        f(FloatAccumulator{});
+        break;
+      case AccumulationMethod::KAHAN:
+        f(KahanAccumulator{});
+        break;
+      case AccumulationMethod::DOUBLE:
+        f(DoubleAccumulator{});
+        break;
+    }
+  }
+
+  // Scalars read by particle_interaction, with dt * G folded on the host
+  struct InteractionConstants {
+    int numParticles;
+    coords_t distEps;
+    coords_t damping;
+    coords_t dt;
+    coords_t dtG;
+    int targetOffset;  ///< First particle updated by the launch
+    int targetCount;   ///< Number of particles updated by the launch
+  };
+
+  // Constants for a launch updating every particle
+  inline InteractionConstants makeInteractionConstants(
+      const SimParam &params) {
+    return {static_cast<int>(params.numParticles), params.distEps,
+      params.damping, params.dt, params.dt * params.G, 0,
+      static_cast<int>(params.numParticles)};
+  }
+
+  // A phase of a step on the device, in ms from the start of the step
+  struct DeviceInterval {
+    const char *name;
+    float start;
+    float end;
+  };
+
   struct ParticleData {
     std::vector<coords_t> x;
     std::vector<coords_t> y;
@@ -95,8 +198,40 @@ namespace simulation {
       gpuErrchk(cudaMalloc((void **)&y, sizeof(coords_t) * n));
       gpuErrchk(cudaMalloc((void **)&z, sizeof(coords_t) * n));
     };
+
+    // No storage, for wrapping existing pointers
+    ParticleData_d() = default;
   };
 
+  class DeviceProfiler;
+  class MortonReorder;
+  class CellList;
+  class TreePM;
+  class StreamingSolver;
+
+  // Velocity & position update of particle id given the (unscaled) force
+  // acting on it. The new position is written to pNextPos.
+  HOSTDEV inline void integrate(ParticleData_d pPos, ParticleData_d pNextPos,
+      ParticleData_d pVel, const InteractionConstants &k, int id,
+      const vec3 &force) {
+    // Update velocity
+    vec3 curr_vel(pVel.x[id], pVel.y[id], pVel.z[id]);
+    curr_vel *= k.damping;
+    curr_vel += force * k.dtG;
+
+    pVel.x[id] = curr_vel.x;
+    pVel.y[id] = curr_vel.y;
+    pVel.z[id] = curr_vel.z;
+
+    // Update position (integration)
+    vec3 curr_pos(pPos.x[id], pPos.y[id], pPos.z[id]);
+
+    curr_pos += curr_vel * k.dt;
+    pNextPos.x[id] = curr_pos.x;
+    pNextPos.y[id] = curr_pos.y;
+    pNextPos.z[id] = curr_pos.z;
+  }
+
   HOSTDEV coords_t length(const vec3 v);
   HOSTDEV vec3 cross(const vec3 v0, const vec3 v1);
   HOSTDEV vec3 normalize(const vec3 v);
@@ -129,6 +264,7 @@ Invariants:
   class DiskGalaxySimulator : public Simulator {
     public:
       DiskGalaxySimulator(SimParam params_);
+      ~DiskGalaxySimulator();
 
       void stepSim();
       float getLastStepTime() { return lastStepTime; }
@@ -137,9 +273,41 @@ Invariants:
       const ParticleData &getParticleVel();
       const std::string* getDeviceName();
       int getGwSize() { return params.gwSize; }
+      // Parameters in use, which come partly from the checkpoint on restart
+      const SimParam &getParams() { return params; }
+      // This process in a distributed run, 0 otherwise
+      int getRank() { return transport ? transport->rank() : 0; }
+      // Whether flag is set on any process of a distributed run (flag
+      // itself otherwise). Every rank must call it at the same step.
+      bool anyRank(bool flag) {
+        return transport ? transport->anyOf(flag) : flag;
+      }
       CalculationMethod getCM() { return params.calcMethod; }
+      AccumulationMethod getAM() { return params.accumMethod; }
+      // Original (generation order) index of the particle in each slot of
+      // getParticlePos/getParticleVel, which differ once reordered
+      const std::vector<uint32_t> &getParticleIds() { return ids; }
+      // Writes the state after the last step to a checkpoint file, from
+      // which a simulator constructed with params.restartFile resumes
+      void saveCheckpoint(const std::string &path);
+      // Copies the state after the last step into a snapshot buffer, to be
+      // written in the background like a checkpoint
+      // @return false on ranks which don't write snapshots
+      bool takeSnapshot(Snapshot &snapshot);
+      // Device time of each phase of the last stepSim, with --profile=1
+      // (getLastStepTime is then their device time too)
+      const std::vector<DeviceInterval> &getDeviceIntervals() {
+        return deviceIntervals;
+      }
+      // Energy, momentum & angular momentum after the last step, on the
+      // device when it holds every particle (O(n^2) either way)
+      Conserved getConserved();
 
     private:
+      // Initial conditions file from withInitialConditionParams, until
+      // the constructor has loaded it. Declared before params, which is
+      // initialized from it.
+      std::unique_ptr<InitialConditionFile> initialConditions;
       SimParam params;
       std::string devName;
       float lastStepTime{0.0};
@@ -152,11 +320,41 @@ Invariants:
       ParticleData_d pos_d;
       ParticleData_d pos_next_d;  // double buffering
       ParticleData_d vel_d;
-
-      void randomParticlePos();
-      void initialParticleVel();
+      uint32_t *ids_d = nullptr;
+      std::vector<uint32_t> ids;
+
+      // Number of integration steps taken so far
+      size_t simStep{0};
+      // Mapped restart file, until sendToDevice has copied from it
+      std::unique_ptr<CheckpointReader> restart;
+      // Host pos & vel not yet filled, after initializing straight on the
+      // device from a restart or the generator
+      bool hostStale{false};
+
+      std::unique_ptr<MortonReorder> reorder;
+      std::unique_ptr<CellList> cells;
+      std::unique_ptr<TreePM> treepm;
+      std::unique_ptr<StreamingSolver> stream;
+      std::unique_ptr<Transport> transport;
+      std::unique_ptr<DeviceProfiler> profiler;
+      std::vector<DeviceInterval> deviceIntervals;
+
+      // Particles updated by this process of a distributed run
+      size_t rankBegin{0};
+      size_t rankCount{0};
+
+      void generateParticles();
+      // Picks params.gwSize & params.calcMethod for the all pairs
+      // interaction, from params.tuneCache or by timing the candidates
+      void autotune();
+      // Initial condition generator, as stored in checkpoints
+      std::string generatorState() const;
+      void loadCheckpoint(std::unique_ptr<CheckpointReader> reader);
       void sendToDevice();
       void recvFromDevice();
+      // Replaces the positions outside this rank's range with those
+      // computed by the other ranks
+      void exchangePositions(ParticleData_d p);
   };
 
 }  // namespace simulation
@@ -0,0 +1,124 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "snapshot_writer.hpp"
+#include "checkpoint.hpp"
+#include "frame_timer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+constexpr size_t PAGE = 4096;
+
+}  // namespace
+
+SnapshotWriter::SnapshotWriter(const SimParam &params_, int numBuffers)
+  : params(params_), pool(std::max(1, numBuffers)) {
+  // One page aligned block per buffer: 3 position, 3 velocity & 1 id array
+  const size_t n = params.numParticles;
+  const size_t bytes = (7 * n * sizeof(float) + PAGE - 1) / PAGE * PAGE;
+  for (auto &s : pool) {
+    void *block = std::aligned_alloc(PAGE, std::max(bytes, PAGE));
+    if (!block) throw std::bad_alloc();
+    storage.push_back(block);
+    float *arrays = static_cast<float *>(block);
+    for (int i = 0; i < 3; i++) {
+      s.pos[i] = arrays + i * n;
+      s.vel[i] = arrays + (3 + i) * n;
+    }
+    s.ids = reinterpret_cast<uint32_t *>(arrays + 6 * n);
+    freeBuffers.push_back(&s);
+  }
+  thread = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  changed.notify_all();
+  thread.join();
+  for (void *block : storage) std::free(block);
+}
+
+Snapshot *SnapshotWriter::acquire() {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [&] { return !freeBuffers.empty() || error; });
+  rethrow();
+  Snapshot *s = freeBuffers.back();
+  freeBuffers.pop_back();
+  return s;
+}
+
+void SnapshotWriter::submit(Snapshot *snapshot, const std::string &path) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back({snapshot, path});
+  }
+  changed.notify_all();
+}
+
+void SnapshotWriter::release(Snapshot *snapshot) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    freeBuffers.push_back(snapshot);
+  }
+  changed.notify_all();
+}
+
+void SnapshotWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [&] { return (queue.empty() && !writing) || error; });
+  rethrow();
+}
+
+// Called with the mutex held
+void SnapshotWriter::rethrow() {
+  if (!error) return;
+  std::exception_ptr e = error;
+  error = nullptr;
+  std::rethrow_exception(e);
+}
+
+void SnapshotWriter::run() {
+  FrameTimer::get().nameThread("snapshot writer");
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [&] { return !queue.empty() || stopping; });
+    if (queue.empty()) return;
+    Pending p = std::move(queue.front());
+    queue.pop_front();
+    writing = true;
+    lock.unlock();
+
+    const Snapshot &s = *p.snapshot;
+    std::exception_ptr failed;
+    try {
+      ScopedTimer timer("writeSnapshot");
+      writeCheckpoint(p.path, {&params, s.step, s.rngState,
+          {s.pos[0], s.pos[1], s.pos[2]}, {s.vel[0], s.vel[1], s.vel[2]},
+          s.ids});
+    } catch (...) {
+      failed = std::current_exception();
+    }
+
+    lock.lock();
+    writing = false;
+    if (failed && !error) error = failed;
+    freeBuffers.push_back(p.snapshot);
+    changed.notify_all();
+  }
+}
+
+std::string snapshotPath(const std::string &prefix, uint64_t step) {
+  char number[32];
+  std::snprintf(number, sizeof(number), "_%06llu.ckpt",
+      static_cast<unsigned long long>(step));
+  return prefix + number;
+}
@@ -0,0 +1,104 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sim_param.hpp"
+
+/**
+ * Host copy of the simulation state, taken from a SnapshotWriter's pool.
+ * The arrays hold numParticles elements & live as long as the writer.
+ */
+struct Snapshot {
+  uint64_t step = 0;
+  std::string rngState;
+  float *pos[3];
+  float *vel[3];
+  uint32_t *ids;
+};
+
+/**
+ * Writes snapshots of the simulation state as checkpoint files, on a
+ * background thread. Snapshots come from a fixed pool of buffers, so taking
+ * one allocates nothing: the caller fills a buffer from acquire & hands it
+ * back with submit, which queues it for writing & returns at once. Only
+ * when every buffer is queued or being written does acquire block until
+ * the oldest has been written.
+ */
+class SnapshotWriter {
+  public:
+    /**
+     * @param params parameters stored in every snapshot
+     * @param numBuffers size of the buffer pool (at least 1)
+     */
+    SnapshotWriter(const SimParam &params, int numBuffers);
+
+    /**
+     * Writes every queued snapshot before returning
+     */
+    ~SnapshotWriter();
+
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    /**
+     * A free buffer, waiting for one if all are in use. Rethrows the error
+     * of a failed earlier write.
+     */
+    Snapshot *acquire();
+
+    /**
+     * Queues a buffer from acquire to be written to path. The buffer
+     * belongs to the writer again until returned by acquire.
+     */
+    void submit(Snapshot *snapshot, const std::string &path);
+
+    /**
+     * Returns a buffer from acquire to the pool unwritten
+     */
+    void release(Snapshot *snapshot);
+
+    /**
+     * Waits for every queued snapshot to be written. Rethrows the error of
+     * a failed write.
+     */
+    void flush();
+
+  private:
+    struct Pending {
+      Snapshot *snapshot;
+      std::string path;
+    };
+
+    void run();
+    void rethrow();
+
+    SimParam params;
+    std::vector<Snapshot> pool;
+    std::vector<void *> storage;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<Snapshot *> freeBuffers;
+    std::deque<Pending> queue;
+    bool writing = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread thread;
+};
+
+/**
+ * Name of the snapshot of step, e.g. prefix_000120.ckpt
+ */
+std::string snapshotPath(const std::string &prefix, uint64_t step);
@@ -0,0 +1,95 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "stream_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+P2Quantile::P2Quantile(double p_) : p(std::min(1.0, std::max(0.0, p_))) {}
+
+void P2Quantile::add(double x) {
+  if (count < 5) {
+    height[count++] = x;
+    if (count == 5) {
+      std::sort(height, height + 5);
+      for (int i = 0; i < 5; i++) pos[i] = i + 1;
+      desired[0] = 1;
+      desired[1] = 1 + 2 * p;
+      desired[2] = 1 + 4 * p;
+      desired[3] = 3 + 2 * p;
+      desired[4] = 5;
+      increment[0] = 0;
+      increment[1] = p / 2;
+      increment[2] = p;
+      increment[3] = (1 + p) / 2;
+      increment[4] = 1;
+    }
+    return;
+  }
+  count++;
+
+  // Cell of x, widening the extremes if it lies outside them
+  int cell;
+  if (x < height[0]) {
+    height[0] = x;
+    cell = 0;
+  } else if (x >= height[4]) {
+    height[4] = x;
+    cell = 3;
+  } else {
+    cell = 0;
+    while (x >= height[cell + 1]) cell++;
+  }
+  for (int i = cell + 1; i < 5; i++) pos[i]++;
+  for (int i = 0; i < 5; i++) desired[i] += increment[i];
+
+  // Move each middle marker at most one position towards where it should
+  // be, keeping the heights ordered
+  for (int i = 1; i < 4; i++) {
+    const double d = desired[i] - pos[i];
+    if ((d >= 1 && pos[i + 1] - pos[i] > 1) ||
+        (d <= -1 && pos[i - 1] - pos[i] < -1)) {
+      const int s = d >= 0 ? 1 : -1;
+      const double parabolic = height[i] + s / (pos[i + 1] - pos[i - 1]) *
+        ((pos[i] - pos[i - 1] + s) * (height[i + 1] - height[i]) /
+         (pos[i + 1] - pos[i]) +
+         (pos[i + 1] - pos[i] - s) * (height[i] - height[i - 1]) /
+         (pos[i] - pos[i - 1]));
+      if (height[i - 1] < parabolic && parabolic < height[i + 1]) {
+        height[i] = parabolic;
+      } else {
+        height[i] += s * (height[i + s] - height[i]) / (pos[i + s] - pos[i]);
+      }
+      pos[i] += s;
+    }
+  }
+}
+
+double P2Quantile::value() const {
+  if (count == 0) return 0;
+  if (count >= 5) return height[2];
+  double sorted[5];
+  std::copy(height, height + count, sorted);
+  std::sort(sorted, sorted + count);
+  return sorted[size_t(std::lround(p * (count - 1)))];
+}
+
+StreamStats::StreamStats() : median(0.5), q95(0.95), q99(0.99) {}
+
+void StreamStats::add(double x) {
+  n++;
+  const double delta = x - m;
+  m += delta / n;
+  m2 += delta * (x - m);
+  lo = n == 1 ? x : std::min(lo, x);
+  hi = n == 1 ? x : std::max(hi, x);
+  median.add(x);
+  q95.add(x);
+  q99.add(x);
+}
+
+double StreamStats::stddev() const {
+  return n > 0 ? std::sqrt(m2 / n) : 0;
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Running estimate of a quantile in constant memory, by the P² algorithm
+ * of Jain & Chlamtac (1985): five markers track the minimum, the quantile,
+ * the maximum & the quantiles halfway between, & are moved along a
+ * piecewise parabola as samples arrive. Exact for up to five samples.
+ */
+class P2Quantile {
+  public:
+    /**
+     * @param p_ the quantile, in [0, 1]
+     */
+    explicit P2Quantile(double p_);
+
+    void add(double x);
+
+    /**
+     * The estimate, 0 before any sample
+     */
+    double value() const;
+
+  private:
+    double p;
+    size_t count = 0;
+    double height[5];    ///< Marker heights, the first count samples at first
+    double pos[5];       ///< Marker positions, from 1
+    double desired[5];   ///< Desired marker positions
+    double increment[5]; ///< Change in desired positions per sample
+};
+
+/**
+ * Summary statistics of a stream of samples in constant memory: count,
+ * mean & standard deviation by Welford's method, extremes & the median,
+ * 95th & 99th percentiles by P2Quantile
+ */
+class StreamStats {
+  public:
+    StreamStats();
+
+    void add(double x);
+
+    size_t count() const { return n; }
+    double mean() const { return m; }
+    /** Population standard deviation */
+    double stddev() const;
+    double min() const { return lo; }
+    double max() const { return hi; }
+    double p50() const { return median.value(); }
+    double p95() const { return q95.value(); }
+    double p99() const { return q99.value(); }
+
+  private:
+    size_t n = 0;
+    double m = 0;
+    double m2 = 0;  ///< Sum of squared differences from the mean
+    double lo = 0;
+    double hi = 0;
+    P2Quantile median;
+    P2Quantile q95;
+    P2Quantile q99;
+};
@@ -0,0 +1,219 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "streaming.cuh"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace simulation {
+
+  namespace {
+    ParticleData_d allocHost(size_t n) {
+      ParticleData_d p;
+      gpuErrchk(cudaMallocHost((void **)&p.x, sizeof(coords_t) * n));
+      gpuErrchk(cudaMallocHost((void **)&p.y, sizeof(coords_t) * n));
+      gpuErrchk(cudaMallocHost((void **)&p.z, sizeof(coords_t) * n));
+      return p;
+    }
+
+    void freeHost(ParticleData_d &p) {
+      cudaFreeHost(p.x);
+      cudaFreeHost(p.y);
+      cudaFreeHost(p.z);
+    }
+
+    void freeDevice(ParticleData_d &p) {
+      cudaFree(p.x);
+      cudaFree(p.y);
+      cudaFree(p.z);
+    }
+
+    // Copies count elements, from srcOffset in src to dstOffset in dst
+    void copy(cudaStream_t stream, ParticleData_d dst, size_t dstOffset,
+        ParticleData_d src, size_t srcOffset, size_t count) {
+      size_t bytes = count * sizeof(coords_t);
+      gpuErrchk(cudaMemcpyAsync(dst.x + dstOffset, src.x + srcOffset, bytes,
+            cudaMemcpyDefault, stream));
+      gpuErrchk(cudaMemcpyAsync(dst.y + dstOffset, src.y + srcOffset, bytes,
+            cudaMemcpyDefault, stream));
+      gpuErrchk(cudaMemcpyAsync(dst.z + dstOffset, src.z + srcOffset, bytes,
+            cudaMemcpyDefault, stream));
+    }
+  }  // namespace
+
+  /* Force on targetCount particles of pos (starting at particle
+     targetOffset), from the tileCount particles of tile (starting at
+     particle tileOffset). With first set the force buffer is overwritten,
+     otherwise it is added to.
+   */
+  template <CalculationMethod ct, typename accum_t>
+    __global__ void tile_force(ParticleData_d pos, int targetOffset,
+        int targetCount, ParticleData_d tile, int tileOffset, int tileCount,
+        ParticleData_d force, bool first, coords_t distEps) {
+      int id = threadIdx.x + (blockIdx.x * blockDim.x);
+      if (id >= targetCount) return;
+      int self = targetOffset + id - tileOffset;
+
+      accum_t acc;
+      vec3 p(pos.x[id], pos.y[id], pos.z[id]);
+      for (int i = 0; i < tileCount; i++) {
+        vec3 r = vec3(tile.x[i], tile.y[i], tile.z[i]) - p;
+        coords_t dist_sqr = dot(r, r) + distEps;
+        coords_t inv_dist_cube = rsqrt(dist_sqr * dist_sqr * dist_sqr);
+        if constexpr (ct == CalculationMethod::BRANCH) {
+          if (i == self) continue;
+          acc.add(r * inv_dist_cube);
+        } else {
+          acc.add(r * inv_dist_cube * (i != self));
+        }
+      }
+
+      vec3 f = acc.get();
+      if (!first) f += vec3(force.x[id], force.y[id], force.z[id]);
+      force.x[id] = f.x;
+      force.y[id] = f.y;
+      force.z[id] = f.z;
+    }
+
+  __global__ void tile_integrate(ParticleData_d pos, ParticleData_d posNext,
+      ParticleData_d vel, ParticleData_d force, int count,
+      InteractionConstants k) {
+    int id = threadIdx.x + (blockIdx.x * blockDim.x);
+    if (id >= count) return;
+    integrate(pos, posNext, vel, k, id,
+        vec3(force.x[id], force.y[id], force.z[id]));
+  }
+
+  StreamingSolver::StreamingSolver(size_t n_, size_t tileSize,
+      int poolTiles)
+    : n(n_), tile(std::min(tileSize, n_)), hostPos(allocHost(n_)),
+    hostPosNext(allocHost(n_)), hostVel(allocHost(n_)) {
+      gpuErrchk(cudaStreamCreateWithFlags(&h2d, cudaStreamNonBlocking));
+      gpuErrchk(cudaStreamCreateWithFlags(&compute, cudaStreamNonBlocking));
+      gpuErrchk(cudaStreamCreateWithFlags(&d2h, cudaStreamNonBlocking));
+
+      // Two tiles are needed for a copy to overlap the calculation
+      size_t numSources = std::max(2, poolTiles);
+      for (size_t i = 0; i < numSources; i++) {
+        sources.emplace_back(tile);
+      }
+      for (auto &t : targets) {
+        t = {ParticleData_d(tile), ParticleData_d(tile), ParticleData_d(tile),
+          ParticleData_d(tile)};
+      }
+
+      sourceIn.resize(numSources);
+      sourceFree.resize(numSources);
+      for (auto *events : {&sourceIn, &sourceFree}) {
+        for (auto &e : *events) {
+          gpuErrchk(cudaEventCreateWithFlags(&e, cudaEventDisableTiming));
+        }
+      }
+      for (int i = 0; i < 2; i++) {
+        for (auto *e : {&targetIn[i], &targetFree[i], &integrated[i]}) {
+          gpuErrchk(cudaEventCreateWithFlags(e, cudaEventDisableTiming));
+        }
+      }
+    }
+
+  StreamingSolver::~StreamingSolver() {
+    cudaDeviceSynchronize();
+    for (auto &s : sources) freeDevice(s);
+    for (auto &t : targets) {
+      for (auto *p : {&t.pos, &t.posNext, &t.vel, &t.force}) freeDevice(*p);
+    }
+    freeHost(hostPos);
+    freeHost(hostPosNext);
+    freeHost(hostVel);
+    for (auto *events : {&sourceIn, &sourceFree}) {
+      for (auto &e : *events) cudaEventDestroy(e);
+    }
+    for (int i = 0; i < 2; i++) {
+      cudaEventDestroy(targetIn[i]);
+      cudaEventDestroy(targetFree[i]);
+      cudaEventDestroy(integrated[i]);
+    }
+    cudaStreamDestroy(h2d);
+    cudaStreamDestroy(compute);
+    cudaStreamDestroy(d2h);
+  }
+
+  void StreamingSolver::upload(const ParticleData &pos,
+      const ParticleData &vel) {
+    size_t bytes = n * sizeof(coords_t);
+    std::memcpy(hostPos.x, pos.x.data(), bytes);
+    std::memcpy(hostPos.y, pos.y.data(), bytes);
+    std::memcpy(hostPos.z, pos.z.data(), bytes);
+    std::memcpy(hostVel.x, vel.x.data(), bytes);
+    std::memcpy(hostVel.y, vel.y.data(), bytes);
+    std::memcpy(hostVel.z, vel.z.data(), bytes);
+  }
+
+  void StreamingSolver::download(ParticleData &pos, ParticleData &vel) {
+    size_t bytes = n * sizeof(coords_t);
+    std::memcpy(pos.x.data(), hostPos.x, bytes);
+    std::memcpy(pos.y.data(), hostPos.y, bytes);
+    std::memcpy(pos.z.data(), hostPos.z, bytes);
+    std::memcpy(vel.x.data(), hostVel.x, bytes);
+    std::memcpy(vel.y.data(), hostVel.y, bytes);
+    std::memcpy(vel.z.data(), hostVel.z, bytes);
+  }
+
+  void StreamingSolver::step(const SimParam &params, int wg_size) {
+    const size_t numTiles = (n + tile - 1) / tile;
+    const size_t poolTiles = sources.size();
+    InteractionConstants k = makeInteractionConstants(params);
+
+    size_t job = 0;
+    for (size_t t = 0; t < numTiles; t++) {
+      Target &target = targets[t % 2];
+      size_t targetBegin = t * tile;
+      size_t targetCount = std::min(tile, n - targetBegin);
+      int nblocks = (targetCount + wg_size - 1) / wg_size;
+
+      // The buffers still hold tile t - 2 until it has been copied back
+      gpuErrchk(cudaStreamWaitEvent(h2d, targetFree[t % 2], 0));
+      copy(h2d, target.vel, 0, hostVel, targetBegin, targetCount);
+      copy(h2d, target.pos, 0, hostPos, targetBegin, targetCount);
+      gpuErrchk(cudaEventRecord(targetIn[t % 2], h2d));
+      gpuErrchk(cudaStreamWaitEvent(compute, targetIn[t % 2], 0));
+
+      for (size_t s = 0; s < numTiles; s++, job++) {
+        size_t b = job % poolTiles;
+        size_t sourceBegin = s * tile;
+        size_t sourceCount = std::min(tile, n - sourceBegin);
+        gpuErrchk(cudaStreamWaitEvent(h2d, sourceFree[b], 0));
+        copy(h2d, sources[b], 0, hostPos, sourceBegin, sourceCount);
+        gpuErrchk(cudaEventRecord(sourceIn[b], h2d));
+        gpuErrchk(cudaStreamWaitEvent(compute, sourceIn[b], 0));
+        dispatchAccumulator(params.accumMethod, [&](auto accum) {
+            using accum_t = decltype(accum);
+            auto kernel = params.calcMethod == CalculationMethod::BRANCH ?
+              tile_force<CalculationMethod::BRANCH, accum_t> :
+              tile_force<CalculationMethod::PREDICATED, accum_t>;
+            kernel<<<nblocks, wg_size, 0, compute>>>(target.pos,
+                targetBegin, targetCount, sources[b], sourceBegin,
+                sourceCount, target.force, s == 0, params.distEps);
+            });
+        gpuErrchk(cudaEventRecord(sourceFree[b], compute));
+      }
+
+      tile_integrate<<<nblocks, wg_size, 0, compute>>>(target.pos,
+          target.posNext, target.vel, target.force, targetCount, k);
+      gpuErrchk(cudaEventRecord(integrated[t % 2], compute));
+      gpuErrchk(cudaStreamWaitEvent(d2h, integrated[t % 2], 0));
+      copy(d2h, hostVel, targetBegin, target.vel, 0, targetCount);
+      copy(d2h, hostPosNext, targetBegin, target.posNext, 0, targetCount);
+      gpuErrchk(cudaEventRecord(targetFree[t % 2], d2h));
+    }
+
+    gpuErrchk(cudaStreamSynchronize(h2d));
+    gpuErrchk(cudaStreamSynchronize(compute));
+    gpuErrchk(cudaStreamSynchronize(d2h));
+    std::swap(hostPos, hostPosNext);
+  }
+
+}  // namespace simulation
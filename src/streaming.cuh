@@ -0,0 +1,69 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <vector>
+
+#include "simulator.cuh"
+
+namespace simulation {
+
+  /*
+     Out of core Solver::DIRECT, for particle counts whose positions &
+     velocities don't fit in device memory. The authoritative data stays in
+     pinned host memory, and each step streams it through a fixed pool of
+     device tiles: for every target tile, each source tile is copied in &
+     its forces summed, then the targets are integrated & copied back.
+
+     Host to device copies, kernels & device to host copies go to three
+     streams ordered by events, so the next source tile's copy & the
+     previous target tile's copy back overlap the force calculation. Device
+     memory is O(tile * (poolTiles + 8)), independent of n.
+   */
+  class StreamingSolver {
+    public:
+      StreamingSolver(size_t n_, size_t tileSize, int poolTiles);
+      ~StreamingSolver();
+
+      StreamingSolver(const StreamingSolver &) = delete;
+      StreamingSolver &operator=(const StreamingSolver &) = delete;
+
+      void upload(const ParticleData &pos, const ParticleData &vel);
+      void download(ParticleData &pos, ParticleData &vel);
+
+      // One step for all particles (blocks until complete)
+      void step(const SimParam &params, int wg_size);
+
+    private:
+      // Device buffers of one target tile
+      struct Target {
+        ParticleData_d pos;
+        ParticleData_d posNext;
+        ParticleData_d vel;
+        ParticleData_d force;
+      };
+
+      cudaStream_t h2d;      ///< Copies to the device
+      cudaStream_t compute;  ///< Force calculation & integration
+      cudaStream_t d2h;      ///< Copies back to the host
+      size_t n;
+      size_t tile;
+
+      // Pinned host memory, holding every particle
+      ParticleData_d hostPos;
+      ParticleData_d hostPosNext;
+      ParticleData_d hostVel;
+
+      std::vector<ParticleData_d> sources;  ///< Pool of source tiles
+      Target targets[2];                    ///< Double buffered targets
+
+      std::vector<cudaEvent_t> sourceIn;    ///< Source tile copied in
+      std::vector<cudaEvent_t> sourceFree;  ///< Forces from source summed
+      cudaEvent_t targetIn[2];     ///< Target tile copied in
+      cudaEvent_t targetFree[2];   ///< Target tile copied back
+      cudaEvent_t integrated[2];   ///< Target tile integrated
+  };
+
+}  // namespace simulation
@@ -0,0 +1,43 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "sweep_args.hpp"
+
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+SimParam parseSweepArgs(int argc, char **argv, const SweepOption &option) {
+  // The tool's options are consumed here & the rest left to SimParam
+  std::vector<char *> rest = {argv[0]};
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    const size_t eq = arg.find('=');
+    const std::string name =
+      arg.rfind("--", 0) == 0 ? arg.substr(2, eq - 2) : "";
+    const std::string value =
+      eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (name.empty() || !option(name, value)) rest.push_back(argv[i]);
+  }
+  SimParam params;
+  params.parseArgs(rest.size(), rest.data());
+  return params;
+}
+
+std::vector<std::string> splitList(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) items.push_back(item);
+  }
+  if (items.empty()) throw std::invalid_argument("Empty list: " + list);
+  return items;
+}
+
+int parseCount(const std::string &value) {
+  const int n = atoi(value.c_str());
+  if (n <= 0) throw std::invalid_argument("Expected a count, got " + value);
+  return n;
+}
@@ -0,0 +1,51 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sim_param.hpp"
+
+/**
+ * Takes a --name=value option of a tool, returning false for names the
+ * tool doesn't have
+ * @throws std::invalid_argument for a malformed value
+ */
+using SweepOption =
+  std::function<bool(const std::string &name, const std::string &value)>;
+
+/**
+ * Parses the command line of a tool running several simulations, such as
+ * nbody_bench: every --name=value argument is offered to option, & those
+ * it doesn't take, with the positional arguments, give the SimParam the
+ * configurations share, as for nbody
+ * @throws std::invalid_argument for malformed arguments
+ */
+SimParam parseSweepArgs(int argc, char **argv, const SweepOption &option);
+
+/**
+ * The items of a comma separated list
+ * @throws std::invalid_argument for an empty list
+ */
+std::vector<std::string> splitList(const std::string &list);
+
+/**
+ * A comma separated list, each item converted by parse
+ */
+template <typename T, typename F>
+std::vector<T> parseList(const std::string &list, F &&parse) {
+  std::vector<T> values;
+  for (const std::string &item : splitList(list)) {
+    values.push_back(parse(item));
+  }
+  return values;
+}
+
+/**
+ * @throws std::invalid_argument unless value is a positive integer
+ */
+int parseCount(const std::string &value);
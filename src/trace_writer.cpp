@@ -0,0 +1,71 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "trace_writer.hpp"
+
+#include <iomanip>
+#include <stdexcept>
+
+namespace {
+
+// Trace processes, one per PhaseTrack
+int processId(PhaseTrack track) {
+  switch (track) {
+    case PhaseTrack::DEVICE:
+      return 1;
+    case PhaseTrack::GL:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+}  // namespace
+
+TraceWriter::TraceWriter(const std::string &path) : out(path) {
+  if (!out) throw std::runtime_error("Can't create trace " + path);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  out << std::fixed << std::setprecision(3);
+  metadata("process_name", processId(PhaseTrack::HOST), 0, "host");
+  metadata("process_name", processId(PhaseTrack::DEVICE), 0, "device");
+  metadata("thread_name", processId(PhaseTrack::DEVICE), 0, "simulation");
+  metadata("process_name", processId(PhaseTrack::GL), 0, "gl");
+  metadata("thread_name", processId(PhaseTrack::GL), 0, "render passes");
+}
+
+TraceWriter::~TraceWriter() {
+  out << "\n]}\n";
+}
+
+void TraceWriter::write(size_t frame, const std::vector<FramePhase> &phases) {
+  const std::vector<const char *> names = FrameTimer::get().threadNames();
+  for (; namedThreads < names.size(); namedThreads++) {
+    if (names[namedThreads]) {
+      metadata("thread_name", processId(PhaseTrack::HOST), namedThreads,
+          names[namedThreads]);
+    }
+  }
+  // Names are string literals from the instrumented code, so need no
+  // escaping
+  for (const FramePhase &phase : phases) {
+    beginEvent();
+    out << "{\"name\":\"" << phase.name << "\",\"ph\":\"X\",\"pid\":"
+      << processId(phase.track) << ",\"tid\":" << phase.thread
+      << ",\"ts\":" << phase.start << ",\"dur\":" << phase.end - phase.start
+      << ",\"args\":{\"frame\":" << frame << "}}";
+  }
+  out.flush();
+}
+
+void TraceWriter::beginEvent() {
+  out << (first ? "\n" : ",\n");
+  first = false;
+}
+
+void TraceWriter::metadata(const char *kind, int pid, int tid,
+    const char *name) {
+  beginEvent();
+  out << "{\"name\":\"" << kind << "\",\"ph\":\"M\",\"pid\":" << pid
+    << ",\"tid\":" << tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+}
@@ -0,0 +1,47 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "frame_timer.hpp"
+
+/**
+ * Writes FrameTimer phases as a Chrome trace event file, which
+ * chrome://tracing & ui.perfetto.dev open. Host threads, the simulation
+ * device & the GL passes show as separate processes on one timeline, each
+ * phase a complete ("X") event in microseconds since the timer was created.
+ */
+class TraceWriter {
+  public:
+    /**
+     * @throws std::runtime_error if path can't be created
+     */
+    explicit TraceWriter(const std::string &path);
+
+    /**
+     * Closes the event array, so the file is valid JSON
+     */
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    /**
+     * Appends the phases of a frame, from FrameTimer::endFrame
+     */
+    void write(size_t frame, const std::vector<FramePhase> &phases);
+
+  private:
+    void beginEvent();
+    void metadata(const char *kind, int pid, int tid, const char *name);
+
+    std::ofstream out;
+    bool first = true;
+    size_t namedThreads = 0;  ///< FrameTimer::threadNames already written
+};
@@ -0,0 +1,498 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "trajectory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+constexpr char MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+constexpr uint32_t HEADER_SIZE = 64;
+constexpr uint32_t FRAME_HEADER_SIZE = 24;
+constexpr uint32_t KEY_FRAME = 0;
+constexpr uint32_t DELTA_FRAME = 1;
+
+// Quantized values stay below this, so predictions & differences can't
+// overflow an int64_t
+constexpr double MAX_QUANTIZED = double(int64_t(1) << 60);
+
+// rANS with a 32 bit state kept in [RANS_L, RANS_L << 8) by moving bytes
+// in & out, & symbol frequencies scaled to sum to SCALE
+constexpr uint32_t SCALE_BITS = 14;
+constexpr uint32_t SCALE = 1u << SCALE_BITS;
+constexpr uint32_t RANS_L = 1u << 23;
+// A symbol is the bit length of a difference, 0 to 64
+constexpr int NUM_SYMBOLS = 65;
+
+using Frequencies = std::array<uint32_t, NUM_SYMBOLS>;
+
+void putLE(std::vector<char> &buf, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) buf.push_back(char(value >> (8 * i)));
+}
+
+void putDouble(std::vector<char> &buf, double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  putLE(buf, bits, 8);
+}
+
+// Reads little-endian values from a byte buffer
+class Cursor {
+  public:
+    Cursor(const char *data_, size_t size_) : data(data_), size(size_) {}
+
+    uint64_t get(int bytes) {
+      const char *p = take(bytes);
+      uint64_t value = 0;
+      for (int i = 0; i < bytes; i++) {
+        value |= uint64_t(uint8_t(p[i])) << (8 * i);
+      }
+      return value;
+    }
+
+    double getDouble() {
+      uint64_t bits = get(8);
+      double value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+
+    const char *take(size_t n) {
+      if (pos + n > size) throw std::runtime_error("Truncated trajectory");
+      const char *p = data + pos;
+      pos += n;
+      return p;
+    }
+
+  private:
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+};
+
+// Packs bit fields, least significant first
+class BitWriter {
+  public:
+    void put(uint64_t bits, int count) {
+      while (count > 0) {
+        int take = std::min(count, 32);
+        acc |= (bits & ((uint64_t(1) << take) - 1)) << fill;
+        fill += take;
+        bits >>= take;
+        count -= take;
+        while (fill >= 8) {
+          buf.push_back(char(acc));
+          acc >>= 8;
+          fill -= 8;
+        }
+      }
+    }
+
+    std::vector<char> finish() {
+      if (fill > 0) buf.push_back(char(acc));
+      return std::move(buf);
+    }
+
+  private:
+    std::vector<char> buf;
+    uint64_t acc = 0;
+    int fill = 0;
+};
+
+class BitReader {
+  public:
+    BitReader(const char *data_, size_t size_) : data(data_), size(size_) {}
+
+    uint64_t get(int count) {
+      uint64_t result = 0;
+      for (int got = 0; got < count;) {
+        if (fill == 0) {
+          if (pos == size) throw std::runtime_error("Truncated trajectory");
+          acc = uint8_t(data[pos++]);
+          fill = 8;
+        }
+        int take = std::min(count - got, fill);
+        result |= (acc & ((uint64_t(1) << take) - 1)) << got;
+        acc >>= take;
+        fill -= take;
+        got += take;
+      }
+      return result;
+    }
+
+  private:
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+    uint64_t acc = 0;
+    int fill = 0;
+};
+
+uint64_t zigzag(int64_t v) {
+  return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+int64_t unzigzag(uint64_t z) {
+  return int64_t(z >> 1) ^ -int64_t(z & 1);
+}
+
+int bitLength(uint64_t z) {
+  return z == 0 ? 0 : 64 - __builtin_clzll(z);
+}
+
+// Scales symbol counts to frequencies summing to SCALE, keeping every
+// symbol which occurs
+Frequencies normalize(const std::array<uint64_t, NUM_SYMBOLS> &counts,
+    uint64_t total) {
+  Frequencies freq{};
+  if (total == 0) return freq;
+  uint32_t sum = 0;
+  int largest = 0;
+  for (int s = 0; s < NUM_SYMBOLS; s++) {
+    if (counts[s] == 0) continue;
+    freq[s] = std::max<uint64_t>(1, counts[s] * SCALE / total);
+    sum += freq[s];
+    if (counts[s] > counts[largest]) largest = s;
+  }
+  // Rounding leaves the sum within NUM_SYMBOLS of SCALE, which the most
+  // frequent symbol (at least SCALE / NUM_SYMBOLS) absorbs
+  freq[largest] = freq[largest] + SCALE - sum;
+  return freq;
+}
+
+Frequencies cumulative(const Frequencies &freq) {
+  Frequencies cum{};
+  for (int s = 1; s < NUM_SYMBOLS; s++) cum[s] = cum[s - 1] + freq[s - 1];
+  return cum;
+}
+
+/*
+   Entropy codes zigzagged differences as
+     u8 number of symbols used, then (u8 symbol, u16 frequency) for each
+     u32 rANS byte count, rANS bytes
+     u32 raw byte count, bits below the leading one of each value
+ */
+std::vector<char> encodeStream(const std::vector<uint64_t> &values) {
+  std::vector<uint8_t> symbols(values.size());
+  std::array<uint64_t, NUM_SYMBOLS> counts{};
+  BitWriter raw;
+  for (size_t i = 0; i < values.size(); i++) {
+    int s = bitLength(values[i]);
+    symbols[i] = s;
+    counts[s]++;
+    if (s > 1) raw.put(values[i], s - 1);
+  }
+  const Frequencies freq = normalize(counts, values.size());
+  const Frequencies cum = cumulative(freq);
+
+  // rANS decodes in the reverse of the encoding order, so encode from the
+  // end & reverse the bytes
+  std::vector<char> rans;
+  uint32_t x = RANS_L;
+  for (size_t i = values.size(); i-- > 0;) {
+    uint32_t f = freq[symbols[i]];
+    uint32_t xMax = ((RANS_L >> SCALE_BITS) << 8) * f;
+    while (x >= xMax) {
+      rans.push_back(char(x & 0xff));
+      x >>= 8;
+    }
+    x = ((x / f) << SCALE_BITS) + (x % f) + cum[symbols[i]];
+  }
+  for (int b = 3; b >= 0; b--) rans.push_back(char(x >> (8 * b)));
+  std::reverse(rans.begin(), rans.end());
+  std::vector<char> rawBytes = raw.finish();
+
+  std::vector<char> out;
+  int used = std::count_if(freq.begin(), freq.end(),
+      [](uint32_t f) { return f > 0; });
+  putLE(out, used, 1);
+  for (int s = 0; s < NUM_SYMBOLS; s++) {
+    if (freq[s] == 0) continue;
+    putLE(out, s, 1);
+    putLE(out, freq[s], 2);
+  }
+  putLE(out, rans.size(), 4);
+  out.insert(out.end(), rans.begin(), rans.end());
+  putLE(out, rawBytes.size(), 4);
+  out.insert(out.end(), rawBytes.begin(), rawBytes.end());
+  return out;
+}
+
+std::vector<uint64_t> decodeStream(Cursor &in, size_t count) {
+  Frequencies freq{};
+  int used = in.get(1);
+  uint32_t sum = 0;
+  for (int i = 0; i < used; i++) {
+    uint32_t s = in.get(1);
+    if (s >= NUM_SYMBOLS) throw std::runtime_error("Corrupt trajectory");
+    freq[s] = in.get(2);
+    sum += freq[s];
+  }
+  if (count > 0 && sum != SCALE) {
+    throw std::runtime_error("Corrupt trajectory");
+  }
+  const Frequencies cum = cumulative(freq);
+  std::vector<uint8_t> lookup(count > 0 ? SCALE : 0);
+  for (int s = 0; s < NUM_SYMBOLS; s++) {
+    std::fill_n(lookup.begin() + cum[s], freq[s], s);
+  }
+
+  size_t ransSize = in.get(4);
+  const char *rans = in.take(ransSize);
+  size_t rawSize = in.get(4);
+  BitReader raw(in.take(rawSize), rawSize);
+  Cursor state(rans, ransSize);
+  uint32_t x = state.get(4);
+  size_t pos = 4;
+
+  std::vector<uint64_t> values(count);
+  for (size_t i = 0; i < count; i++) {
+    uint32_t slot = x & (SCALE - 1);
+    int s = lookup[slot];
+    x = freq[s] * (x >> SCALE_BITS) + slot - cum[s];
+    while (x < RANS_L) {
+      if (pos == ransSize) throw std::runtime_error("Truncated trajectory");
+      x = (x << 8) | uint8_t(rans[pos++]);
+    }
+    values[i] = s <= 1 ? s : (uint64_t(1) << (s - 1)) | raw.get(s - 1);
+  }
+  return values;
+}
+
+uint64_t spreadBits(uint64_t v) {
+  // Inserts two zero bits between each of the low 21 bits
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// Original indices sorted along a Morton curve through the quantized
+// positions, scaled to 21 bits per axis
+std::vector<uint32_t> mortonOrder(const std::vector<int64_t> *q, size_t n) {
+  std::vector<std::pair<uint64_t, uint32_t>> keys(n);
+  int64_t lo[3];
+  int shift[3];
+  for (int c = 0; c < 3; c++) {
+    auto range = std::minmax_element(q[c].begin(), q[c].end());
+    lo[c] = n ? *range.first : 0;
+    uint64_t span = n ? uint64_t(*range.second - *range.first) : 0;
+    shift[c] = std::max(0, bitLength(span) - 21);
+  }
+  for (size_t i = 0; i < n; i++) {
+    uint64_t code = 0;
+    for (int c = 0; c < 3; c++) {
+      code |= spreadBits(uint64_t(q[c][i] - lo[c]) >> shift[c]) << c;
+    }
+    keys[i] = {code, uint32_t(i)};
+  }
+  std::sort(keys.begin(), keys.end());
+  std::vector<uint32_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = keys[i].second;
+  return order;
+}
+
+}  // namespace
+
+TrajectoryWriter::TrajectoryWriter(const std::string &path_,
+    size_t numParticles, double posError, double velError,
+    int keyframeInterval_)
+  : path(path_), n(numParticles),
+  keyframeInterval(std::max(1, keyframeInterval_)) {
+  if (!(posError > 0) || !(velError > 0)) {
+    throw std::invalid_argument("Trajectory error bounds must be positive");
+  }
+  for (int c = 0; c < 6; c++) {
+    quantum[c] = 2 * (c < 3 ? posError : velError);
+    last[c].resize(n);
+    beforeLast[c].resize(n);
+    quantized[c].resize(n);
+  }
+  out.open(path, std::ios::binary | std::ios::trunc);
+  if (!out) throw std::runtime_error("Can't open " + path);
+
+  std::vector<char> head(MAGIC, MAGIC + sizeof(MAGIC));
+  putLE(head, TRAJECTORY_VERSION, 4);
+  putLE(head, HEADER_SIZE, 4);
+  putLE(head, n, 8);
+  putDouble(head, posError);
+  putDouble(head, velError);
+  putLE(head, keyframeInterval, 4);
+  head.resize(HEADER_SIZE, 0);
+  out.write(head.data(), head.size());
+  written = head.size();
+}
+
+void TrajectoryWriter::write(uint64_t step, const float *const pos[3],
+    const float *const vel[3], const uint32_t *ids) {
+  for (int c = 0; c < 6; c++) {
+    const float *src = c < 3 ? pos[c] : vel[c - 3];
+    for (size_t slot = 0; slot < n; slot++) {
+      size_t id = ids ? ids[slot] : slot;
+      double q = std::nearbyint(src[slot] / quantum[c]);
+      if (id >= n || !(std::fabs(q) < MAX_QUANTIZED)) {
+        throw std::runtime_error("Particle state out of range for " + path);
+      }
+      quantized[c][id] = int64_t(q);
+    }
+  }
+
+  const bool key = frames % keyframeInterval == 0;
+  if (key) {
+    order = mortonOrder(quantized, n);
+    haveBeforeLast = false;
+  }
+
+  // The streams are independent, so code them concurrently
+  std::vector<std::future<std::vector<char>>> streams;
+  if (key) {
+    streams.push_back(std::async(std::launch::async, [&] {
+          std::vector<uint64_t> diff(n);
+          for (size_t k = 0; k < n; k++) {
+            diff[k] = zigzag(int64_t(order[k]) - (k ? order[k - 1] : 0));
+          }
+          return encodeStream(diff);
+          }));
+  }
+  for (int c = 0; c < 6; c++) {
+    streams.push_back(std::async(std::launch::async, [&, c] {
+          std::vector<uint64_t> diff(n);
+          for (size_t k = 0; k < n; k++) {
+            int64_t value = quantized[c][order[k]];
+            int64_t predicted;
+            if (key) {
+              predicted = k ? quantized[c][order[k - 1]] : 0;
+            } else if (haveBeforeLast) {
+              predicted = 2 * last[c][k] - beforeLast[c][k];
+            } else {
+              predicted = last[c][k];
+            }
+            diff[k] = zigzag(value - predicted);
+          }
+          return encodeStream(diff);
+          }));
+  }
+  std::vector<char> data;
+  for (auto &s : streams) {
+    std::vector<char> bytes = s.get();
+    data.insert(data.end(), bytes.begin(), bytes.end());
+  }
+
+  for (int c = 0; c < 6; c++) {
+    std::swap(beforeLast[c], last[c]);
+    for (size_t k = 0; k < n; k++) last[c][k] = quantized[c][order[k]];
+  }
+  haveBeforeLast = !key;
+
+  std::vector<char> frame;
+  putLE(frame, key ? KEY_FRAME : DELTA_FRAME, 4);
+  putLE(frame, 0, 4);
+  putLE(frame, step, 8);
+  putLE(frame, data.size(), 8);
+  out.write(frame.data(), frame.size());
+  out.write(data.data(), data.size());
+  // Complete frames stay readable if the run is killed
+  out.flush();
+  if (!out) throw std::runtime_error("Error writing " + path);
+  written += frame.size() + data.size();
+  frames++;
+}
+
+TrajectoryReader::TrajectoryReader(const std::string &path_) : path(path_) {
+  in.open(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Can't open trajectory " + path);
+  char head[HEADER_SIZE];
+  in.read(head, sizeof(head));
+  if (!in || std::memcmp(head, MAGIC, sizeof(MAGIC)) != 0) {
+    throw std::runtime_error(path + " is not a trajectory");
+  }
+  Cursor r(head + sizeof(MAGIC), HEADER_SIZE - sizeof(MAGIC));
+  uint32_t version = r.get(4);
+  if (version != TRAJECTORY_VERSION) {
+    throw std::runtime_error(path + " has trajectory version " +
+        std::to_string(version) + ", expected " +
+        std::to_string(TRAJECTORY_VERSION));
+  }
+  uint32_t headerSize = r.get(4);
+  n = r.get(8);
+  posError = r.getDouble();
+  velError = r.getDouble();
+  in.seekg(headerSize);
+  for (int c = 0; c < 6; c++) {
+    quantum[c] = 2 * (c < 3 ? posError : velError);
+    last[c].resize(n);
+    beforeLast[c].resize(n);
+  }
+}
+
+bool TrajectoryReader::next(uint64_t &step, float *const pos[3],
+    float *const vel[3]) {
+  char head[FRAME_HEADER_SIZE];
+  in.read(head, sizeof(head));
+  if (in.gcount() == 0 && in.eof()) return false;
+  if (in.gcount() != FRAME_HEADER_SIZE) {
+    throw std::runtime_error("Truncated trajectory " + path);
+  }
+  Cursor h(head, sizeof(head));
+  uint32_t type = h.get(4);
+  h.get(4);
+  step = h.get(8);
+  std::vector<char> data(h.get(8));
+  in.read(data.data(), data.size());
+  if (size_t(in.gcount()) != data.size()) {
+    throw std::runtime_error("Truncated trajectory " + path);
+  }
+
+  Cursor d(data.data(), data.size());
+  const bool key = type == KEY_FRAME;
+  if (key) {
+    std::vector<uint64_t> diff = decodeStream(d, n);
+    order.resize(n);
+    int64_t id = 0;
+    for (size_t k = 0; k < n; k++) {
+      id += unzigzag(diff[k]);
+      if (id < 0 || size_t(id) >= n) {
+        throw std::runtime_error("Corrupt trajectory " + path);
+      }
+      order[k] = id;
+    }
+    haveBeforeLast = false;
+  } else if (type != DELTA_FRAME || !haveLast) {
+    throw std::runtime_error("Corrupt trajectory " + path);
+  }
+
+  for (int c = 0; c < 6; c++) {
+    std::vector<uint64_t> diff = decodeStream(d, n);
+    // beforeLast becomes the previous frame, & last, holding the one
+    // before it, is overwritten with this frame as it's decoded
+    std::swap(beforeLast[c], last[c]);
+    float *dst = c < 3 ? pos[c] : vel[c - 3];
+    for (size_t k = 0; k < n; k++) {
+      int64_t predicted;
+      if (key) {
+        predicted = k ? last[c][k - 1] : 0;
+      } else if (haveBeforeLast) {
+        predicted = 2 * beforeLast[c][k] - last[c][k];
+      } else {
+        predicted = beforeLast[c][k];
+      }
+      last[c][k] = predicted + unzigzag(diff[k]);
+      dst[order[k]] = float(last[c][k] * quantum[c]);
+    }
+  }
+  haveLast = true;
+  haveBeforeLast = !key;
+  return true;
+}
@@ -0,0 +1,125 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Compressed trajectory: a sequence of frames of particle positions &
+ * velocities, each quantized to within a fixed absolute error. All values
+ * are little-endian.
+ *
+ * The file starts with a 64 byte header:
+ *   0  char[8] magic "NBODYTRJ"
+ *   8  u32     format version (TRAJECTORY_VERSION)
+ *   12 u32     header size (64)
+ *   16 u64     number of particles
+ *   24 f64     position error bound
+ *   32 f64     velocity error bound
+ *   40 u32     frames between key frames
+ *   44 ...     reserved (0)
+ * followed by frames, each a 24 byte frame header
+ *   0  u32     frame type (0 = key, 1 = delta)
+ *   4  u32     reserved (0)
+ *   8  u64     step
+ *   16 u64     size of the frame data that follows
+ *
+ * A value v is stored as the integer q = round(v / (2 * error)), so it
+ * decodes to within error (plus float rounding). Key frames sort the
+ * particles along a Morton curve through their quantized positions & store
+ * the particle ids in that order, then each component as the difference
+ * from the previous particle's. Delta frames keep the key frame's order &
+ * store each component as the difference from a linear extrapolation of
+ * the previous two frames (from the previous frame, just after a key
+ * frame). The differences are entropy coded with rANS: the bit length of
+ * each (zigzag coded) difference is the rANS symbol & the bits below its
+ * leading one follow uncoded.
+ */
+
+constexpr uint32_t TRAJECTORY_VERSION = 1;
+
+/**
+ * Appends frames to a trajectory file
+ */
+class TrajectoryWriter {
+  public:
+    /**
+     * Creates (or truncates) path
+     * @param posError maximum absolute error of the stored positions
+     * @param velError maximum absolute error of the stored velocities
+     * @param keyframeInterval frames between key frames (at least 1)
+     */
+    TrajectoryWriter(const std::string &path, size_t numParticles,
+        double posError, double velError, int keyframeInterval);
+
+    /**
+     * Writes a frame
+     * @param pos, vel numParticles elements per component
+     * @param ids original index of the particle in each slot of pos & vel,
+     * or nullptr if unordered. Frames are decoded in original index order.
+     */
+    void write(uint64_t step, const float *const pos[3],
+        const float *const vel[3], const uint32_t *ids = nullptr);
+
+    /**
+     * Bytes written so far, including the header
+     */
+    uint64_t bytesWritten() const { return written; }
+
+  private:
+    std::string path;
+    std::ofstream out;
+    size_t n;
+    double quantum[6];  ///< Quantization step of each component
+    int keyframeInterval;
+    uint64_t frames = 0;
+    uint64_t written = 0;
+
+    // Original index of the particles in key frame order, with their
+    // quantized values in the last two frames, per component
+    std::vector<uint32_t> order;
+    std::vector<int64_t> last[6];
+    std::vector<int64_t> beforeLast[6];
+    bool haveBeforeLast = false;
+    // Quantized values of the frame being written, by original index
+    std::vector<int64_t> quantized[6];
+};
+
+/**
+ * Decodes the frames of a trajectory file in order
+ */
+class TrajectoryReader {
+  public:
+    explicit TrajectoryReader(const std::string &path);
+
+    size_t numParticles() const { return n; }
+    double positionError() const { return posError; }
+    double velocityError() const { return velError; }
+
+    /**
+     * Decodes the next frame, in original particle index order
+     * @param pos, vel numParticles elements per component
+     * @return false at the end of the file
+     */
+    bool next(uint64_t &step, float *const pos[3], float *const vel[3]);
+
+  private:
+    std::string path;
+    std::ifstream in;
+    size_t n;
+    double posError;
+    double velError;
+    double quantum[6];
+
+    std::vector<uint32_t> order;
+    std::vector<int64_t> last[6];
+    std::vector<int64_t> beforeLast[6];
+    bool haveLast = false;
+    bool haveBeforeLast = false;
+};
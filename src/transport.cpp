@@ -0,0 +1,261 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "transport.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef NBODY_USE_MPI
+#include <mpi.h>
+#endif
+
+std::pair<size_t, size_t> rankRange(size_t n, int rank, int size) {
+  return {n * rank / size, n * (rank + 1) / size};
+}
+
+namespace {
+
+/**
+ * Layout of the start of the shared memory segment, followed by the data
+ * area used to gather values & a flag per rank for anyOf
+ */
+struct ShmHeader {
+  pthread_barrier_t barrier;
+  std::atomic<int> ready;
+  int size;
+  size_t capacity;
+  pid_t owner;     ///< Rank 0's process
+  char token[64];  ///< Rank 0's --shmToken
+};
+
+/**
+ * Transport between processes on one machine, through a POSIX shared
+ * memory segment. Rank 0 creates the segment & the others attach to it, so
+ * ranks can be started in any order. A segment left by a crashed run is
+ * told apart by its token, which must match --shmToken if given, or else
+ * by its rank 0 no longer running.
+ */
+class ShmTransport : public Transport {
+  public:
+    ShmTransport(const std::string &name, const std::string &token,
+        int rank_, int size_, size_t capacity)
+      : r(rank_), s(size_) {
+      if (s < 1 || r < 0 || r >= s) {
+        throw std::invalid_argument("--rank must be in [0, --ranks)");
+      }
+      if (token.size() >= sizeof(ShmHeader::token)) {
+        throw std::invalid_argument("--shmToken is too long");
+      }
+      bytes = sizeof(ShmHeader) + capacity * sizeof(float) +
+        s * sizeof(int);
+
+      if (r == 0) {
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, bytes) != 0) {
+          throw std::runtime_error("Can't create shared memory " + name);
+        }
+        map(fd, name);
+
+        pthread_barrierattr_t attr;
+        pthread_barrierattr_init(&attr);
+        pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_barrier_init(&header->barrier, &attr, s);
+        pthread_barrierattr_destroy(&attr);
+        header->size = s;
+        header->capacity = capacity;
+        header->owner = getpid();
+        token.copy(header->token, sizeof(header->token) - 1);
+        header->ready.store(1, std::memory_order_release);
+      } else {
+        // Wait for rank 0 to create & size the segment & fill in the
+        // header, reopening the name in case it's still a previous run's
+        auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+        while (!attach(name, token)) {
+          if (std::chrono::steady_clock::now() > deadline) {
+            throw std::runtime_error("Timed out waiting for rank 0 to "
+                "create " + name);
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (header->size != s || header->capacity != capacity) {
+          throw std::runtime_error("Ranks disagree on --ranks or particle "
+              "count");
+        }
+      }
+
+      // Every rank is attached, so the name is no longer needed
+      barrier();
+      if (r == 0) shm_unlink(name.c_str());
+    }
+
+    ~ShmTransport() { munmap(header, bytes); }
+
+    int rank() const override { return r; }
+    int size() const override { return s; }
+
+    void allGather(float *data, size_t n) override {
+      if (n > header->capacity) {
+        throw std::invalid_argument("allGather larger than shared memory");
+      }
+      auto range = rankRange(n, r, s);
+      std::memcpy(area + range.first, data + range.first,
+          (range.second - range.first) * sizeof(float));
+      barrier();
+      std::memcpy(data, area, n * sizeof(float));
+      // Nobody may write the next values until everyone has read these
+      barrier();
+    }
+
+    bool anyOf(bool flag) override {
+      flags[r] = flag;
+      barrier();
+      bool any = false;
+      for (int i = 0; i < s; i++) any = any || flags[i];
+      // Nobody may write the next flags until everyone has read these
+      barrier();
+      return any;
+    }
+
+    void barrier() override {
+      int rc = pthread_barrier_wait(&header->barrier);
+      if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD) {
+        throw std::runtime_error("pthread_barrier_wait failed");
+      }
+    }
+
+  private:
+    static constexpr std::chrono::seconds TIMEOUT{60};
+
+    // Maps the segment open on fd, which is then closed
+    void map(int fd, const std::string &name) {
+      void *mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+          fd, 0);
+      close(fd);
+      if (mem == MAP_FAILED) {
+        throw std::runtime_error("Can't map shared memory " + name);
+      }
+      header = static_cast<ShmHeader *>(mem);
+      area = reinterpret_cast<float *>(header + 1);
+      flags = reinterpret_cast<int *>(static_cast<char *>(mem) + bytes) - s;
+    }
+
+    // Maps the segment if this run's rank 0 has finished creating it
+    bool attach(const std::string &name, const std::string &token) {
+      struct stat st {};
+      int fd = shm_open(name.c_str(), O_RDWR, 0600);
+      if (fd < 0) return false;
+      if (fstat(fd, &st) != 0 || size_t(st.st_size) < bytes) {
+        close(fd);
+        return false;
+      }
+      map(fd, name);
+      bool current = header->ready.load(std::memory_order_acquire) == 1;
+      if (current && token.empty()) {
+        // A crashed run's rank 0 has gone
+        current = kill(header->owner, 0) == 0 || errno == EPERM;
+      } else if (current) {
+        // Zero filled by ftruncate, so terminated
+        current = token == header->token;
+      }
+      if (!current) {
+        munmap(header, bytes);
+        header = nullptr;
+      }
+      return current;
+    }
+
+    int r;
+    int s;
+    size_t bytes;
+    ShmHeader *header = nullptr;
+    float *area = nullptr;
+    int *flags = nullptr;
+};
+
+#ifdef NBODY_USE_MPI
+/**
+ * Transport over MPI_COMM_WORLD. Ranks are assigned by the MPI launcher.
+ */
+class MpiTransport : public Transport {
+  public:
+    MpiTransport() {
+      int initialized;
+      MPI_Initialized(&initialized);
+      if (!initialized) {
+        MPI_Init(nullptr, nullptr);
+        ownsMpi = true;
+      }
+      MPI_Comm_rank(MPI_COMM_WORLD, &r);
+      MPI_Comm_size(MPI_COMM_WORLD, &s);
+    }
+
+    ~MpiTransport() {
+      if (ownsMpi) MPI_Finalize();
+    }
+
+    int rank() const override { return r; }
+    int size() const override { return s; }
+
+    void allGather(float *data, size_t n) override {
+      std::vector<int> counts(s);
+      std::vector<int> displs(s);
+      for (int i = 0; i < s; i++) {
+        auto range = rankRange(n, i, s);
+        displs[i] = range.first;
+        counts[i] = range.second - range.first;
+      }
+      MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, data, counts.data(),
+          displs.data(), MPI_FLOAT, MPI_COMM_WORLD);
+    }
+
+    bool anyOf(bool flag) override {
+      int local = flag;
+      int any;
+      MPI_Allreduce(&local, &any, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+      return any != 0;
+    }
+
+    void barrier() override { MPI_Barrier(MPI_COMM_WORLD); }
+
+  private:
+    int r;
+    int s;
+    bool ownsMpi = false;
+};
+#endif
+
+}  // namespace
+
+std::unique_ptr<Transport> makeTransport(const SimParam &params) {
+  switch (params.transport) {
+    case TransportKind::SHM:
+      return std::make_unique<ShmTransport>(params.shmName,
+          params.shmToken, params.rank, params.numRanks,
+          params.numParticles);
+    case TransportKind::MPI:
+#ifdef NBODY_USE_MPI
+      return std::make_unique<MpiTransport>();
+#else
+      throw std::invalid_argument("Built without MPI (configure with "
+          "-DUSE_MPI=ON)");
+#endif
+    default:
+      return nullptr;
+  }
+}
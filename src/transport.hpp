@@ -0,0 +1,52 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "sim_param.hpp"
+
+/**
+ * Exchange of particle data between the processes (ranks) of a distributed
+ * run. Each rank owns a contiguous range of particles, given by rankRange,
+ * and computes new values only for that range.
+ */
+class Transport {
+  public:
+    virtual ~Transport() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    /**
+     * Fills each rank's range of data[0, n) with the values held by the
+     * rank owning it. Must be called by every rank with the same n.
+     */
+    virtual void allGather(float *data, size_t n) = 0;
+
+    /**
+     * Whether flag is true on any rank, the same result on every rank.
+     * Must be called by every rank.
+     */
+    virtual bool anyOf(bool flag) = 0;
+
+    /**
+     * Blocks until every rank has reached the barrier
+     */
+    virtual void barrier() = 0;
+};
+
+/**
+ * Particles [first, second) of n owned by the given rank
+ */
+std::pair<size_t, size_t> rankRange(size_t n, int rank, int size);
+
+/**
+ * Creates the transport selected in params
+ * @return nullptr for a single process run
+ */
+std::unique_ptr<Transport> makeTransport(const SimParam &params);
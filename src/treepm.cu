@@ -0,0 +1,502 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "treepm.cuh"
+#include "morton.cuh"
+
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace simulation {
+
+  namespace {
+    // Short range forces are dropped beyond this many split scales
+    constexpr coords_t CUTOFF_SCALES = 4.5;
+    // Depth of the tree walk stack. Nodes that would overflow it are
+    // accepted as they are, rather than opened.
+    constexpr int STACK_SIZE = 64;
+    constexpr int THREADS = 256;
+
+    int blocksFor(size_t n) { return (n + THREADS - 1) / THREADS; }
+
+    // Position wrapped into [0, box)
+    __device__ inline coords_t wrap(coords_t x, coords_t box) {
+      return x - box * floorf(x / box);
+    }
+
+    // Displacement to the nearest periodic image
+    __device__ inline coords_t nearestImage(coords_t d, coords_t box) {
+      return d - box * rintf(d / box);
+    }
+
+    __device__ inline Complex operator+(const Complex &a, const Complex &b) {
+      return {a.re + b.re, a.im + b.im};
+    }
+
+    __device__ inline Complex operator-(const Complex &a, const Complex &b) {
+      return {a.re - b.re, a.im - b.im};
+    }
+
+    __device__ inline Complex operator*(const Complex &a, const Complex &b) {
+      return {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re};
+    }
+
+    __device__ inline coords_t sinc(coords_t x) {
+      return x == 0 ? coords_t(1) : sinf(x) / x;
+    }
+
+    // Length of the common prefix of the keys of sorted leaves i & j, or -1
+    // if j is out of range. Equal keys are told apart by their index.
+    __device__ inline int commonPrefix(const uint32_t *keys, int n, int i,
+        int j) {
+      if (j < 0 || j >= n) return -1;
+      uint32_t a = keys[i];
+      uint32_t b = keys[j];
+      if (a == b) return 32 + __clz(i ^ j);
+      return __clz(a ^ b);
+    }
+
+    // Fraction of the Newtonian force at distance r left to the short range
+    // part, given 1 / 2rs
+    __device__ inline coords_t shortRangeFactor(coords_t r, coords_t inv2rs) {
+      coords_t u = r * inv2rs;
+      return erfcf(u) + coords_t(1.1283791670955126) * u * expf(-u * u);
+    }
+
+    // Squared distance from p to the nearest periodic image of the box
+    // [lo, hi], zero if p is inside it
+    __device__ inline coords_t boxDistSqr(const vec3 &p, const vec3 &lo,
+        const vec3 &hi, coords_t box) {
+      coords_t c[3] = {(lo.x + hi.x) / 2 - p.x, (lo.y + hi.y) / 2 - p.y,
+        (lo.z + hi.z) / 2 - p.z};
+      coords_t h[3] = {(hi.x - lo.x) / 2, (hi.y - lo.y) / 2,
+        (hi.z - lo.z) / 2};
+      coords_t d2 = 0;
+      for (int a = 0; a < 3; a++) {
+        coords_t d = fmaxf(fabsf(nearestImage(c[a], box)) - h[a], 0.0f);
+        d2 += d * d;
+      }
+      return d2;
+    }
+  }  // namespace
+
+  // In place radix-2 FFT of each mesh line along one axis
+  __global__ void fft_lines(Complex *mesh, const Complex *tw, int ng,
+      int logNg, int axis, float sign) {
+    size_t l = blockIdx.x * blockDim.x + threadIdx.x;
+    if (l >= size_t(ng) * ng) return;
+    size_t a = l % ng;
+    size_t b = l / ng;
+    size_t base, stride;
+    if (axis == 0) {
+      base = l * ng;
+      stride = 1;
+    } else if (axis == 1) {
+      base = b * ng * ng + a;
+      stride = ng;
+    } else {
+      base = b * ng + a;
+      stride = size_t(ng) * ng;
+    }
+    Complex *line = mesh + base;
+
+    // Bit reversal permutation, then iterative radix-2 butterflies
+    for (int i = 0; i < ng; i++) {
+      int j = __brev(i) >> (32 - logNg);
+      if (i < j) {
+        Complex t = line[i * stride];
+        line[i * stride] = line[j * stride];
+        line[j * stride] = t;
+      }
+    }
+    for (int len = 2; len <= ng; len <<= 1) {
+      int half = len >> 1;
+      int twStep = ng / len;
+      for (int i = 0; i < ng; i += len) {
+        for (int k = 0; k < half; k++) {
+          Complex w = tw[k * twStep];
+          w.im *= sign;
+          Complex u = line[(i + k) * stride];
+          Complex v = line[(i + k + half) * stride] * w;
+          line[(i + k) * stride] = u + v;
+          line[(i + k + half) * stride] = u - v;
+        }
+      }
+    }
+  }
+
+  // Cloud-in-cell mass assignment, with cell centres at (i + 0.5) * size
+  __global__ void cic_deposit(ParticleData_d p, size_t n, Complex *mesh,
+      int ng, coords_t box) {
+    size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n) return;
+    const coords_t invCellSize = ng / box;
+    coords_t u[3] = {wrap(p.x[i], box) * invCellSize - coords_t(0.5),
+      wrap(p.y[i], box) * invCellSize - coords_t(0.5),
+      wrap(p.z[i], box) * invCellSize - coords_t(0.5)};
+    int c[3];
+    coords_t f[3];
+    for (int a = 0; a < 3; a++) {
+      coords_t fl = floorf(u[a]);
+      c[a] = int(fl);
+      f[a] = u[a] - fl;
+    }
+    for (int dz = 0; dz < 2; dz++) {
+      for (int dy = 0; dy < 2; dy++) {
+        for (int dx = 0; dx < 2; dx++) {
+          coords_t w = (dx ? f[0] : 1 - f[0]) * (dy ? f[1] : 1 - f[1]) *
+            (dz ? f[2] : 1 - f[2]);
+          int x = (c[0] + dx) & (ng - 1);
+          int y = (c[1] + dy) & (ng - 1);
+          int z = (c[2] + dz) & (ng - 1);
+          atomicAdd(&mesh[(size_t(z) * ng + y) * ng + x].re, w);
+        }
+      }
+    }
+  }
+
+  // Long range Green's function -4 pi / k^2 * exp(-k^2 rs^2), deconvolved by
+  // the CIC window of both the assignment & the interpolation. norm folds in
+  // the cell volume (density from counts) & the inverse FFT normalisation.
+  __global__ void pm_green(Complex *mesh, int ng, coords_t box,
+      coords_t rs2, coords_t norm) {
+    size_t c = blockIdx.x * blockDim.x + threadIdx.x;
+    if (c >= size_t(ng) * ng * ng) return;
+    if (c == 0) {
+      mesh[0] = {0, 0};
+      return;
+    }
+    int x = c % ng;
+    int y = (c / ng) % ng;
+    int z = c / (size_t(ng) * ng);
+    const coords_t kFund = 2 * PI / box;
+    const coords_t cellSize = box / ng;
+    coords_t kx = kFund * (x <= ng / 2 ? x : x - ng);
+    coords_t ky = kFund * (y <= ng / 2 ? y : y - ng);
+    coords_t kz = kFund * (z <= ng / 2 ? z : z - ng);
+    coords_t k2 = kx * kx + ky * ky + kz * kz;
+    coords_t s = sinc(kx * cellSize / 2) * sinc(ky * cellSize / 2) *
+      sinc(kz * cellSize / 2);
+    coords_t window = s * s;
+    coords_t g = -4 * PI / k2 * expf(-k2 * rs2) * norm / (window * window);
+    mesh[c].re *= g;
+    mesh[c].im *= g;
+  }
+
+  // Acceleration -grad(phi), by fourth order central differences
+  __global__ void pm_gradient(const Complex *mesh, ParticleData_d force,
+      int ng, coords_t box) {
+    size_t c = blockIdx.x * blockDim.x + threadIdx.x;
+    if (c >= size_t(ng) * ng * ng) return;
+    int x = c % ng;
+    int y = (c / ng) % ng;
+    int z = c / (size_t(ng) * ng);
+    const coords_t cellSize = box / ng;
+    const coords_t c1 = coords_t(2) / (3 * cellSize);
+    const coords_t c2 = coords_t(1) / (12 * cellSize);
+    auto phi = [=](int xx, int yy, int zz) {
+      return mesh[(size_t(zz & (ng - 1)) * ng + (yy & (ng - 1))) * ng +
+        (xx & (ng - 1))].re;
+    };
+    force.x[c] = -(c1 * (phi(x + 1, y, z) - phi(x - 1, y, z)) -
+        c2 * (phi(x + 2, y, z) - phi(x - 2, y, z)));
+    force.y[c] = -(c1 * (phi(x, y + 1, z) - phi(x, y - 1, z)) -
+        c2 * (phi(x, y + 2, z) - phi(x, y - 2, z)));
+    force.z[c] = -(c1 * (phi(x, y, z + 1) - phi(x, y, z - 1)) -
+        c2 * (phi(x, y, z + 2) - phi(x, y, z - 2)));
+  }
+
+  __global__ void tree_keys(ParticleData_d p, size_t n, coords_t box,
+      uint32_t *keys, uint32_t *order) {
+    size_t i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n) return;
+    const coords_t invBox = 1 / box;
+    keys[i] = mortonKey(wrap(p.x[i], box) * invBox,
+        wrap(p.y[i], box) * invBox, wrap(p.z[i], box) * invBox);
+    order[i] = i;
+  }
+
+  // Internal nodes (Karras 2012): node i covers the range of leaves sharing
+  // its longest common key prefix with a neighbour, split where the next bit
+  // changes
+  __global__ void tree_internal(const uint32_t *keys, TreeNodes t) {
+    const int count = t.numLeaves;
+    const int leafBase = count - 1;
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count - 1) return;
+    int d = commonPrefix(keys, count, i, i + 1) >
+      commonPrefix(keys, count, i, i - 1) ? 1 : -1;
+
+    // Far end of the range, by exponential then binary search
+    int minPrefix = commonPrefix(keys, count, i, i - d);
+    int lMax = 2;
+    while (commonPrefix(keys, count, i, i + lMax * d) > minPrefix) {
+      lMax *= 2;
+    }
+    int l = 0;
+    for (int step = lMax / 2; step >= 1; step /= 2) {
+      if (commonPrefix(keys, count, i, i + (l + step) * d) > minPrefix) {
+        l += step;
+      }
+    }
+    int j = i + l * d;
+
+    // Split position, by binary search
+    int nodePrefix = commonPrefix(keys, count, i, j);
+    int s = 0;
+    int step = l;
+    do {
+      step = (step + 1) >> 1;
+      if (commonPrefix(keys, count, i, i + (s + step) * d) > nodePrefix) {
+        s += step;
+      }
+    } while (step > 1);
+    int split = i + s * d + min(d, 0);
+
+    int left = min(i, j) == split ? leafBase + split : split;
+    int right = max(i, j) == split + 1 ? leafBase + split + 1 : split + 1;
+    t.left[i] = left;
+    t.right[i] = right;
+    t.parent[left] = i;
+    t.parent[right] = i;
+  }
+
+  // Mass, centre of mass & bounds, from the leaves up. The second child to
+  // reach a node combines both, so each node is visited once. Node data
+  // written by other blocks is read through L2 (__ldcg), as L1 isn't
+  // coherent between SMs.
+  __global__ void tree_summarise(ParticleData_d p, coords_t box,
+      TreeNodes t) {
+    int k = blockIdx.x * blockDim.x + threadIdx.x;
+    if (k >= t.numLeaves) return;
+    int node = t.numLeaves - 1 + k;
+    uint32_t i = t.order[k];
+    coords_t x = wrap(p.x[i], box);
+    coords_t y = wrap(p.y[i], box);
+    coords_t z = wrap(p.z[i], box);
+    t.mass[node] = 1;
+    t.com.x[node] = t.lo.x[node] = t.hi.x[node] = x;
+    t.com.y[node] = t.lo.y[node] = t.hi.y[node] = y;
+    t.com.z[node] = t.lo.z[node] = t.hi.z[node] = z;
+
+    int parent = t.parent[node];
+    while (parent >= 0) {
+      __threadfence();
+      if (atomicAdd(&t.flags[parent], 1) == 0) break;
+
+      int a = t.left[parent];
+      int b = t.right[parent];
+      coords_t ma = __ldcg(&t.mass[a]);
+      coords_t mb = __ldcg(&t.mass[b]);
+      coords_t m = ma + mb;
+      t.mass[parent] = m;
+      t.com.x[parent] = (ma * __ldcg(&t.com.x[a]) +
+          mb * __ldcg(&t.com.x[b])) / m;
+      t.com.y[parent] = (ma * __ldcg(&t.com.y[a]) +
+          mb * __ldcg(&t.com.y[b])) / m;
+      t.com.z[parent] = (ma * __ldcg(&t.com.z[a]) +
+          mb * __ldcg(&t.com.z[b])) / m;
+      t.lo.x[parent] = fminf(__ldcg(&t.lo.x[a]), __ldcg(&t.lo.x[b]));
+      t.lo.y[parent] = fminf(__ldcg(&t.lo.y[a]), __ldcg(&t.lo.y[b]));
+      t.lo.z[parent] = fminf(__ldcg(&t.lo.z[a]), __ldcg(&t.lo.z[b]));
+      t.hi.x[parent] = fmaxf(__ldcg(&t.hi.x[a]), __ldcg(&t.hi.x[b]));
+      t.hi.y[parent] = fmaxf(__ldcg(&t.hi.y[a]), __ldcg(&t.hi.y[b]));
+      t.hi.z[parent] = fmaxf(__ldcg(&t.hi.z[a]), __ldcg(&t.hi.z[b]));
+      node = parent;
+      parent = t.parent[node];
+    }
+  }
+
+  /* Tree walk for the short range force, plus the long range force
+     interpolated from the mesh with the same CIC weights used for the
+     assignment.
+   */
+  template <typename accum_t>
+    __global__ void treepm_interaction(ParticleData_d pPos,
+        ParticleData_d pNextPos, ParticleData_d pVel,
+        InteractionConstants k, TreeNodes t, ParticleData_d meshForce,
+        int ng, coords_t box, coords_t inv2rs, coords_t cutoffSqr,
+        coords_t thetaSqr) {
+      int id = threadIdx.x + (blockIdx.x * blockDim.x);
+      if (id >= k.numParticles) return;
+
+      accum_t force;
+      vec3 pos(wrap(pPos.x[id], box), wrap(pPos.y[id], box),
+          wrap(pPos.z[id], box));
+
+      int stack[STACK_SIZE];
+      int top = 0;
+      stack[top++] = 0;
+      while (top > 0) {
+        int node = stack[--top];
+        bool leaf = node >= t.numLeaves - 1;
+        if (leaf && t.order[node - (t.numLeaves - 1)] == uint32_t(id)) {
+          continue;
+        }
+
+        vec3 lo(t.lo.x[node], t.lo.y[node], t.lo.z[node]);
+        vec3 hi(t.hi.x[node], t.hi.y[node], t.hi.z[node]);
+        coords_t boxSqr = boxDistSqr(pos, lo, hi, box);
+        if (boxSqr >= cutoffSqr) continue;
+
+        vec3 r(nearestImage(t.com.x[node] - pos.x, box),
+            nearestImage(t.com.y[node] - pos.y, box),
+            nearestImage(t.com.z[node] - pos.z, box));
+        coords_t r_sqr = dot(r, r);
+        vec3 size = hi - lo;
+        coords_t sizeMax = fmaxf(size.x, fmaxf(size.y, size.z));
+        bool accept = leaf || (boxSqr > 0 &&
+            sizeMax * sizeMax < thetaSqr * r_sqr) || top + 2 > STACK_SIZE;
+
+        if (accept) {
+          coords_t dist_sqr = r_sqr + k.distEps;
+          coords_t scale = t.mass[node] *
+            shortRangeFactor(sqrtf(r_sqr), inv2rs) *
+            rsqrt(dist_sqr * dist_sqr * dist_sqr);
+          force.add(r * scale);
+        } else {
+          stack[top++] = t.left[node];
+          stack[top++] = t.right[node];
+        }
+      }
+
+      // Long range part
+      const coords_t invCellSize = ng / box;
+      coords_t u[3] = {pos.x * invCellSize - coords_t(0.5),
+        pos.y * invCellSize - coords_t(0.5),
+        pos.z * invCellSize - coords_t(0.5)};
+      int c[3];
+      coords_t f[3];
+      for (int a = 0; a < 3; a++) {
+        coords_t fl = floorf(u[a]);
+        c[a] = int(fl);
+        f[a] = u[a] - fl;
+      }
+      vec3 longRange;
+      for (int dz = 0; dz < 2; dz++) {
+        for (int dy = 0; dy < 2; dy++) {
+          for (int dx = 0; dx < 2; dx++) {
+            coords_t w = (dx ? f[0] : 1 - f[0]) * (dy ? f[1] : 1 - f[1]) *
+              (dz ? f[2] : 1 - f[2]);
+            size_t cell = (size_t((c[2] + dz) & (ng - 1)) * ng +
+                ((c[1] + dy) & (ng - 1))) * ng + ((c[0] + dx) & (ng - 1));
+            longRange += vec3(meshForce.x[cell], meshForce.y[cell],
+                meshForce.z[cell]) * w;
+          }
+        }
+      }
+      force.add(longRange);
+
+      integrate(pPos, pNextPos, pVel, k, id, force.get());
+    }
+
+  TreePM::TreePM(const SimParam &params)
+    : n(params.numParticles), grid(params.pmGrid),
+    boxSize(params.boxSize),
+    splitScale(params.pmSplit * params.boxSize / params.pmGrid),
+    sorter(params.numParticles), meshForce(size_t(params.pmGrid) *
+        params.pmGrid * params.pmGrid),
+    nodes{static_cast<int>(params.numParticles), nullptr, nullptr, nullptr,
+      nullptr, nullptr, nullptr, ParticleData_d(2 * n - 1),
+      ParticleData_d(2 * n - 1), ParticleData_d(2 * n - 1)} {
+      if (grid < 2 || (grid & (grid - 1)) != 0) {
+        throw std::invalid_argument("PM grid must be a power of two");
+      }
+      if (!(boxSize > 0) || !(splitScale > 0)) {
+        throw std::invalid_argument("Box size & PM split must be positive");
+      }
+      while ((1 << logGrid) < grid) logGrid++;
+
+      const size_t cells = size_t(grid) * grid * grid;
+      gpuErrchk(cudaMalloc((void **)&mesh, sizeof(Complex) * cells));
+
+      // exp(-2 pi i k / grid) for the first half of the roots of unity
+      std::vector<Complex> w(grid / 2);
+      for (int k = 0; k < grid / 2; k++) {
+        double angle = -2.0 * 3.14159265358979323846 * k / grid;
+        w[k] = {float(std::cos(angle)), float(std::sin(angle))};
+      }
+      gpuErrchk(cudaMalloc((void **)&twiddles, sizeof(Complex) * w.size()));
+      gpuErrchk(cudaMemcpy(twiddles, w.data(), sizeof(Complex) * w.size(),
+            cudaMemcpyHostToDevice));
+
+      const size_t numNodes = 2 * n - 1;
+      gpuErrchk(cudaMalloc((void **)&nodes.left, sizeof(int) * n));
+      gpuErrchk(cudaMalloc((void **)&nodes.right, sizeof(int) * n));
+      gpuErrchk(cudaMalloc((void **)&nodes.parent, sizeof(int) * numNodes));
+      gpuErrchk(cudaMalloc((void **)&nodes.flags, sizeof(int) * n));
+      gpuErrchk(cudaMalloc((void **)&nodes.order, sizeof(uint32_t) * n));
+      gpuErrchk(cudaMalloc((void **)&nodes.mass,
+            sizeof(coords_t) * numNodes));
+      gpuErrchk(cudaMalloc((void **)&keys, sizeof(uint32_t) * n));
+    }
+
+  TreePM::~TreePM() {
+    cudaFree(mesh);
+    cudaFree(twiddles);
+    for (auto p : {meshForce, nodes.com, nodes.lo, nodes.hi}) {
+      cudaFree(p.x);
+      cudaFree(p.y);
+      cudaFree(p.z);
+    }
+    cudaFree(nodes.left);
+    cudaFree(nodes.right);
+    cudaFree(nodes.parent);
+    cudaFree(nodes.flags);
+    cudaFree(nodes.order);
+    cudaFree(nodes.mass);
+    cudaFree(keys);
+  }
+
+  void TreePM::fft(bool inverse) {
+    // Each thread transforms one line of the mesh along the axis
+    for (int axis = 0; axis < 3; axis++) {
+      fft_lines<<<blocksFor(size_t(grid) * grid), THREADS>>>(mesh, twiddles,
+          grid, logGrid, axis, inverse ? -1.0f : 1.0f);
+    }
+  }
+
+  void TreePM::computeMeshForce(const ParticleData_d &pos) {
+    const size_t cells = size_t(grid) * grid * grid;
+    gpuErrchk(cudaMemset(mesh, 0, cells * sizeof(Complex)));
+    cic_deposit<<<blocksFor(n), THREADS>>>(pos, n, mesh, grid, boxSize);
+    fft(false);
+    pm_green<<<blocksFor(cells), THREADS>>>(mesh, grid, boxSize,
+        splitScale * splitScale, 1 / (boxSize * boxSize * boxSize));
+    fft(true);
+    pm_gradient<<<blocksFor(cells), THREADS>>>(mesh, meshForce, grid,
+        boxSize);
+  }
+
+  void TreePM::buildTree(const ParticleData_d &pos) {
+    tree_keys<<<blocksFor(n), THREADS>>>(pos, n, boxSize, keys, nodes.order);
+    sorter.sort(keys, nodes.order, n, 3 * MORTON_BITS);
+
+    gpuErrchk(cudaMemset(nodes.parent, 0xFF, sizeof(int)));
+    if (n > 1) {
+      tree_internal<<<blocksFor(n - 1), THREADS>>>(keys, nodes);
+      gpuErrchk(cudaMemset(nodes.flags, 0, (n - 1) * sizeof(int)));
+    }
+    tree_summarise<<<blocksFor(n), THREADS>>>(pos, boxSize, nodes);
+  }
+
+  void TreePM::step(ParticleData_d pos_d, ParticleData_d pos_next_d,
+      ParticleData_d vel_d, const SimParam &params, int nblocks,
+      int wg_size) {
+    computeMeshForce(pos_d);
+    buildTree(pos_d);
+
+    InteractionConstants k = makeInteractionConstants(params);
+    coords_t cutoff = CUTOFF_SCALES * splitScale;
+    coords_t thetaSqr = params.treeTheta * params.treeTheta;
+    dispatchAccumulator(params.accumMethod, [&](auto accum) {
+        treepm_interaction<decltype(accum)><<<nblocks, wg_size>>>(pos_d,
+            pos_next_d, vel_d, k, nodes, meshForce, grid, boxSize,
+            1 / (2 * splitScale), cutoff * cutoff, thetaSqr);
+        });
+  }
+
+}  // namespace simulation
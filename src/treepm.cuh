@@ -0,0 +1,86 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstdint>
+
+#include "device_util.cuh"
+#include "simulator.cuh"
+
+namespace simulation {
+
+  // Single precision complex value held in the PM mesh
+  struct Complex {
+    float re;
+    float im;
+  };
+
+  /*
+     Device view of a linear BVH over the particles in Morton order. Internal
+     nodes are numbered [0, numLeaves - 1) with the root at 0, and leaf i
+     (holding particle order[i]) is node numLeaves - 1 + i. A single particle
+     tree is just the leaf, which is then also node 0.
+   */
+  struct TreeNodes {
+    int numLeaves;
+    int *left;
+    int *right;
+    int *parent;
+    int *flags;        ///< Children completed, for the bottom up pass
+    uint32_t *order;   ///< Particle index held by each leaf
+    coords_t *mass;
+    ParticleData_d com;
+    ParticleData_d lo;
+    ParticleData_d hi;
+  };
+
+  /*
+     TreePM solver for particles in a periodic cubic box. The potential of
+     each particle is split with a Gaussian of scale rs into:
+     - a long range part, solved on a mesh with FFTs (particle-mesh, using
+       cloud-in-cell assignment), and
+     - a short range part, summed over a Barnes-Hut tree out to 4.5 rs,
+       where each pair force is scaled by
+       erfc(r / 2rs) + r / (rs sqrt(pi)) * exp(-r^2 / 4rs^2).
+
+     Positions are taken modulo the box, so particles leaving one side
+     interact as if they had entered through the other.
+   */
+  class TreePM {
+    public:
+      TreePM(const SimParam &params);
+      ~TreePM();
+
+      TreePM(const TreePM &) = delete;
+      TreePM &operator=(const TreePM &) = delete;
+
+      // One step for all particles, writing the new positions to pos_next_d
+      void step(ParticleData_d pos_d, ParticleData_d pos_next_d,
+          ParticleData_d vel_d, const SimParam &params, int nblocks,
+          int wg_size);
+
+    private:
+      // Fills meshForce with the long range acceleration at each mesh cell
+      void computeMeshForce(const ParticleData_d &pos);
+      // In place 3D FFT of the mesh, unnormalised in both directions
+      void fft(bool inverse);
+      void buildTree(const ParticleData_d &pos);
+
+      size_t n;
+      int grid;
+      int logGrid{0};
+      coords_t boxSize;
+      coords_t splitScale;
+      RadixSorter sorter;
+
+      Complex *mesh = nullptr;
+      Complex *twiddles = nullptr;
+      ParticleData_d meshForce;
+
+      TreeNodes nodes;
+      uint32_t *keys = nullptr;
+  };
+
+}  // namespace simulation
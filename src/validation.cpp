@@ -0,0 +1,211 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "validation.hpp"
+#include "parallel.hpp"
+#include "sweep_args.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+double tolerance(const std::string &value) {
+  const double tol = atof(value.c_str());
+  if (!(tol > 0)) {
+    throw std::invalid_argument("Expected a tolerance, got " + value);
+  }
+  return tol;
+}
+
+// Accelerations from the velocities after one step with damping 0, which
+// the integrator sets to exactly force * dt * G
+void accelerationsOf(const HostState &after, const SimParam &params,
+    std::vector<double> accel[3]) {
+  for (int a = 0; a < 3; a++) {
+    accel[a].resize(after.vel[a].size());
+    for (size_t i = 0; i < accel[a].size(); i++) {
+      accel[a][i] = after.vel[a][i] / params.dt;
+    }
+  }
+}
+
+// Displacement of each particle between two states
+void displacement(const HostState &from, const HostState &to,
+    std::vector<double> disp[3]) {
+  for (int a = 0; a < 3; a++) {
+    disp[a].resize(to.pos[a].size());
+    for (size_t i = 0; i < disp[a].size(); i++) {
+      disp[a][i] = to.pos[a][i] - from.pos[a][i];
+    }
+  }
+}
+
+}  // namespace
+
+void referenceAccelerations(const HostState &state, const SimParam &params,
+    std::vector<double> accel[3]) {
+  const size_t n = state.pos[0].size();
+  for (int a = 0; a < 3; a++) accel[a].assign(n, 0);
+  const double *const pos[3] = {state.pos[0].data(), state.pos[1].data(),
+    state.pos[2].data()};
+  const double distEps = params.distEps;
+  parallelRanges(n, [&](size_t begin, size_t end, size_t) {
+      for (size_t i = begin; i < end; i++) {
+        double f[3] = {0, 0, 0};
+        for (size_t j = 0; j < n; j++) {
+          if (j == i) continue;
+          const double r[3] = {pos[0][j] - pos[0][i], pos[1][j] - pos[1][i],
+            pos[2][j] - pos[2][i]};
+          const double distSqr =
+            r[0] * r[0] + r[1] * r[1] + r[2] * r[2] + distEps;
+          const double invDistCube = 1 / (distSqr * std::sqrt(distSqr));
+          for (int a = 0; a < 3; a++) f[a] += r[a] * invDistCube;
+        }
+        for (int a = 0; a < 3; a++) accel[a][i] = params.G * f[a];
+      }
+      });
+}
+
+void referenceSteps(HostState &state, const SimParam &params, int steps) {
+  std::vector<double> accel[3];
+  for (int s = 0; s < steps; s++) {
+    referenceAccelerations(state, params, accel);
+    for (int a = 0; a < 3; a++) {
+      for (size_t i = 0; i < accel[a].size(); i++) {
+        double &v = state.vel[a][i];
+        v = v * params.damping + accel[a][i] * params.dt;
+        state.pos[a][i] += v * params.dt;
+      }
+    }
+  }
+}
+
+ValidationError ValidationError::of(const std::vector<double> value[3],
+    const std::vector<double> reference[3]) {
+  const size_t n = reference[0].size();
+  std::vector<double> errors(n);
+  double refSqr = 0;
+  double errSqr = 0;
+  for (size_t i = 0; i < n; i++) {
+    double e = 0;
+    for (int a = 0; a < 3; a++) {
+      const double d = value[a][i] - reference[a][i];
+      e += d * d;
+      refSqr += reference[a][i] * reference[a][i];
+    }
+    errSqr += e;
+    errors[i] = std::sqrt(e);
+  }
+  ValidationError error;
+  if (n == 0 || refSqr == 0) return error;
+  const double scale = std::sqrt(refSqr / n);
+  auto p99 = errors.begin() + (n - 1) * 99 / 100;
+  std::nth_element(errors.begin(), p99, errors.end());
+  error.p99 = *p99 / scale;
+  error.max = *std::max_element(p99, errors.end()) / scale;
+  error.rms = std::sqrt(errSqr / n) / scale;
+  return error;
+}
+
+ValidateOptions::ValidateOptions(int argc, char **argv)
+  : particles{1000, 4096},
+  methods{CalculationMethod::BRANCH, CalculationMethod::PREDICATED},
+  accums{AccumulationMethod::FLOAT, AccumulationMethod::KAHAN,
+    AccumulationMethod::DOUBLE} {
+  base = parseSweepArgs(argc, argv,
+      [&](const std::string &name, const std::string &value) {
+        if (name == "particles") {
+          particles = parseList<size_t>(value, parseCount);
+        } else if (name == "methods") {
+          methods = parseList<CalculationMethod>(value, getCalculationMethod);
+        } else if (name == "accums") {
+          accums = parseList<AccumulationMethod>(value, getAccumulationMethod);
+        } else if (name == "steps") {
+          steps = parseCount(value);
+        } else if (name == "accelTol") {
+          accelTol = tolerance(value);
+        } else if (name == "posTol") {
+          posTol = tolerance(value);
+        } else {
+          return false;
+        }
+        return true;
+      });
+  if (base.solver != Solver::DIRECT) {
+    throw std::invalid_argument(
+        "The reference is the DIRECT solver's all pairs interaction");
+  }
+}
+
+std::vector<SimParam> ValidateOptions::configurations() const {
+  std::vector<SimParam> configs;
+  for (size_t n : particles) {
+    for (CalculationMethod method : methods) {
+      for (AccumulationMethod accum : accums) {
+        SimParam params = base;
+        params.numParticles = n;
+        params.calcMethod = method;
+        params.accumMethod = accum;
+        params.simIterationsPerFrame = 1;
+        params.reorderInterval = 0;
+        params.autotune = false;
+        configs.push_back(params);
+      }
+    }
+  }
+  return configs;
+}
+
+int runValidation(int argc, char **argv, const ValidationRun &run) {
+  try {
+    ValidateOptions options(argc, argv);
+    const std::vector<SimParam> configs = options.configurations();
+    size_t failed = 0;
+    for (const SimParam &params : configs) {
+      std::cout << params.numParticles << " particles, "
+        << calculationMethodName(params.calcMethod) << ", "
+        << accumulationMethodName(params.accumMethod) << ": ";
+
+      // Accelerations, from a step with damping 0, which discards the
+      // initial velocities
+      SimParam forceOnly = params;
+      forceOnly.damping = 0;
+      HostState initial, after;
+      const std::string device = run(forceOnly, 1, initial, after);
+      std::vector<double> accel[3], refAccel[3];
+      accelerationsOf(after, forceOnly, accel);
+      referenceAccelerations(initial, forceOnly, refAccel);
+      const ValidationError accelError = ValidationError::of(accel, refAccel);
+
+      // Positions after several steps, from the simulator's own start.
+      // Compared as displacements, which the particles' distance from the
+      // origin would otherwise dwarf.
+      run(params, options.steps, initial, after);
+      HostState reference = initial;
+      referenceSteps(reference, params, options.steps);
+      std::vector<double> disp[3], refDisp[3];
+      displacement(initial, after, disp);
+      displacement(initial, reference, refDisp);
+      const ValidationError posError = ValidationError::of(disp, refDisp);
+
+      const bool pass = accelError.max <= options.accelTol &&
+        posError.p99 <= options.posTol;
+      if (!pass) failed++;
+      std::cout << "acceleration error max " << accelError.max << " rms "
+        << accelError.rms << ", displacement error after " << options.steps
+        << " steps max " << posError.max << " p99 " << posError.p99
+        << " rms " << posError.rms
+        << (pass ? " ok" : " FAILED") << " (" << device << ")\n";
+    }
+    std::cout << failed << " of " << configs.size()
+      << " variants out of tolerance\n";
+    return failed > 0 ? 1 : 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+}
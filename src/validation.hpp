@@ -0,0 +1,111 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sim_param.hpp"
+
+/**
+ * Particle state copied from a simulator, in double precision for the
+ * reference
+ */
+struct HostState {
+  std::vector<double> pos[3];
+  std::vector<double> vel[3];
+
+  /**
+   * Copies a simulator's getParticlePos & getParticleVel
+   */
+  template <class Data>
+  void assign(const Data &p, const Data &v) {
+    pos[0].assign(p.x.begin(), p.x.end());
+    pos[1].assign(p.y.begin(), p.y.end());
+    pos[2].assign(p.z.begin(), p.z.end());
+    vel[0].assign(v.x.begin(), v.x.end());
+    vel[1].assign(v.y.begin(), v.y.end());
+    vel[2].assign(v.z.begin(), v.z.end());
+  }
+};
+
+/**
+ * Runs one configuration: constructs a simulator from params, copies its
+ * state to initial, takes steps steps & copies the state to after
+ * @return the device name
+ */
+using ValidationRun = std::function<std::string(const SimParam &params,
+    int steps, HostState &initial, HostState &after)>;
+
+/**
+ * Accelerations of the softened all pairs interaction particle_interaction
+ * computes, G * sum (x_j - x_i) / (r^2 + distEps)^(3/2), in double
+ * precision on host threads
+ */
+void referenceAccelerations(const HostState &state, const SimParam &params,
+    std::vector<double> accel[3]);
+
+/**
+ * Advances state by steps steps of the simulator's integrator (damped
+ * velocity, then position) with referenceAccelerations
+ */
+void referenceSteps(HostState &state, const SimParam &params, int steps);
+
+/**
+ * Error of vectors against a reference, relative to the RMS magnitude of
+ * the reference so that particles whose forces nearly cancel don't
+ * dominate
+ */
+struct ValidationError {
+  double max = 0;
+  double p99 = 0;  ///< 99th percentile
+  double rms = 0;
+
+  static ValidationError of(const std::vector<double> value[3],
+      const std::vector<double> reference[3]);
+};
+
+/**
+ * Command line of nbody_validate. The comma separated lists --particles,
+ * --methods & --accums give the kernel variants, every combination of
+ * which is compared against the reference; every other argument sets the
+ * SimParam of all of them, as for nbody.
+ */
+class ValidateOptions {
+  public:
+    /**
+     * @throws std::invalid_argument for malformed arguments, or a solver
+     * other than Solver::DIRECT
+     */
+    ValidateOptions(int argc, char **argv);
+
+    /**
+     * Parameters of each variant, with one iteration per step & neither
+     * autotuning nor reordering (which would permute the particles)
+     */
+    std::vector<SimParam> configurations() const;
+
+    std::vector<size_t> particles;
+    std::vector<CalculationMethod> methods;
+    std::vector<AccumulationMethod> accums;
+    int steps = 10;          ///< Steps before positions are compared
+    double accelTol = 1e-3;  ///< Largest acceptable acceleration max error
+    double posTol = 1e-3;    ///< Largest acceptable displacement p99
+                             ///< error, as the odd close encounter
+                             ///< amplifies rounding chaotically
+
+  private:
+    SimParam base;
+};
+
+/**
+ * Runs nbody_validate: compares the accelerations of the first step &
+ * the displacements over ValidateOptions::steps steps of every variant
+ * with the reference, & prints their errors
+ * @return the exit status, 1 if any variant is out of tolerance
+ */
+int runValidation(int argc, char **argv, const ValidationRun &run);
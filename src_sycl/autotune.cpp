@@ -0,0 +1 @@
+../src/autotune.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/autotune.hpp
\ No newline at end of file
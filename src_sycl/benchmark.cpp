@@ -0,0 +1 @@
+../src/benchmark.cpp
\ No newline at end of file
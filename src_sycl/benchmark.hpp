@@ -0,0 +1 @@
+../src/benchmark.hpp
\ No newline at end of file
@@ -0,0 +1,209 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "cell_list.dp.hpp"
+#include "device_util.dp.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace simulation {
+
+  namespace {
+    // Limits on grid size, beyond which cells are made wider than asked
+    constexpr int MAX_CELLS_PER_AXIS = 1024;
+    constexpr size_t MAX_CELLS = size_t(1) << 24;
+  }  // namespace
+
+  template <typename accum_t>
+  class cutoff_interaction_kernel;
+
+  CellList::CellList(sycl::queue &q_, size_t n_)
+    : q(q_), n(n_), builtPos(n_, q_) {
+    particleCell = sycl::malloc_device<uint32_t>(n, q);
+    particles = sycl::malloc_device<uint32_t>(n, q);
+    maxDispSqr = sycl::malloc_device<coords_t>(1, q);
+  }
+
+  CellList::~CellList() {
+    q.wait();
+    sycl::free(particleCell, q);
+    sycl::free(particles, q);
+    sycl::free(cellStart, q);
+    sycl::free(cellCursor, q);
+    sycl::free(scanScratch, q);
+    sycl::free(builtPos.x, q);
+    sycl::free(builtPos.y, q);
+    sycl::free(builtPos.z, q);
+    sycl::free(maxDispSqr, q);
+  }
+
+  void CellList::build(const ParticleData_d &pos, coords_t cellSize) {
+    Bounds b = computeBounds(q, pos, n);
+    vec3 extent = b.max - b.min;
+
+    // Widen the cells if the grid would be unreasonably large
+    coords_t maxExtent = std::max({extent.x, extent.y, extent.z});
+    cellSize = std::max(cellSize, maxExtent / MAX_CELLS_PER_AXIS);
+    int dims[3];
+    auto gridSize = [&]() {
+      coords_t e[3] = {extent.x, extent.y, extent.z};
+      size_t total = 1;
+      for (int a = 0; a < 3; a++) {
+        dims[a] = std::clamp<int>(std::ceil(e[a] / cellSize), 1,
+            MAX_CELLS_PER_AXIS);
+        total *= dims[a];
+      }
+      return total;
+    };
+    size_t numCells = gridSize();
+    while (numCells > MAX_CELLS) {
+      cellSize *= 1.25;
+      numCells = gridSize();
+    }
+
+    if (numCells + 1 > cellCapacity) {
+      q.wait();
+      sycl::free(cellStart, q);
+      sycl::free(cellCursor, q);
+      sycl::free(scanScratch, q);
+      cellCapacity = numCells + 1;
+      cellStart = sycl::malloc_device<uint32_t>(cellCapacity, q);
+      cellCursor = sycl::malloc_device<uint32_t>(cellCapacity, q);
+      scanScratch =
+        sycl::malloc_device<uint32_t>(scanScratchSize(cellCapacity), q);
+    }
+
+    grid.origin = b.min;
+    grid.invCellSize = coords_t(1) / cellSize;
+    grid.dimX = dims[0];
+    grid.dimY = dims[1];
+    grid.dimZ = dims[2];
+    grid.cellStart = cellStart;
+    grid.particles = particles;
+
+    // Count particles per cell
+    q.memset(cellCursor, 0, (numCells + 1) * sizeof(uint32_t));
+    auto g = grid;
+    auto p = pos;
+    auto particleCell_d = particleCell;
+    auto cellCursor_d = cellCursor;
+    q.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx) {
+        size_t i = idx[0];
+        int c = g.cellIndex(g.cellCoord(p.x[i], g.origin.x, g.dimX),
+            g.cellCoord(p.y[i], g.origin.y, g.dimY),
+            g.cellCoord(p.z[i], g.origin.z, g.dimZ));
+        particleCell_d[i] = c;
+        sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+          sycl::memory_scope::device,
+          sycl::access::address_space::global_space> count(cellCursor_d[c]);
+        count.fetch_add(1u);
+        });
+
+    // Offsets of each cell, with the extra last entry holding n
+    exclusiveScan(q, cellCursor, cellStart, numCells + 1, scanScratch);
+    q.memcpy(cellCursor, cellStart, (numCells + 1) * sizeof(uint32_t));
+
+    // Scatter particle indices into their cells. The order within a cell
+    // depends on atomic ordering, so isn't reproducible between runs.
+    auto particles_d = particles;
+    q.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx) {
+        size_t i = idx[0];
+        sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed,
+          sycl::memory_scope::device,
+          sycl::access::address_space::global_space>
+          cursor(cellCursor_d[particleCell_d[i]]);
+        particles_d[cursor.fetch_add(1u)] = i;
+        });
+
+    q.memcpy(builtPos.x, pos.x, n * sizeof(coords_t));
+    q.memcpy(builtPos.y, pos.y, n * sizeof(coords_t));
+    q.memcpy(builtPos.z, pos.z, n * sizeof(coords_t));
+    built = true;
+  }
+
+  coords_t CellList::maxDisplacement(const ParticleData_d &pos) {
+    if (!built) return INFINITY;
+    auto init = sycl::property_list{
+      sycl::property::reduction::initialize_to_identity{}};
+    auto p = pos;
+    auto from = builtPos;
+    q.submit([&](sycl::handler &cgh) {
+        cgh.parallel_for(sycl::range<1>(n),
+            sycl::reduction(maxDispSqr, coords_t(0),
+              sycl::maximum<coords_t>(), init),
+            [=](sycl::id<1> idx, auto &distSqr) {
+            size_t i = idx[0];
+            vec3 d(p.x[i] - from.x[i], p.y[i] - from.y[i],
+                p.z[i] - from.z[i]);
+            distSqr.combine(dot(d, d));
+            });
+    });
+    coords_t distSqr;
+    q.memcpy(&distSqr, maxDispSqr, sizeof(distSqr)).wait();
+    return std::sqrt(distSqr);
+  }
+
+  /* Short range interaction, truncated at the cutoff radius. Only the 27
+     cells around the particle are searched.
+   */
+  template <typename accum_t>
+    void cutoff_interaction(ParticleData_d pPos, ParticleData_d pNextPos,
+        ParticleData_d pVel, InteractionConstants k, CellGrid grid,
+        coords_t cutoffSqr, const sycl::nd_item<1> &item_ct1) {
+      int id = item_ct1.get_global_id(0);
+      if (id >= k.numParticles) return;
+
+      accum_t force;
+      vec3 pos(pPos.x[id], pPos.y[id], pPos.z[id]);
+      int cx = grid.cellCoord(pos.x, grid.origin.x, grid.dimX);
+      int cy = grid.cellCoord(pos.y, grid.origin.y, grid.dimY);
+      int cz = grid.cellCoord(pos.z, grid.origin.z, grid.dimZ);
+
+      for (int z = sycl::max(cz - 1, 0);
+          z <= sycl::min(cz + 1, grid.dimZ - 1); z++) {
+        for (int y = sycl::max(cy - 1, 0);
+            y <= sycl::min(cy + 1, grid.dimY - 1); y++) {
+          for (int x = sycl::max(cx - 1, 0);
+              x <= sycl::min(cx + 1, grid.dimX - 1); x++) {
+            int c = grid.cellIndex(x, y, z);
+            for (uint32_t s = grid.cellStart[c];
+                s < grid.cellStart[c + 1]; s++) {
+              int i = grid.particles[s];
+              vec3 other_pos{pPos.x[i], pPos.y[i], pPos.z[i]};
+              vec3 r = other_pos - pos;
+              coords_t r_sqr = dot(r, r);
+              if (i == id || r_sqr >= cutoffSqr) continue;
+              coords_t dist_sqr = r_sqr + k.distEps;
+              force.add(r * sycl::rsqrt(dist_sqr * dist_sqr * dist_sqr));
+            }
+          }
+        }
+      }
+
+      integrate(pPos, pNextPos, pVel, k, id, force.get());
+    }
+
+  void submitCutoffInteraction(sycl::queue &q, ParticleData_d pos_d,
+      ParticleData_d pos_next_d, ParticleData_d vel_d,
+      const SimParam &params, const CellGrid &grid, int nblocks,
+      int wg_size) {
+    InteractionConstants k = makeInteractionConstants(params);
+    coords_t cutoffSqr = params.cutoff * params.cutoff;
+    dispatchAccumulator(params.accumMethod, [&](auto accum) {
+        using accum_t = decltype(accum);
+        q.submit([&](sycl::handler &cgh) {
+            cgh.parallel_for<cutoff_interaction_kernel<accum_t>>(
+                sycl::nd_range<1>(
+                  sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
+                  sycl::range<1>(wg_size)),
+                [=](sycl::nd_item<1> item_ct1) {
+                cutoff_interaction<accum_t>(pos_d, pos_next_d, vel_d, k,
+                    grid, cutoffSqr, item_ct1);
+                });
+        });
+        });
+  }
+
+}  // namespace simulation
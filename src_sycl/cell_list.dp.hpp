@@ -0,0 +1,87 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+
+#include <cstdint>
+
+#include "simulator.dp.hpp"
+
+namespace simulation {
+
+  // Device view of a built CellList, captured by value in kernels
+  struct CellGrid {
+    vec3 origin;
+    coords_t invCellSize;
+    int dimX;
+    int dimY;
+    int dimZ;
+    const uint32_t *cellStart;  ///< numCells + 1 offsets into particles
+    const uint32_t *particles;  ///< Particle indices grouped by cell
+
+    // Cell coordinate along one axis. Positions outside the grid are
+    // clamped to the boundary cells, which keeps neighbouring positions
+    // in neighbouring cells.
+    HOSTDEV inline int cellCoord(coords_t p, coords_t o, int dim) const {
+      int c = sycl::floor((p - o) * invCellSize);
+      return sycl::clamp(c, 0, dim - 1);
+    }
+
+    HOSTDEV inline int cellIndex(int cx, int cy, int cz) const {
+      return (cz * dimY + cy) * dimX + cx;
+    }
+  };
+
+  /*
+     Uniform grid of cells over the particle bounding box, built on the
+     device with a counting sort. Forces truncated at a cutoff only need
+     to search the 27 cells around each particle, provided the cell size
+     is at least the cutoff.
+
+     A cell list built with cells of (cutoff + skin) stays valid while no
+     particle has moved more than skin / 2 since it was built, so it can be
+     reused for several steps. maxDisplacement tells when that no longer
+     holds.
+   */
+  class CellList {
+    public:
+      CellList(sycl::queue &q_, size_t n_);
+      ~CellList();
+
+      CellList(const CellList &) = delete;
+      CellList &operator=(const CellList &) = delete;
+
+      // Bins the particles into cells at least cellSize wide
+      void build(const ParticleData_d &pos, coords_t cellSize);
+
+      CellGrid getGrid() const { return grid; }
+
+      // Largest distance a particle of pos has moved since the last build,
+      // or infinity before the first (blocks until complete)
+      coords_t maxDisplacement(const ParticleData_d &pos);
+
+    private:
+      sycl::queue &q;
+      size_t n;
+      size_t cellCapacity{0};
+      CellGrid grid{};
+      bool built{false};
+      ParticleData_d builtPos;         ///< Positions at the last build
+      coords_t *maxDispSqr = nullptr;
+      uint32_t *particleCell = nullptr;
+      uint32_t *cellStart = nullptr;
+      uint32_t *cellCursor = nullptr;
+      uint32_t *particles = nullptr;
+      uint32_t *scanScratch = nullptr;
+  };
+
+  // One step of Solver::CUTOFF for all particles, using the given grid
+  void submitCutoffInteraction(sycl::queue &q, ParticleData_d pos_d,
+      ParticleData_d pos_next_d, ParticleData_d vel_d,
+      const SimParam &params, const CellGrid &grid, int nblocks,
+      int wg_size);
+
+}  // namespace simulation
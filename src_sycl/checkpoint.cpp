@@ -0,0 +1 @@
+../src/checkpoint.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/checkpoint.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/conservation.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/conservation.hpp
\ No newline at end of file
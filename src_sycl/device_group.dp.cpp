@@ -0,0 +1,136 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "device_group.dp.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+namespace simulation {
+
+  namespace {
+    ParticleData_d mallocHost(size_t n, const sycl::context &ctx) {
+      ParticleData_d p;
+      p.x = sycl::malloc_host<coords_t>(n, ctx);
+      p.y = sycl::malloc_host<coords_t>(n, ctx);
+      p.z = sycl::malloc_host<coords_t>(n, ctx);
+      return p;
+    }
+
+    // View of host vectors, for copies
+    ParticleData_d view(const ParticleData &p) {
+      ParticleData_d v;
+      v.x = const_cast<coords_t *>(p.x.data());
+      v.y = const_cast<coords_t *>(p.y.data());
+      v.z = const_cast<coords_t *>(p.z.data());
+      return v;
+    }
+
+    void freeAll(ParticleData_d &p, const sycl::context &ctx) {
+      sycl::free(p.x, ctx);
+      sycl::free(p.y, ctx);
+      sycl::free(p.z, ctx);
+    }
+
+    // Copies count elements from offset of each coordinate array
+    void copy(sycl::queue &q, ParticleData_d dst, ParticleData_d src,
+        size_t offset, size_t count) {
+      size_t bytes = count * sizeof(coords_t);
+      q.memcpy(dst.x + offset, src.x + offset, bytes);
+      q.memcpy(dst.y + offset, src.y + offset, bytes);
+      q.memcpy(dst.z + offset, src.z + offset, bytes);
+    }
+  }  // namespace
+
+  std::vector<sycl::queue> DeviceGroup::makeQueues(
+      DevicePartition partition, int virtualDevices) {
+    sycl::device root = dpct::get_default_queue().get_device();
+    std::vector<sycl::device> devices{root};
+    if (virtualDevices > 0) {
+      devices.assign(virtualDevices, root);
+    } else if (partition == DevicePartition::PLATFORM) {
+      devices = root.get_platform().get_devices();
+    } else if (partition == DevicePartition::NUMA) {
+      try {
+        devices = root.create_sub_devices<
+          sycl::info::partition_property::partition_by_affinity_domain>(
+              sycl::info::partition_affinity_domain::numa);
+      } catch (const sycl::exception &) {
+        // Not partitionable by NUMA node, so keep the whole device
+      }
+    }
+
+    sycl::context ctx(virtualDevices > 0 ? std::vector<sycl::device>{root} :
+        devices);
+    std::vector<sycl::queue> queues;
+    for (auto &dev : devices) {
+      queues.emplace_back(ctx, dev, sycl::property::queue::in_order{});
+    }
+    return queues;
+  }
+
+  DeviceGroup::DeviceGroup(std::vector<sycl::queue> queues, size_t n_)
+    : n(n_), staging(mallocHost(n_, queues.at(0).get_context())) {
+      const size_t numDevices = queues.size();
+      for (size_t d = 0; d < numDevices; d++) {
+        sycl::queue &q = queues[d];
+        size_t begin = n * d / numDevices;
+        size_t end = n * (d + 1) / numDevices;
+        slices.push_back({q, begin, end - begin, ParticleData_d(n, q),
+            ParticleData_d(n, q), ParticleData_d(n, q)});
+      }
+    }
+
+  DeviceGroup::~DeviceGroup() {
+    for (auto &s : slices) {
+      s.q.wait();
+      sycl::context ctx = s.q.get_context();
+      freeAll(s.pos, ctx);
+      freeAll(s.posNext, ctx);
+      freeAll(s.vel, ctx);
+    }
+    freeAll(staging, slices.at(0).q.get_context());
+  }
+
+  void DeviceGroup::upload(const ParticleData &pos, const ParticleData &vel) {
+    ParticleData_d posHost = view(pos);
+    ParticleData_d velHost = view(vel);
+    for (auto &s : slices) {
+      copy(s.q, s.pos, posHost, 0, n);
+      copy(s.q, s.vel, velHost, s.begin, s.count);
+    }
+    for (auto &s : slices) s.q.wait();
+  }
+
+  void DeviceGroup::download(ParticleData &pos, ParticleData &vel) {
+    ParticleData_d posHost = view(pos);
+    ParticleData_d velHost = view(vel);
+    for (auto &s : slices) {
+      copy(s.q, posHost, s.pos, s.begin, s.count);
+      copy(s.q, velHost, s.vel, s.begin, s.count);
+    }
+    for (auto &s : slices) s.q.wait();
+  }
+
+  void DeviceGroup::step(const SimParam &params, int wg_size) {
+    // Each device integrates its own slice, then sends it to the host
+    for (auto &s : slices) {
+      if (s.count == 0) continue;
+      InteractionConstants k = makeInteractionConstants(params);
+      k.targetOffset = s.begin;
+      k.targetCount = s.count;
+      int nblocks = (s.count + wg_size - 1) / wg_size;
+      submitDirectInteraction(s.q, s.pos, s.posNext, s.vel, params, k,
+          nblocks, wg_size);
+      copy(s.q, staging, s.posNext, s.begin, s.count);
+    }
+    for (auto &s : slices) s.q.wait();
+
+    // All-gather: every device receives the full set of new positions. The
+    // staging buffer is rewritten by the next step, so wait for the reads.
+    for (auto &s : slices) copy(s.q, s.pos, staging, 0, n);
+    for (auto &s : slices) s.q.wait();
+  }
+
+}  // namespace simulation
@@ -0,0 +1,59 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+
+#include <vector>
+
+#include "simulator.dp.hpp"
+
+namespace simulation {
+
+  /*
+     Splits Solver::DIRECT across several devices. Every device holds all
+     particle positions & updates its own contiguous slice of particles
+     against the full set. After each step the new positions of each slice
+     are gathered on the host & broadcast back to every device.
+   */
+  class DeviceGroup {
+    public:
+      // In order queues, sharing one context, on the devices selected by
+      // partition. A device which can't be split by NUMA node is used
+      // whole. A non-zero virtualDevices instead makes that many queues on
+      // the default device.
+      static std::vector<sycl::queue> makeQueues(DevicePartition partition,
+          int virtualDevices = 0);
+
+      DeviceGroup(std::vector<sycl::queue> queues, size_t n_);
+      ~DeviceGroup();
+
+      DeviceGroup(const DeviceGroup &) = delete;
+      DeviceGroup &operator=(const DeviceGroup &) = delete;
+
+      void upload(const ParticleData &pos, const ParticleData &vel);
+      void download(ParticleData &pos, ParticleData &vel);
+
+      // One step for all particles (blocks until complete)
+      void step(const SimParam &params, int wg_size);
+
+      size_t size() const { return slices.size(); }
+
+    private:
+      struct Slice {
+        sycl::queue q;
+        size_t begin;
+        size_t count;
+        ParticleData_d pos;      ///< All particles
+        ParticleData_d posNext;  ///< Only [begin, begin + count) is updated
+        ParticleData_d vel;      ///< Only [begin, begin + count) is valid
+      };
+
+      size_t n;
+      std::vector<Slice> slices;
+      ParticleData_d staging;  ///< Host (pinned) positions for the gather
+  };
+
+}  // namespace simulation
@@ -0,0 +1,180 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "device_util.dp.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace simulation {
+
+  namespace {
+    constexpr int RADIX_BITS = 4;
+    constexpr uint32_t RADIX = 1u << RADIX_BITS;
+
+    // Elements handled serially by one work item in the sort & scan
+    constexpr size_t SORT_TILE = 256;
+    constexpr size_t SCAN_CHUNK = 1024;
+  }  // namespace
+
+  Bounds computeBounds(sycl::queue &q, const ParticleData_d &pos,
+      size_t n) {
+    const coords_t lowest = std::numeric_limits<coords_t>::lowest();
+    const coords_t highest = std::numeric_limits<coords_t>::max();
+    coords_t *result_d = sycl::malloc_device<coords_t>(6, q);
+    auto init = sycl::property_list{
+      sycl::property::reduction::initialize_to_identity{}};
+
+    auto px = pos.x;
+    auto py = pos.y;
+    auto pz = pos.z;
+    q.submit([&](sycl::handler &cgh) {
+        cgh.parallel_for(sycl::range<1>(n),
+            sycl::reduction(result_d + 0, highest,
+              sycl::minimum<coords_t>(), init),
+            sycl::reduction(result_d + 1, highest,
+              sycl::minimum<coords_t>(), init),
+            sycl::reduction(result_d + 2, highest,
+              sycl::minimum<coords_t>(), init),
+            sycl::reduction(result_d + 3, lowest,
+              sycl::maximum<coords_t>(), init),
+            sycl::reduction(result_d + 4, lowest,
+              sycl::maximum<coords_t>(), init),
+            sycl::reduction(result_d + 5, lowest,
+              sycl::maximum<coords_t>(), init),
+            [=](sycl::id<1> idx, auto &minX, auto &minY, auto &minZ,
+              auto &maxX, auto &maxY, auto &maxZ) {
+            size_t i = idx[0];
+            minX.combine(px[i]);
+            minY.combine(py[i]);
+            minZ.combine(pz[i]);
+            maxX.combine(px[i]);
+            maxY.combine(py[i]);
+            maxZ.combine(pz[i]);
+            });
+    });
+
+    coords_t result[6];
+    q.memcpy(result, result_d, sizeof(result)).wait();
+    sycl::free(result_d, q);
+    return {{result[0], result[1], result[2]},
+      {result[3], result[4], result[5]}};
+  }
+
+  size_t scanScratchSize(size_t n) {
+    return (n + SCAN_CHUNK - 1) / SCAN_CHUNK;
+  }
+
+  void exclusiveScan(sycl::queue &q, const uint32_t *in, uint32_t *out,
+      size_t n, uint32_t *scratch) {
+    if (n == 0) return;
+    const size_t chunks = scanScratchSize(n);
+
+    // Total of each chunk
+    q.parallel_for(sycl::range<1>(chunks), [=](sycl::id<1> c) {
+        size_t begin = c[0] * SCAN_CHUNK;
+        size_t end = sycl::min(begin + SCAN_CHUNK, n);
+        uint32_t sum = 0;
+        for (size_t i = begin; i < end; i++) sum += in[i];
+        scratch[c[0]] = sum;
+        });
+
+    // Chunk totals become chunk base offsets
+    q.single_task([=]() {
+        uint32_t sum = 0;
+        for (size_t c = 0; c < chunks; c++) {
+          uint32_t total = scratch[c];
+          scratch[c] = sum;
+          sum += total;
+        }
+        });
+
+    // Scan within each chunk, starting from its base offset
+    q.parallel_for(sycl::range<1>(chunks), [=](sycl::id<1> c) {
+        size_t begin = c[0] * SCAN_CHUNK;
+        size_t end = sycl::min(begin + SCAN_CHUNK, n);
+        uint32_t sum = scratch[c[0]];
+        for (size_t i = begin; i < end; i++) {
+          uint32_t v = in[i];
+          out[i] = sum;
+          sum += v;
+        }
+        });
+  }
+
+  RadixSorter::RadixSorter(sycl::queue &q_, size_t capacity_)
+    : q(q_), capacity(capacity_) {
+      const size_t tiles = (capacity + SORT_TILE - 1) / SORT_TILE;
+      keysAlt = sycl::malloc_device<uint32_t>(capacity, q);
+      valsAlt = sycl::malloc_device<uint32_t>(capacity, q);
+      hist = sycl::malloc_device<uint32_t>(RADIX * tiles, q);
+      scanScratch =
+        sycl::malloc_device<uint32_t>(scanScratchSize(RADIX * tiles), q);
+    }
+
+  RadixSorter::~RadixSorter() {
+    q.wait();
+    sycl::free(keysAlt, q);
+    sycl::free(valsAlt, q);
+    sycl::free(hist, q);
+    sycl::free(scanScratch, q);
+  }
+
+  void RadixSorter::sort(uint32_t *keys, uint32_t *vals, size_t n,
+      int keyBits) {
+    if (n == 0) return;
+    const size_t tiles = (n + SORT_TILE - 1) / SORT_TILE;
+
+    uint32_t *keysIn = keys;
+    uint32_t *valsIn = vals;
+    uint32_t *keysOut = keysAlt;
+    uint32_t *valsOut = valsAlt;
+    uint32_t *hist_d = hist;
+
+    for (int shift = 0; shift < keyBits; shift += RADIX_BITS) {
+      // Per tile digit counts, stored digit major so that a single
+      // exclusive scan yields every tile's output offset per digit
+      q.parallel_for(sycl::range<1>(tiles), [=](sycl::id<1> t) {
+          uint32_t counts[RADIX] = {};
+          size_t begin = t[0] * SORT_TILE;
+          size_t end = sycl::min(begin + SORT_TILE, n);
+          for (size_t i = begin; i < end; i++) {
+            counts[(keysIn[i] >> shift) & (RADIX - 1)]++;
+          }
+          for (uint32_t d = 0; d < RADIX; d++) {
+            hist_d[d * tiles + t[0]] = counts[d];
+          }
+          });
+
+      exclusiveScan(q, hist_d, hist_d, RADIX * tiles, scanScratch);
+
+      // Scatter, in order within each tile
+      q.parallel_for(sycl::range<1>(tiles), [=](sycl::id<1> t) {
+          uint32_t offsets[RADIX];
+          for (uint32_t d = 0; d < RADIX; d++) {
+            offsets[d] = hist_d[d * tiles + t[0]];
+          }
+          size_t begin = t[0] * SORT_TILE;
+          size_t end = sycl::min(begin + SORT_TILE, n);
+          for (size_t i = begin; i < end; i++) {
+            uint32_t key = keysIn[i];
+            uint32_t dst = offsets[(key >> shift) & (RADIX - 1)]++;
+            keysOut[dst] = key;
+            valsOut[dst] = valsIn[i];
+          }
+          });
+
+      std::swap(keysIn, keysOut);
+      std::swap(valsIn, valsOut);
+    }
+
+    // Odd number of passes leaves the result in the alternate buffers
+    if (keysIn != keys) {
+      q.memcpy(keys, keysIn, n * sizeof(uint32_t));
+      q.memcpy(vals, valsIn, n * sizeof(uint32_t));
+    }
+  }
+
+}  // namespace simulation
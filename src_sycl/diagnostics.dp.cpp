@@ -0,0 +1,80 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "diagnostics.dp.hpp"
+
+namespace simulation {
+
+  namespace {
+    // Kinetic & potential energy, momentum xyz, angular momentum xyz
+    constexpr int CONSERVED_TERMS = 8;
+  }  // namespace
+
+  template <typename real_t>
+  Conserved sumConserved(sycl::queue &q, const ParticleData_d &pos,
+      const ParticleData_d &vel, size_t n, coords_t G, coords_t distEps) {
+    real_t *result_d = sycl::malloc_device<real_t>(CONSERVED_TERMS, q);
+    auto init = sycl::property_list{
+      sycl::property::reduction::initialize_to_identity{}};
+    auto plus = sycl::plus<real_t>();
+
+    ParticleData_d p_d = pos;
+    ParticleData_d v_d = vel;
+    q.submit([&](sycl::handler &cgh) {
+        cgh.parallel_for(sycl::range<1>(n),
+            sycl::reduction(result_d + 0, real_t(0), plus, init),
+            sycl::reduction(result_d + 1, real_t(0), plus, init),
+            sycl::reduction(result_d + 2, real_t(0), plus, init),
+            sycl::reduction(result_d + 3, real_t(0), plus, init),
+            sycl::reduction(result_d + 4, real_t(0), plus, init),
+            sycl::reduction(result_d + 5, real_t(0), plus, init),
+            sycl::reduction(result_d + 6, real_t(0), plus, init),
+            sycl::reduction(result_d + 7, real_t(0), plus, init),
+            [=](sycl::id<1> idx, auto &kinetic, auto &potential,
+              auto &momentumX, auto &momentumY, auto &momentumZ,
+              auto &angularX, auto &angularY, auto &angularZ) {
+            size_t i = idx[0];
+            vec3 p(p_d.x[i], p_d.y[i], p_d.z[i]);
+            vec3 v(v_d.x[i], v_d.y[i], v_d.z[i]);
+            // Each pair is visited from both ends, so counts half each
+            // time
+            real_t phi = 0;
+            for (size_t j = 0; j < n; j++) {
+              if (j == i) continue;
+              vec3 r = vec3(p_d.x[j], p_d.y[j], p_d.z[j]) - p;
+              phi += sycl::rsqrt(dot(r, r) + distEps);
+            }
+            kinetic.combine(real_t(0.5) * dot(v, v));
+            potential.combine(real_t(-0.5) * phi);
+            momentumX.combine(v.x);
+            momentumY.combine(v.y);
+            momentumZ.combine(v.z);
+            angularX.combine(p.y * v.z - p.z * v.y);
+            angularY.combine(p.z * v.x - p.x * v.z);
+            angularZ.combine(p.x * v.y - p.y * v.x);
+            });
+    });
+
+    real_t sum[CONSERVED_TERMS];
+    q.memcpy(sum, result_d, sizeof(sum)).wait();
+    sycl::free(result_d, q);
+    Conserved c;
+    c.kinetic = sum[0];
+    c.potential = G * double(sum[1]);
+    for (int a = 0; a < 3; a++) {
+      c.momentum[a] = sum[2 + a];
+      c.angularMomentum[a] = sum[5 + a];
+    }
+    return c;
+  }
+
+  Conserved computeConserved(sycl::queue &q, const ParticleData_d &pos,
+      const ParticleData_d &vel, size_t n, coords_t G, coords_t distEps) {
+    if (q.get_device().has(sycl::aspect::fp64)) {
+      return sumConserved<double>(q, pos, vel, n, G, distEps);
+    }
+    return sumConserved<float>(q, pos, vel, n, G, distEps);
+  }
+
+}  // namespace simulation
@@ -0,0 +1,21 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+
+#include "conservation.hpp"
+#include "simulator.dp.hpp"
+
+namespace simulation {
+
+  // Conserved quantities of the first n particles on the device, as SYCL
+  // reductions in double precision where the device supports it. The
+  // potential visits every pair like the DIRECT interaction, so this costs
+  // about one interaction step (blocks until complete).
+  Conserved computeConserved(sycl::queue &q, const ParticleData_d &pos,
+      const ParticleData_d &vel, size_t n, coords_t G, coords_t distEps);
+
+}  // namespace simulation
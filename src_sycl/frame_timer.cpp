@@ -0,0 +1 @@
+../src/frame_timer.cpp
\ No newline at end of file
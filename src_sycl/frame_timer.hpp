@@ -0,0 +1 @@
+../src/frame_timer.hpp
\ No newline at end of file
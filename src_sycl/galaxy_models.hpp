@@ -0,0 +1 @@
+../src/galaxy_models.hpp
\ No newline at end of file
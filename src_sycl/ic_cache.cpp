@@ -0,0 +1 @@
+../src/ic_cache.cpp
\ No newline at end of file
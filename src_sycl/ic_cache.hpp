@@ -0,0 +1 @@
+../src/ic_cache.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/initial_conditions.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/initial_conditions.hpp
\ No newline at end of file
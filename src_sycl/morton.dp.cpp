@@ -0,0 +1,73 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "morton.dp.hpp"
+
+#include <utility>
+
+namespace simulation {
+
+  MortonReorder::MortonReorder(sycl::queue &q_, size_t n_)
+    : q(q_), n(n_), sorter(q_, n_), velAlt(n_) {
+      keys = sycl::malloc_device<uint32_t>(n, q);
+      perm = sycl::malloc_device<uint32_t>(n, q);
+      idsAlt = sycl::malloc_device<uint32_t>(n, q);
+    }
+
+  MortonReorder::~MortonReorder() {
+    q.wait();
+    sycl::free(keys, q);
+    sycl::free(perm, q);
+    sycl::free(idsAlt, q);
+    sycl::free(velAlt.x, q);
+    sycl::free(velAlt.y, q);
+    sycl::free(velAlt.z, q);
+  }
+
+  void MortonReorder::apply(ParticleData_d &pos, ParticleData_d &posAlt,
+      ParticleData_d &vel, uint32_t *&ids) {
+    Bounds b = computeBounds(q, pos, n);
+    // Cubic cell so the curve isn't stretched along the longest axis
+    coords_t extent = sycl::fmax(b.max.x - b.min.x,
+        sycl::fmax(b.max.y - b.min.y, b.max.z - b.min.z));
+    coords_t invExtent = extent > 0 ? coords_t(1) / extent : coords_t(0);
+    vec3 origin = b.min;
+
+    auto keys_d = keys;
+    auto perm_d = perm;
+    auto p = pos;
+    q.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx) {
+        size_t i = idx[0];
+        keys_d[i] = mortonKey((p.x[i] - origin.x) * invExtent,
+            (p.y[i] - origin.y) * invExtent,
+            (p.z[i] - origin.z) * invExtent);
+        perm_d[i] = i;
+        });
+
+    sorter.sort(keys, perm, n, 3 * MORTON_BITS);
+
+    // Gather every array through the sorted permutation
+    auto pa = posAlt;
+    auto v = vel;
+    auto va = velAlt;
+    auto ids_d = ids;
+    auto idsAlt_d = idsAlt;
+    q.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx) {
+        size_t i = idx[0];
+        uint32_t src = perm_d[i];
+        pa.x[i] = p.x[src];
+        pa.y[i] = p.y[src];
+        pa.z[i] = p.z[src];
+        va.x[i] = v.x[src];
+        va.y[i] = v.y[src];
+        va.z[i] = v.z[src];
+        idsAlt_d[i] = ids_d[src];
+        });
+
+    std::swap(pos, posAlt);
+    std::swap(vel, velAlt);
+    std::swap(ids, idsAlt);
+  }
+
+}  // namespace simulation
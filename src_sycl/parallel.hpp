@@ -0,0 +1 @@
+../src/parallel.hpp
\ No newline at end of file
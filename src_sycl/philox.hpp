@@ -0,0 +1 @@
+../src/philox.hpp
\ No newline at end of file
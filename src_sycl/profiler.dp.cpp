@@ -0,0 +1,39 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "profiler.dp.hpp"
+
+#include <cstdint>
+
+namespace simulation {
+
+  void DeviceProfiler::start() {
+    events.clear();
+    phases.clear();
+    events.push_back(q.ext_oneapi_submit_barrier());
+  }
+
+  void DeviceProfiler::mark(const char *phase) {
+    phases.push_back(phase);
+    events.push_back(q.ext_oneapi_submit_barrier());
+  }
+
+  float DeviceProfiler::collect(std::vector<DeviceInterval> &intervals) {
+    intervals.clear();
+    if (phases.empty()) return 0;
+    events.back().wait_and_throw();
+    auto endOf = [](const sycl::event &e) {
+      return e.get_profiling_info<sycl::info::event_profiling::command_end>();
+    };
+    const uint64_t origin = endOf(events[0]);
+    float begin = 0;
+    for (size_t i = 0; i < phases.size(); i++) {
+      float end = (endOf(events[i + 1]) - origin) * 1e-6f;
+      intervals.push_back({phases[i], begin, end});
+      begin = end;
+    }
+    return begin;
+  }
+
+}  // namespace simulation
@@ -0,0 +1,43 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+
+#include <vector>
+
+#include "simulator.dp.hpp"
+
+namespace simulation {
+
+  /*
+     Times the phases of a step on an in-order queue created with
+     property::queue::enable_profiling, from the command_end timestamps of
+     barriers submitted between them (which is how dpct migrates
+     cudaEventRecord). A phase lasts from the previous barrier to its own,
+     so it includes any time the device waited for the host to submit its
+     kernels, but not submission overhead or host synchronization.
+   */
+  class DeviceProfiler {
+    public:
+      explicit DeviceProfiler(sycl::queue &q_) : q(q_) {}
+
+      // Starts a step
+      void start();
+      // Ends the phase of the work submitted since the previous mark (or
+      // the start)
+      void mark(const char *phase);
+      // Phases marked since start, once the queue has finished them
+      // @return device time from the start to the last mark, in ms
+      float collect(std::vector<DeviceInterval> &intervals);
+
+    private:
+      sycl::queue &q;
+      // events[0] is the start
+      std::vector<sycl::event> events;
+      std::vector<const char *> phases;
+  };
+
+}  // namespace simulation
@@ -0,0 +1,150 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "ring_pass.dp.hpp"
+#include "tile_force.dp.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace simulation {
+
+  namespace {
+    void freeAll(ParticleData_d &p, sycl::queue &q) {
+      sycl::free(p.x, q);
+      sycl::free(p.y, q);
+      sycl::free(p.z, q);
+    }
+
+    // Copies count elements, from srcOffset in src to dstOffset in dst
+    sycl::event copy(sycl::queue &q, ParticleData_d dst, size_t dstOffset,
+        ParticleData_d src, size_t srcOffset, size_t count,
+        const std::vector<sycl::event> &deps = {}) {
+      size_t bytes = count * sizeof(coords_t);
+      q.memcpy(dst.x + dstOffset, src.x + srcOffset, bytes, deps);
+      q.memcpy(dst.y + dstOffset, src.y + srcOffset, bytes, deps);
+      return q.memcpy(dst.z + dstOffset, src.z + srcOffset, bytes, deps);
+    }
+  }  // namespace
+
+  RingPass::RingPass(std::vector<sycl::queue> queues, size_t n_) : n(n_) {
+    const size_t numDevices = queues.size();
+    size_t maxCount = 0;
+    for (size_t d = 0; d < numDevices; d++) {
+      sycl::queue &q = queues[d];
+      size_t begin = n * d / numDevices;
+      size_t count = n * (d + 1) / numDevices - begin;
+      maxCount = std::max(maxCount, count);
+      slices.push_back({q,
+          sycl::queue(q.get_context(), q.get_device(),
+            sycl::property::queue::in_order{}),
+          begin, count, ParticleData_d(count, q), ParticleData_d(count, q),
+          ParticleData_d(count, q), ParticleData_d(count, q), {}});
+    }
+    for (auto &s : slices) {
+      s.tile[0] = ParticleData_d(maxCount, s.q);
+      s.tile[1] = ParticleData_d(maxCount, s.q);
+    }
+  }
+
+  RingPass::~RingPass() {
+    for (auto &s : slices) {
+      s.q.wait();
+      s.copyQ.wait();
+      for (auto *p : {&s.pos, &s.posNext, &s.vel, &s.force, &s.tile[0],
+          &s.tile[1]}) {
+        freeAll(*p, s.q);
+      }
+    }
+  }
+
+  ParticleData_d RingPass::source(size_t d, size_t r) const {
+    return r == 0 ? slices[d].pos : slices[d].tile[r % 2];
+  }
+
+  void RingPass::upload(const ParticleData &pos, const ParticleData &vel) {
+    for (auto &s : slices) {
+      size_t bytes = s.count * sizeof(coords_t);
+      s.q.memcpy(s.pos.x, pos.x.data() + s.begin, bytes);
+      s.q.memcpy(s.pos.y, pos.y.data() + s.begin, bytes);
+      s.q.memcpy(s.pos.z, pos.z.data() + s.begin, bytes);
+      s.q.memcpy(s.vel.x, vel.x.data() + s.begin, bytes);
+      s.q.memcpy(s.vel.y, vel.y.data() + s.begin, bytes);
+      s.q.memcpy(s.vel.z, vel.z.data() + s.begin, bytes);
+    }
+    for (auto &s : slices) s.q.wait();
+  }
+
+  void RingPass::download(ParticleData &pos, ParticleData &vel) {
+    for (auto &s : slices) {
+      size_t bytes = s.count * sizeof(coords_t);
+      s.q.memcpy(pos.x.data() + s.begin, s.pos.x, bytes);
+      s.q.memcpy(pos.y.data() + s.begin, s.pos.y, bytes);
+      s.q.memcpy(pos.z.data() + s.begin, s.pos.z, bytes);
+      s.q.memcpy(vel.x.data() + s.begin, s.vel.x, bytes);
+      s.q.memcpy(vel.y.data() + s.begin, s.vel.y, bytes);
+      s.q.memcpy(vel.z.data() + s.begin, s.vel.z, bytes);
+    }
+    for (auto &s : slices) s.q.wait();
+  }
+
+  void RingPass::step(const SimParam &params, int wg_size) {
+    const size_t numDevices = slices.size();
+    InteractionConstants k = makeInteractionConstants(params);
+
+    // In round r slice d holds the positions of slice (d + r) % numDevices,
+    // received from its neighbour d + 1. copied[r][d] completes when that
+    // tile has arrived, computed[r][d] when slice d has finished with it.
+    std::vector<std::vector<sycl::event>> copied(numDevices,
+        std::vector<sycl::event>(numDevices));
+    std::vector<std::vector<sycl::event>> computed = copied;
+
+    for (size_t r = 0; r < numDevices; r++) {
+      // Fetch the tiles for round r + 1 while round r computes
+      for (size_t d = 0; r + 1 < numDevices && d < numDevices; d++) {
+        size_t next = (d + 1) % numDevices;
+        size_t prev = (d + numDevices - 1) % numDevices;
+        size_t owner = (d + r + 1) % numDevices;
+        std::vector<sycl::event> deps;
+        if (r >= 1) {
+          // The neighbour's round r tile must have arrived
+          deps.push_back(copied[r][next]);
+        }
+        if (r >= 2) {
+          // The buffer being overwritten held the round r - 1 tile, which
+          // must have been used here & passed on to the previous slice
+          deps.push_back(computed[r - 1][d]);
+          deps.push_back(copied[r][prev]);
+        }
+        Slice &s = slices[d];
+        copied[r + 1][d] = copy(s.copyQ, s.tile[(r + 1) % 2], 0,
+            source(next, r), 0, slices[owner].count, deps);
+      }
+
+      for (size_t d = 0; d < numDevices; d++) {
+        Slice &s = slices[d];
+        if (s.count == 0) continue;
+        const Slice &owner = slices[(d + r) % numDevices];
+        std::vector<sycl::event> deps;
+        if (r >= 1) deps.push_back(copied[r][d]);
+        computed[r][d] = submitTileForce(s.q, params, s.pos, s.begin,
+            s.count, source(d, r), owner.begin, owner.count, s.force, r == 0,
+            wg_size, deps);
+      }
+    }
+
+    // Integrate each slice once its lap is complete
+    for (auto &s : slices) {
+      if (s.count == 0) continue;
+      submitTileIntegrate(s.q, s.pos, s.posNext, s.vel, s.force, s.count, k,
+          wg_size);
+    }
+    for (auto &s : slices) {
+      s.q.wait();
+      s.copyQ.wait();
+      std::swap(s.pos, s.posNext);
+    }
+  }
+
+}  // namespace simulation
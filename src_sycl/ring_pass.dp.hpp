@@ -0,0 +1,61 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+
+#include <vector>
+
+#include "simulator.dp.hpp"
+
+namespace simulation {
+
+  /*
+     Systolic (ring pass) decomposition of Solver::DIRECT. Each device only
+     holds its own slice of particles. Over one step, the devices form a
+     ring & source tiles (copies of each slice's positions) rotate around
+     it, so that after one lap every slice has seen every source. The copy
+     of the next tile into a device's spare tile buffer runs on a separate
+     queue, overlapping the force calculation on the current one.
+
+     Memory per device is O(n / devices), against O(n) for DeviceGroup.
+   */
+  class RingPass {
+    public:
+      RingPass(std::vector<sycl::queue> queues, size_t n_);
+      ~RingPass();
+
+      RingPass(const RingPass &) = delete;
+      RingPass &operator=(const RingPass &) = delete;
+
+      void upload(const ParticleData &pos, const ParticleData &vel);
+      void download(ParticleData &pos, ParticleData &vel);
+
+      // One step for all particles (blocks until complete)
+      void step(const SimParam &params, int wg_size);
+
+      size_t size() const { return slices.size(); }
+
+    private:
+      struct Slice {
+        sycl::queue q;       ///< Force calculation & integration
+        sycl::queue copyQ;   ///< Incoming tiles
+        size_t begin;
+        size_t count;
+        ParticleData_d pos;
+        ParticleData_d posNext;
+        ParticleData_d vel;
+        ParticleData_d force;    ///< Force summed over the tiles so far
+        ParticleData_d tile[2];  ///< Double buffered source tiles
+      };
+
+      // Positions slice d reads in round r of the lap
+      ParticleData_d source(size_t d, size_t r) const;
+
+      size_t n;
+      std::vector<Slice> slices;
+  };
+
+}  // namespace simulation
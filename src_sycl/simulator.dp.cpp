@@ -5,6 +5,20 @@
 #include <sycl/sycl.hpp>
 #include <dpct/dpct.hpp>
 #include "simulator.dp.hpp"
+#include "morton.dp.hpp"
+#include "cell_list.dp.hpp"
+#include "treepm.dp.hpp"
+#include "device_group.dp.hpp"
+#include "ring_pass.dp.hpp"
+#include "streaming.dp.hpp"
+#include "initial_conditions.hpp"
+#include "galaxy_models.hpp"
+#include "parallel.hpp"
+#include "ic_cache.hpp"
+#include "frame_timer.hpp"
+#include "autotune.hpp"
+#include "diagnostics.dp.hpp"
+#include "profiler.dp.hpp"
 //#include <cstddef>
 #include <stdio.h>
 
@@ -12,29 +26,191 @@
 #include <cmath>
 #include <random>
 #include <tuple>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <optional>
 #include <chrono>
+#include <iostream>
+#include <stdexcept>
 
 namespace simulation {
 
   // Forward decl
-  template <CalculationMethod ct>
+  template <CalculationMethod ct, typename accum_t>
   void particle_interaction(ParticleData_d pPos,
         ParticleData_d pNextPos,
-        ParticleData_d pVel, SimParam params,
+        ParticleData_d pVel, InteractionConstants k,
         const sycl::nd_item<1> &item_ct1);
 
+  template <CalculationMethod ct, typename accum_t>
+  class particle_interaction_kernel;
+  template <CalculationMethod ct, typename accum_t>
+  class particle_interaction_spec_kernel;
+
+  // Specialization constants for particle_interaction_spec_kernel
+  constexpr sycl::specialization_id<int> num_particles_sc{0};
+  constexpr sycl::specialization_id<coords_t> dist_eps_sc{0};
+  constexpr sycl::specialization_id<coords_t> damping_sc{1};
+  constexpr sycl::specialization_id<coords_t> dt_sc{0};
+  constexpr sycl::specialization_id<coords_t> dt_g_sc{0};
+
+  // Particles kept in the default device's memory (none when streaming,
+  // or when --devices hold them instead)
+  static size_t residentParticles(const SimParam &params) {
+    if (params.streamTile > 0 ||
+        params.devicePartition != DevicePartition::SINGLE ||
+        params.virtualDevices > 0) {
+      return 0;
+    }
+    return params.numParticles;
+  }
+
+  // Every particle in the default device's memory, which can then be
+  // initialized without staging on the host
+  static bool deviceResident(const SimParam &params) {
+    return params.streamTile == 0 &&
+      params.devicePartition == DevicePartition::SINGLE &&
+      params.virtualDevices == 0 &&
+      params.transport == TransportKind::NONE;
+  }
+
   DiskGalaxySimulator::DiskGalaxySimulator(SimParam params_)
-    : params(params_),
-    pos(params_.numParticles),
-    vel(params_.numParticles),
-    pos_d(params_.numParticles),
-    vel_d(params_.numParticles),
-    pos_next_d(params_.numParticles) {
-      randomParticlePos();
-      initialParticleVel();
+    : params(withInitialConditionParams(withRestartParams(params_),
+          initialConditions)),
+    pos(params.numParticles),
+    vel(params.numParticles),
+    pos_d(residentParticles(params)),
+    vel_d(residentParticles(params)),
+    pos_next_d(residentParticles(params)) {
+      if (getAM() == AccumulationMethod::DOUBLE &&
+          !dpct::get_current_device().has(sycl::aspect::fp64)) {
+        throw std::runtime_error(
+            "DOUBLE accumulation requires a device with fp64 support");
+      }
+      if (params.profile && (params.streamTile > 0 ||
+            params.devicePartition != DevicePartition::SINGLE ||
+            params.virtualDevices > 0)) {
+        std::cerr << "--profile only covers the default queue, timing "
+          << "steps on the host\n";
+      } else if (params.profile) {
+        // Sharing the default queue's context, & so its allocations
+        sycl::queue &q = dpct::get_default_queue();
+        profilingQueue = std::make_unique<sycl::queue>(q.get_context(),
+            q.get_device(), sycl::property_list{
+            sycl::property::queue::in_order{},
+            sycl::property::queue::enable_profiling{}});
+      }
+      if (!params.restartFile.empty()) {
+        loadCheckpoint(
+            std::make_unique<CheckpointReader>(params.restartFile));
+      } else if (initialConditions) {
+        float *icPos[3] = {pos.x.data(), pos.y.data(), pos.z.data()};
+        float *icVel[3] = {vel.x.data(), vel.y.data(), vel.z.data()};
+        initialConditions->load(icPos, icVel);
+        initialConditions.reset();
+      } else if (!params.icCache.empty()) {
+        InitialConditionCache cache(params, generatorState());
+        if (auto cached = cache.open()) {
+          loadCheckpoint(std::move(cached));
+        } else {
+          generateParticles();
+          if (hostStale) recvFromDevice();
+          const float *icPos[3] = {pos.x.data(), pos.y.data(), pos.z.data()};
+          const float *icVel[3] = {vel.x.data(), vel.y.data(), vel.z.data()};
+          cache.store(icPos, icVel);
+        }
+      } else {
+        generateParticles();
+      }
+
+      sycl::queue &q_ct1 = queue();
+      if (params.streamTile > 0) {
+        if (params.solver != Solver::DIRECT || params.reorderInterval > 0 ||
+            params.devicePartition != DevicePartition::SINGLE ||
+            params.virtualDevices > 0 ||
+            params.transport != TransportKind::NONE) {
+          throw std::invalid_argument("--streamTile needs the DIRECT solver "
+              "without --reorder, --devices or --transport");
+        }
+        stream = std::make_unique<StreamingSolver>(q_ct1,
+            params.numParticles, params.streamTile, params.streamPool);
+      }
       sendToDevice();
+
+      if (ids.empty()) {
+        ids.resize(params.numParticles);
+        std::iota(ids.begin(), ids.end(), 0);
+      }
+      ids_d = sycl::malloc_device<uint32_t>(residentParticles(params), q_ct1);
+      q_ct1.memcpy(ids_d, ids.data(),
+          residentParticles(params) * sizeof(uint32_t)).wait();
+      if (params.reorderInterval > 0) {
+        reorder = std::make_unique<MortonReorder>(q_ct1, params.numParticles);
+      }
+      if (params.solver == Solver::CUTOFF) {
+        cells = std::make_unique<CellList>(q_ct1, params.numParticles);
+      }
+      if (params.solver == Solver::TREEPM) {
+        treepm = std::make_unique<TreePM>(q_ct1, params);
+      }
+      if (params.devicePartition != DevicePartition::SINGLE ||
+          params.virtualDevices > 0) {
+        if (params.solver != Solver::DIRECT || reorder) {
+          throw std::invalid_argument(
+              "--devices needs the DIRECT solver without --reorder");
+        }
+        auto queues = DeviceGroup::makeQueues(params.devicePartition,
+            params.virtualDevices);
+        if (params.deviceExchange == DeviceExchange::RING) {
+          ring = std::make_unique<RingPass>(std::move(queues),
+              params.numParticles);
+          ring->upload(pos, vel);
+        } else {
+          devices = std::make_unique<DeviceGroup>(std::move(queues),
+              params.numParticles);
+          devices->upload(pos, vel);
+        }
+      }
+
+      if (params.transport != TransportKind::NONE &&
+          (params.solver != Solver::DIRECT || reorder || devices || ring)) {
+        throw std::invalid_argument("--transport needs the DIRECT solver "
+            "without --reorder or --devices");
+      }
+      rankCount = params.numParticles;
+      transport = makeTransport(params);
+      if (transport) {
+        auto range = rankRange(params.numParticles, transport->rank(),
+            transport->size());
+        rankBegin = range.first;
+        rankCount = range.second - range.first;
+      }
+      if (profilingQueue) {
+        profiler = std::make_unique<DeviceProfiler>(*profilingQueue);
+      }
+      if (params.autotune && params.solver == Solver::DIRECT && !stream &&
+          !devices && !ring && !transport) {
+        autotune();
+      }
     };
 
+  DiskGalaxySimulator::~DiskGalaxySimulator() {
+    sycl::queue &q_ct1 = dpct::get_default_queue();
+    queue().wait();
+    q_ct1.wait();
+    for (ParticleData_d *p : {&pos_d, &pos_next_d, &vel_d}) {
+      sycl::free(p->x, q_ct1);
+      sycl::free(p->y, q_ct1);
+      sycl::free(p->z, q_ct1);
+    }
+    sycl::free(ids_d, q_ct1);
+  }
+
+  sycl::queue &DiskGalaxySimulator::queue() {
+    return profilingQueue ? *profilingQueue : dpct::get_default_queue();
+  }
+
   const std::string* DiskGalaxySimulator::getDeviceName() {
     // Query the device first time only
     if(devName.empty()){
@@ -56,66 +232,336 @@ You may need to rewrite this code.
     return &devName;
   }
 
+  // Submit one step of the particle_interaction variant selected by
+  // ct & accum_t, with the constants passed as kernel arguments
+  template <CalculationMethod ct, typename accum_t>
+  void submit_interaction(sycl::queue &q, ParticleData_d pos_d,
+      ParticleData_d pos_next_d, ParticleData_d vel_d,
+      InteractionConstants k, int nblocks, int wg_size) {
+    q.submit([&](sycl::handler &cgh) {
+        cgh.parallel_for<particle_interaction_kernel<ct, accum_t>>(
+            sycl::nd_range<1>(
+              sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
+              sycl::range<1>(wg_size)),
+            [=](sycl::nd_item<1> item_ct1) {
+            particle_interaction<ct, accum_t>(pos_d, pos_next_d, vel_d,
+                k, item_ct1);
+            });
+    });
+  }
+
+  // Executable bundle of particle_interaction_spec_kernel<ct, accum_t>
+  // with the specialization constants set to k. Bundles are cached per
+  // context, device & parameter set, so a parameter set is only JIT
+  // compiled once per process (SYCL_CACHE_PERSISTENT=1 extends this across
+  // runs).
+  // Returns nullptr where the device image can't be specialized after the
+  // fact (e.g. AOT nvptx), in which case the runtime handles it at submit.
+  template <CalculationMethod ct, typename accum_t>
+  const sycl::kernel_bundle<sycl::bundle_state::executable> *
+  get_specialized_bundle(sycl::queue &q, const InteractionConstants &k) {
+    using Key = std::tuple<size_t, size_t, int, coords_t, coords_t,
+          coords_t, coords_t>;
+    static std::map<Key, std::optional<
+      sycl::kernel_bundle<sycl::bundle_state::executable>>> cache;
+
+    sycl::context ctx = q.get_context();
+    Key key{std::hash<sycl::context>{}(ctx),
+      std::hash<sycl::device>{}(q.get_device()), k.numParticles, k.distEps,
+      k.damping, k.dt, k.dtG};
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+      std::vector<sycl::kernel_id> ids{
+        sycl::get_kernel_id<particle_interaction_spec_kernel<ct, accum_t>>()};
+      std::optional<sycl::kernel_bundle<sycl::bundle_state::executable>>
+        exe;
+      if (sycl::has_kernel_bundle<sycl::bundle_state::input>(
+            ctx, {q.get_device()}, ids)) {
+        auto input = sycl::get_kernel_bundle<sycl::bundle_state::input>(
+            ctx, {q.get_device()}, ids);
+        input.template set_specialization_constant<num_particles_sc>(
+            k.numParticles);
+        input.template set_specialization_constant<dist_eps_sc>(k.distEps);
+        input.template set_specialization_constant<damping_sc>(k.damping);
+        input.template set_specialization_constant<dt_sc>(k.dt);
+        input.template set_specialization_constant<dt_g_sc>(k.dtG);
+        exe = sycl::build(input);
+      }
+      it = cache.emplace(key, std::move(exe)).first;
+    }
+    return it->second ? &*it->second : nullptr;
+  }
+
+  // As submit_interaction, but with the constants baked into the kernel as
+  // specialization constants, giving the JIT a known trip count & folded
+  // arithmetic
+  template <CalculationMethod ct, typename accum_t>
+  void submit_interaction_spec(sycl::queue &q, ParticleData_d pos_d,
+      ParticleData_d pos_next_d, ParticleData_d vel_d,
+      InteractionConstants k, int nblocks, int wg_size) {
+    auto *bundle = get_specialized_bundle<ct, accum_t>(q, k);
+    q.submit([&](sycl::handler &cgh) {
+        if (bundle) {
+          cgh.use_kernel_bundle(*bundle);
+        } else {
+          cgh.set_specialization_constant<num_particles_sc>(k.numParticles);
+          cgh.set_specialization_constant<dist_eps_sc>(k.distEps);
+          cgh.set_specialization_constant<damping_sc>(k.damping);
+          cgh.set_specialization_constant<dt_sc>(k.dt);
+          cgh.set_specialization_constant<dt_g_sc>(k.dtG);
+        }
+        cgh.parallel_for<particle_interaction_spec_kernel<ct, accum_t>>(
+            sycl::nd_range<1>(
+              sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
+              sycl::range<1>(wg_size)),
+            [=](sycl::nd_item<1> item_ct1, sycl::kernel_handler kh) {
+            InteractionConstants sk{
+              kh.get_specialization_constant<num_particles_sc>(),
+              kh.get_specialization_constant<dist_eps_sc>(),
+              kh.get_specialization_constant<damping_sc>(),
+              kh.get_specialization_constant<dt_sc>(),
+              kh.get_specialization_constant<dt_g_sc>(),
+              k.targetOffset, k.targetCount};
+            particle_interaction<ct, accum_t>(pos_d, pos_next_d, vel_d,
+                sk, item_ct1);
+            });
+    });
+  }
+
+  void submitDirectInteraction(sycl::queue &q, ParticleData_d pos_d,
+      ParticleData_d pos_next_d, ParticleData_d vel_d,
+      const SimParam &params, const InteractionConstants &k, int nblocks,
+      int wg_size) {
+    dispatchAccumulator(params.accumMethod, [&](auto accum) {
+        using accum_t = decltype(accum);
+        constexpr auto BRANCH = CalculationMethod::BRANCH;
+        constexpr auto PREDICATED = CalculationMethod::PREDICATED;
+        if (params.calcMethod == BRANCH && params.specialize) {
+          submit_interaction_spec<BRANCH, accum_t>(q, pos_d, pos_next_d,
+              vel_d, k, nblocks, wg_size);
+        } else if (params.calcMethod == BRANCH) {
+          submit_interaction<BRANCH, accum_t>(q, pos_d, pos_next_d, vel_d, k,
+              nblocks, wg_size);
+        } else if (params.specialize) {
+          submit_interaction_spec<PREDICATED, accum_t>(q, pos_d, pos_next_d,
+              vel_d, k, nblocks, wg_size);
+        } else {
+          submit_interaction<PREDICATED, accum_t>(q, pos_d, pos_next_d,
+              vel_d, k, nblocks, wg_size);
+        }
+        });
+  }
+
   void DiskGalaxySimulator::stepSim() {
     // Compute updated positions
     int wg_size = getGwSize();
     int nblocks = ((getNumParticles() - 1) / wg_size) + 1;
 
-    // Profiling info - rather than using the CUDA event recording
-    // approach, we are instead measuring the time from before kernel
-    // submission until host synchronization. This is more portable via
-    // dpct.
+    // Profiling info - by default, rather than using the CUDA event
+    // recording approach, we are instead measuring the time from before
+    // kernel submission until host synchronization. This is more portable
+    // via dpct. With --profile=1, barriers submitted between the phases of
+    // each step time them on the device instead.
     auto start = std::chrono::steady_clock::now();
+    ScopedTimer submitTimer("submit");
+    const double submitStart = FrameTimer::get().now();
+    auto mark = [&](const char *phase) {
+      if (profiler) profiler->mark(phase);
+    };
+    if (profiler) profiler->start();
     for (size_t i = 0; i < params.simIterationsPerFrame; i++) {
-      dpct::get_default_queue().submit([&](sycl::handler &cgh) {
-          auto pos_d_ct0 = pos_d;
-          auto pos_next_d_ct1 = pos_next_d;
-          auto vel_d_ct2 = vel_d;
-          auto params_ct3 = params;
-
-          if ( getCM() == CalculationMethod::BRANCH ) {
-          cgh.parallel_for<
-          dpct_kernel_name<class particle_interaction_da5588>>(
-              sycl::nd_range<1>(
-                sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
-                sycl::range<1>(wg_size)),
-              [=](sycl::nd_item<1> item_ct1) {
-              particle_interaction<CalculationMethod::BRANCH>(pos_d_ct0, pos_next_d_ct1, vel_d_ct2,
-                  params_ct3, item_ct1);
-              });
-          } else {
-          cgh.parallel_for<
-          dpct_kernel_name<class particle_interaction_da5589>>(
-              sycl::nd_range<1>(
-                sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
-                sycl::range<1>(wg_size)),
-              [=](sycl::nd_item<1> item_ct1) {
-              particle_interaction<CalculationMethod::PREDICATED>(pos_d_ct0, pos_next_d_ct1, vel_d_ct2,
-                  params_ct3, item_ct1);
-              });
-          }
-      });
+      bool reordered = false;
+      if (reorder && simStep % params.reorderInterval == 0) {
+        reorder->apply(pos_d, pos_next_d, vel_d, ids_d);
+        reordered = true;
+        mark("reorder");
+      }
+      if (params.solver == Solver::CUTOFF) {
+        // Particle indices in the cell list are stale after a reorder, &
+        // it misses pairs once a particle has moved over half the skin
+        if (reordered || simStep % params.cellRebuildInterval == 0 ||
+            cells->maxDisplacement(pos_d) > params.cellSkin / 2) {
+          cells->build(pos_d, params.cutoff + params.cellSkin);
+          mark("cells");
+        }
+        submitCutoffInteraction(queue(), pos_d, pos_next_d, vel_d, params,
+            cells->getGrid(), nblocks, wg_size);
+        mark("interaction");
+      } else if (params.solver == Solver::TREEPM) {
+        treepm->step(pos_d, pos_next_d, vel_d, params, nblocks, wg_size);
+        mark("interaction");
+      } else if (stream) {
+        stream->step(params, wg_size);
+      } else if (devices) {
+        devices->step(params, wg_size);
+      } else if (ring) {
+        ring->step(params, wg_size);
+      } else if (transport) {
+        InteractionConstants k = makeInteractionConstants(params);
+        k.targetOffset = rankBegin;
+        k.targetCount = rankCount;
+        int rankBlocks = std::max<int>(1, (rankCount + wg_size - 1) / wg_size);
+        submitDirectInteraction(queue(), pos_d, pos_next_d, vel_d, params,
+            k, rankBlocks, wg_size);
+        mark("interaction");
+        exchangePositions(pos_next_d);
+        mark("exchange");
+      } else {
+        submitDirectInteraction(queue(), pos_d, pos_next_d, vel_d, params,
+            makeInteractionConstants(params), nblocks, wg_size);
+        mark("interaction");
+      }
       std::swap(pos_d, pos_next_d);
+      simStep++;
     }
+    submitTimer.stop();
+    ScopedTimer syncTimer("sync");
+    // The device's queue list doesn't include profilingQueue
+    queue().wait_and_throw();
     /*
 DPCT1003:5: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((dpct::get_current_device().queues_wait_and_throw(), 0));
     auto stop = std::chrono::steady_clock::now();
-    lastStepTime =
-      std::chrono::duration<float, std::milli>(stop - start)
-      .count();
+    syncTimer.stop();
+    if (profiler) {
+      lastStepTime = profiler->collect(deviceIntervals);
+      // On the host timeline, from when the step was submitted
+      if (FrameTimer::get().enabled()) {
+        for (const DeviceInterval &interval : deviceIntervals) {
+          FrameTimer::get().add(interval.name, PhaseTrack::DEVICE,
+              submitStart + interval.start * 1000,
+              submitStart + interval.end * 1000);
+        }
+      }
+    } else {
+      lastStepTime =
+        std::chrono::duration<float, std::milli>(stop - start)
+        .count();
+    }
 
     // Sync data
     recvFromDevice();
   }
 
-  // Only necessary because we can't initialize data on device yet, in a
-  // dpct-friendly way
+  Conserved DiskGalaxySimulator::getConserved() {
+    if (deviceResident(params)) {
+      return computeConserved(queue(), pos_d, vel_d, params.numParticles,
+          params.G, params.distEps);
+    }
+    // Otherwise the host arrays are complete after every step
+    const ParticleData &p = getParticlePos();
+    const ParticleData &v = getParticleVel();
+    const float *posArrays[3] = {p.x.data(), p.y.data(), p.z.data()};
+    const float *velArrays[3] = {v.x.data(), v.y.data(), v.z.data()};
+    return conservedOnHost(posArrays, velArrays, params.numParticles,
+        params.G, params.distEps);
+  }
+
+  void DiskGalaxySimulator::autotune() {
+    TuneCache cache(params.tuneCache);
+    const TuneKey key = makeTuneKey(*getDeviceName(), params);
+    TuneChoice choice;
+    if (cache.find(key, choice)) {
+      std::cout << "Using work-group size " << choice.gwSize << " and "
+        << calculationMethodName(choice.calcMethod) << " tuned in "
+        << params.tuneCache << "\n";
+    } else {
+      // The interaction only reads pos_d, so writing pos_next_d & a copy of
+      // the velocities leaves the state untouched
+      sycl::queue &q = queue();
+      const size_t n = params.numParticles;
+      ParticleData_d velScratch(n);
+      try {
+        q.memcpy(velScratch.x, vel_d.x, n * sizeof(coords_t));
+        q.memcpy(velScratch.y, vel_d.y, n * sizeof(coords_t));
+        q.memcpy(velScratch.z, vel_d.z, n * sizeof(coords_t));
+        q.wait();
+        const int maxGwSize = q.get_device()
+          .get_info<sycl::info::device::max_work_group_size>();
+        const InteractionConstants k = makeInteractionConstants(params);
+        choice = tuneLaunch(maxGwSize,
+            [&](CalculationMethod method, int wg_size) {
+            SimParam candidate = params;
+            candidate.calcMethod = method;
+            int nblocks = (n + wg_size - 1) / wg_size;
+            submitDirectInteraction(q, pos_d, pos_next_d, velScratch,
+                candidate, k, nblocks, wg_size);
+            q.wait_and_throw();
+            });
+      } catch (...) {
+        sycl::free(velScratch.x, q);
+        sycl::free(velScratch.y, q);
+        sycl::free(velScratch.z, q);
+        throw;
+      }
+      sycl::free(velScratch.x, q);
+      sycl::free(velScratch.y, q);
+      sycl::free(velScratch.z, q);
+      cache.store(key, choice);
+      std::cout << "Tuned work-group size " << choice.gwSize << " and "
+        << calculationMethodName(choice.calcMethod) << " ("
+        << choice.stepMs << " ms per interaction step)\n";
+    }
+    params.gwSize = choice.gwSize;
+    params.calcMethod = choice.calcMethod;
+  }
+
+  void DiskGalaxySimulator::exchangePositions(ParticleData_d p) {
+    sycl::queue &q = queue();
+    const size_t n = params.numParticles;
+    const size_t bytes = rankCount * sizeof(coords_t);
+    // The host positions are only staging here, recvFromDevice refreshes
+    // them at the end of the frame
+    q.memcpy(pos.x.data() + rankBegin, p.x + rankBegin, bytes);
+    q.memcpy(pos.y.data() + rankBegin, p.y + rankBegin, bytes);
+    q.memcpy(pos.z.data() + rankBegin, p.z + rankBegin, bytes);
+    q.wait();
+    transport->allGather(pos.x.data(), n);
+    transport->allGather(pos.y.data(), n);
+    transport->allGather(pos.z.data(), n);
+    q.memcpy(p.x, pos.x.data(), n * sizeof(coords_t));
+    q.memcpy(p.y, pos.y.data(), n * sizeof(coords_t));
+    q.memcpy(p.z, pos.z.data(), n * sizeof(coords_t));
+    q.wait();
+  }
+
+  // Position & velocity arrays in place in a mapped checkpoint
+  static void mappedArrays(const CheckpointReader &reader,
+      const coords_t *(&src)[6]) {
+    const CheckpointSection sections[6] = {CheckpointSection::POS_X,
+      CheckpointSection::POS_Y, CheckpointSection::POS_Z,
+      CheckpointSection::VEL_X, CheckpointSection::VEL_Y,
+      CheckpointSection::VEL_Z};
+    for (int i = 0; i < 6; i++) {
+      src[i] = static_cast<const coords_t *>(reader.data(sections[i]));
+    }
+  }
+
+  // Copy the initial state to the device, unless generated there
   void DiskGalaxySimulator::sendToDevice() {
+    if (hostStale && !restart) return;
     dpct::device_ext &dev_ct1 = dpct::get_current_device();
-    sycl::queue &q_ct1 = dev_ct1.default_queue();
+    sycl::queue &q_ct1 = queue();
+    if (stream) {
+      stream->upload(pos, vel);
+      return;
+    }
+    // --devices upload their slices from the host arrays once created
+    if (residentParticles(params) == 0) return;
+    const coords_t *src[6] = {pos.x.data(), pos.y.data(), pos.z.data(),
+      vel.x.data(), vel.y.data(), vel.z.data()};
+    if (restart) {
+      // Copy straight from the mapped checkpoint
+      mappedArrays(*restart, src);
+#ifdef SYCL_EXT_ONEAPI_COPY_OPTIMIZE
+      for (auto *p : src) {
+        sycl::ext::oneapi::experimental::prepare_for_device_copy(p,
+            params.numParticles * sizeof(coords_t), q_ct1);
+      }
+#endif
+    }
     /*
 DPCT1003:6: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
@@ -127,7 +573,7 @@ DPCT1003:7: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((q_ct1
-          .memcpy(pos_d.x, pos.x.data(),
+          .memcpy(pos_d.x, src[0],
             params.numParticles * sizeof(coords_t))
           .wait(),
           0));
@@ -136,7 +582,7 @@ DPCT1003:8: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((q_ct1
-          .memcpy(pos_d.y, pos.y.data(),
+          .memcpy(pos_d.y, src[1],
             params.numParticles * sizeof(coords_t))
           .wait(),
           0));
@@ -145,7 +591,7 @@ DPCT1003:9: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((q_ct1
-          .memcpy(pos_d.z, pos.z.data(),
+          .memcpy(pos_d.z, src[2],
             params.numParticles * sizeof(coords_t))
           .wait(),
           0));
@@ -155,7 +601,7 @@ DPCT1003:10: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((q_ct1
-          .memcpy(vel_d.x, vel.x.data(),
+          .memcpy(vel_d.x, src[3],
             params.numParticles * sizeof(coords_t))
           .wait(),
           0));
@@ -164,7 +610,7 @@ DPCT1003:11: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((q_ct1
-          .memcpy(vel_d.y, vel.y.data(),
+          .memcpy(vel_d.y, src[4],
             params.numParticles * sizeof(coords_t))
           .wait(),
           0));
@@ -173,7 +619,7 @@ DPCT1003:12: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((q_ct1
-          .memcpy(vel_d.z, vel.z.data(),
+          .memcpy(vel_d.z, src[5],
             params.numParticles * sizeof(coords_t))
           .wait(),
           0));
@@ -183,12 +629,34 @@ DPCT1003:13: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
      */
     gpuErrchk((dev_ct1.queues_wait_and_throw(), 0));
+    if (restart) {
+#ifdef SYCL_EXT_ONEAPI_COPY_OPTIMIZE
+      for (auto *p : src) {
+        sycl::ext::oneapi::experimental::release_from_device_copy(p, q_ct1);
+      }
+#endif
+      restart.reset();
+    }
   }
 
   // Receive particle positions & velocity from device
   void DiskGalaxySimulator::recvFromDevice() {
+    ScopedTimer timer("recvFromDevice");
+    hostStale = false;
     dpct::device_ext &dev_ct1 = dpct::get_current_device();
-    sycl::queue &q_ct1 = dev_ct1.default_queue();
+    sycl::queue &q_ct1 = queue();
+    if (stream) {
+      stream->download(pos, vel);
+      return;
+    }
+    if (devices) {
+      devices->download(pos, vel);
+      return;
+    }
+    if (ring) {
+      ring->download(pos, vel);
+      return;
+    }
     /*
 DPCT1003:14: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
@@ -250,6 +718,16 @@ You may need to rewrite this code.
             params.numParticles * sizeof(coords_t))
           .wait(),
           0));
+    if (transport) {
+      // Only this rank's velocities are up to date on the device
+      transport->allGather(vel.x.data(), params.numParticles);
+      transport->allGather(vel.y.data(), params.numParticles);
+      transport->allGather(vel.z.data(), params.numParticles);
+    }
+    if (reorder) {
+      q_ct1.memcpy(ids.data(), ids_d, params.numParticles * sizeof(uint32_t))
+        .wait();
+    }
     /*
 DPCT1003:21: Migrated API does not return error code. (*, 0) is inserted.
 You may need to rewrite this code.
@@ -257,38 +735,113 @@ You may need to rewrite this code.
     gpuErrchk((dev_ct1.queues_wait_and_throw(), 0));
   }
 
-  void DiskGalaxySimulator::randomParticlePos() {
-    // deterministic - default seed
-    std::mt19937 gen;
-    std::uniform_real_distribution<> dis(0.0, 1.0);
-
-    // Disk shape in x-y plane
-    for (int i = 0; i < params.numParticles; i++) {
-      float t = dis(gen) * 2 * PI;
-      float s = dis(gen) * 100;
-      pos.x[i] = cos(t) * s;
-      pos.y[i] = sin(t) * s;
+  class generate_model_kernel;
+
+  // Generates params.model, whose particles are independent of each other
+  void DiskGalaxySimulator::generateParticles() {
+    const size_t n = params.numParticles;
+    const GalaxyModelParams model = makeGalaxyModelParams(params);
+    if (deviceResident(params)) {
+      // Straight into device memory, leaving the host arrays to be filled
+      // by the first recvFromDevice
+      sycl::queue &q_ct1 = queue();
+      ParticleData_d pPos = pos_d;
+      ParticleData_d pVel = vel_d;
+      q_ct1.parallel_for<generate_model_kernel>(sycl::range<1>(n),
+          [=](sycl::id<1> idx) {
+          size_t id = idx[0];
+          float p[3], v[3];
+          galaxyModelParticle(model, id, p, v);
+          pPos.x[id] = p[0];
+          pPos.y[id] = p[1];
+          pPos.z[id] = p[2];
+          pVel.x[id] = v[0];
+          pVel.y[id] = v[1];
+          pVel.z[id] = v[2];
+          }).wait();
+      hostStale = true;
+      return;
     }
+    // Layouts which upload from the host arrays generate them there
+    parallelRanges(n, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; i++) {
+          float p[3], v[3];
+          galaxyModelParticle(model, i, p, v);
+          pos.x[i] = p[0];
+          pos.y[i] = p[1];
+          pos.z[i] = p[2];
+          vel.x[i] = v[0];
+          vel.y[i] = v[1];
+          vel.z[i] = v[2];
+        }
+        });
+  }
 
-    // Z component is independent (uniform range 0-4)
-    std::generate(begin(pos.z), end(pos.z),
-        [&gen, &dis]() { return 4.0 * dis(gen); });
+  std::string DiskGalaxySimulator::generatorState() const {
+    return "philox4x32-10 seed " + std::to_string(params.seed);
   }
 
-  void DiskGalaxySimulator::initialParticleVel() {
-    for (int i = 0; i < params.numParticles; i++) {
-      vec3 vel = cross({pos.x[i], pos.y[i], pos.z[i]}, {0.0, 0.0, 1.0});
-      coords_t orbital_vel = std::sqrt(2.0 * length(vel));
-      vel = normalize(vel) * orbital_vel;
-      this->vel.x[i] = vel.x;
-      this->vel.y[i] = vel.y;
-      this->vel.z[i] = vel.z;
+  void DiskGalaxySimulator::saveCheckpoint(const std::string &path) {
+    // Every rank holds the whole state, so one copy is enough
+    if (transport && transport->rank() != 0) return;
+    if (hostStale) recvFromDevice();
+    writeCheckpoint(path, {&params, simStep, generatorState(),
+        {pos.x.data(), pos.y.data(), pos.z.data()},
+        {vel.x.data(), vel.y.data(), vel.z.data()}, ids.data()});
+  }
+
+  bool DiskGalaxySimulator::takeSnapshot(Snapshot &snapshot) {
+    if (transport && transport->rank() != 0) return false;
+    // stepSim has already copied the state to the host, so this is a
+    // host copy into the pooled buffer
+    if (hostStale) recvFromDevice();
+    snapshot.step = simStep;
+    snapshot.rngState = generatorState();
+    const std::vector<coords_t> *src[6] = {&pos.x, &pos.y, &pos.z,
+      &vel.x, &vel.y, &vel.z};
+    float *dst[6] = {snapshot.pos[0], snapshot.pos[1], snapshot.pos[2],
+      snapshot.vel[0], snapshot.vel[1], snapshot.vel[2]};
+    for (int i = 0; i < 6; i++) {
+      std::copy(src[i]->begin(), src[i]->end(), dst[i]);
+    }
+    std::copy(ids.begin(), ids.end(), snapshot.ids);
+    return true;
+  }
+
+  void DiskGalaxySimulator::loadCheckpoint(
+      std::unique_ptr<CheckpointReader> reader) {
+    restart = std::move(reader);
+    if (restart->has(CheckpointSection::IDS)) {
+      ids.resize(params.numParticles);
+      restart->read(CheckpointSection::IDS, ids.data());
+    }
+    simStep = restart->step();
+
+    // sendToDevice copies straight from the mapping, leaving the host
+    // arrays to be filled by the first recvFromDevice. Layouts which
+    // upload from the host arrays, & big-endian hosts, read into them.
+    if (restart->data(CheckpointSection::POS_X) && deviceResident(params)) {
+      hostStale = true;
+      return;
     }
+    restart->read(CheckpointSection::POS_X, pos.x.data());
+    restart->read(CheckpointSection::POS_Y, pos.y.data());
+    restart->read(CheckpointSection::POS_Z, pos.z.data());
+    restart->read(CheckpointSection::VEL_X, vel.x.data());
+    restart->read(CheckpointSection::VEL_Y, vel.y.data());
+    restart->read(CheckpointSection::VEL_Z, vel.z.data());
+    restart.reset();
   }
 
-  const ParticleData& DiskGalaxySimulator::getParticlePos() { return pos; };
+  const ParticleData& DiskGalaxySimulator::getParticlePos() {
+    if (hostStale) recvFromDevice();
+    return pos;
+  };
 
-  const ParticleData& DiskGalaxySimulator::getParticleVel() { return vel; };
+  const ParticleData& DiskGalaxySimulator::getParticleVel() {
+    if (hostStale) recvFromDevice();
+    return vel;
+  };
 
   // Linear Algebra functions (not yet exposed in header)
   HOSTDEV vec3 cross(const vec3 v0, const vec3 v1) {
@@ -312,51 +865,37 @@ You may need to rewrite this code.
   /* O(n^2) implementation (no distance threshold), with no shared
      memory etc.
    */
-  template <CalculationMethod ct>
+  template <CalculationMethod ct, typename accum_t>
     void particle_interaction(ParticleData_d pPos,
         ParticleData_d pNextPos,
-        ParticleData_d pVel, SimParam params,
+        ParticleData_d pVel, InteractionConstants k,
         const sycl::nd_item<1> &item_ct1) {
       int id = item_ct1.get_local_id(0) +
         (item_ct1.get_group(0) * item_ct1.get_local_range(0));
-      if (id >= params.numParticles) return;
+      if (id >= k.targetCount) return;
+      id += k.targetOffset;
 
-      vec3 force(0.0f, 0.0f, 0.0f);
+      accum_t force;
       vec3 pos(pPos.x[id], pPos.y[id], pPos.z[id]);
 
 #pragma unroll 4
-      for (int i = 0; i < params.numParticles; i++) {
+      for (int i = 0; i < k.numParticles; i++) {
         vec3 other_pos{pPos.x[i], pPos.y[i], pPos.z[i]};
         vec3 r = other_pos - pos;
         // Fast computation of 1/(|r|^3)
-        coords_t dist_sqr = dot(r, r) + params.distEps;
+        coords_t dist_sqr = dot(r, r) + k.distEps;
         coords_t inv_dist_cube = sycl::rsqrt(dist_sqr * dist_sqr * dist_sqr);
 
         // assume uniform unit mass
         if  constexpr(ct == CalculationMethod::BRANCH) {
           if (i == id) continue;
-          force += r * inv_dist_cube;
+          force.add(r * inv_dist_cube);
         } else  if constexpr (ct == CalculationMethod::PREDICATED) {
-          force += r * inv_dist_cube * (i == id);
+          force.add(r * inv_dist_cube * (i != id));
         }
       }
 
-      // Update velocity
-      vec3 curr_vel(pVel.x[id], pVel.y[id], pVel.z[id]);
-      curr_vel *= params.damping;
-      curr_vel += force * params.dt * params.G;
-
-      pVel.x[id] = curr_vel.x;
-      pVel.y[id] = curr_vel.y;
-      pVel.z[id] = curr_vel.z;
-
-      // Update position (integration)
-      vec3 curr_pos(pPos.x[id], pPos.y[id], pPos.z[id]);
-
-      curr_pos += curr_vel * params.dt;
-      pNextPos.x[id] = curr_pos.x;
-      pNextPos.y[id] = curr_pos.y;
-      pNextPos.z[id] = curr_pos.z;
+      integrate(pPos, pNextPos, pVel, k, id, force.get());
     }
 
 }  // namespace simulation
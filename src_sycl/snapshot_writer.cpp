@@ -0,0 +1 @@
+../src/snapshot_writer.cpp
\ No newline at end of file
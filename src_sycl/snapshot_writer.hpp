@@ -0,0 +1 @@
+../src/snapshot_writer.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/stream_stats.cpp
\ No newline at end of file
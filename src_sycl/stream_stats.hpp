@@ -0,0 +1 @@
+../src/stream_stats.hpp
\ No newline at end of file
@@ -0,0 +1,145 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "streaming.dp.hpp"
+#include "tile_force.dp.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace simulation {
+
+  namespace {
+    ParticleData_d allocHost(size_t n, const sycl::context &ctx) {
+      ParticleData_d p;
+      p.x = sycl::malloc_host<coords_t>(n, ctx);
+      p.y = sycl::malloc_host<coords_t>(n, ctx);
+      p.z = sycl::malloc_host<coords_t>(n, ctx);
+      return p;
+    }
+
+    void freeAll(ParticleData_d &p, const sycl::context &ctx) {
+      sycl::free(p.x, ctx);
+      sycl::free(p.y, ctx);
+      sycl::free(p.z, ctx);
+    }
+
+    // Copies count elements, from srcOffset in src to dstOffset in dst
+    sycl::event copy(sycl::queue &q, ParticleData_d dst, size_t dstOffset,
+        ParticleData_d src, size_t srcOffset, size_t count,
+        const std::vector<sycl::event> &deps = {}) {
+      size_t bytes = count * sizeof(coords_t);
+      q.memcpy(dst.x + dstOffset, src.x + srcOffset, bytes, deps);
+      q.memcpy(dst.y + dstOffset, src.y + srcOffset, bytes, deps);
+      return q.memcpy(dst.z + dstOffset, src.z + srcOffset, bytes, deps);
+    }
+  }  // namespace
+
+  StreamingSolver::StreamingSolver(sycl::queue &q, size_t n_,
+      size_t tileSize, int poolTiles)
+    : h2d(q.get_context(), q.get_device(), sycl::property::queue::in_order{}),
+    compute(q.get_context(), q.get_device(),
+        sycl::property::queue::in_order{}),
+    d2h(q.get_context(), q.get_device(), sycl::property::queue::in_order{}),
+    n(n_), tile(std::min(tileSize, n_)),
+    hostPos(allocHost(n_, q.get_context())),
+    hostPosNext(allocHost(n_, q.get_context())),
+    hostVel(allocHost(n_, q.get_context())) {
+      // Two tiles are needed for a copy to overlap the calculation
+      sources.resize(std::max(2, poolTiles));
+      for (auto &s : sources) s = ParticleData_d(tile, compute);
+      for (auto &t : targets) {
+        t = {ParticleData_d(tile, compute), ParticleData_d(tile, compute),
+          ParticleData_d(tile, compute), ParticleData_d(tile, compute)};
+      }
+    }
+
+  StreamingSolver::~StreamingSolver() {
+    h2d.wait();
+    compute.wait();
+    d2h.wait();
+    sycl::context ctx = compute.get_context();
+    for (auto &s : sources) freeAll(s, ctx);
+    for (auto &t : targets) {
+      for (auto *p : {&t.pos, &t.posNext, &t.vel, &t.force}) {
+        freeAll(*p, ctx);
+      }
+    }
+    freeAll(hostPos, ctx);
+    freeAll(hostPosNext, ctx);
+    freeAll(hostVel, ctx);
+  }
+
+  void StreamingSolver::upload(const ParticleData &pos,
+      const ParticleData &vel) {
+    size_t bytes = n * sizeof(coords_t);
+    std::memcpy(hostPos.x, pos.x.data(), bytes);
+    std::memcpy(hostPos.y, pos.y.data(), bytes);
+    std::memcpy(hostPos.z, pos.z.data(), bytes);
+    std::memcpy(hostVel.x, vel.x.data(), bytes);
+    std::memcpy(hostVel.y, vel.y.data(), bytes);
+    std::memcpy(hostVel.z, vel.z.data(), bytes);
+  }
+
+  void StreamingSolver::download(ParticleData &pos, ParticleData &vel) {
+    size_t bytes = n * sizeof(coords_t);
+    std::memcpy(pos.x.data(), hostPos.x, bytes);
+    std::memcpy(pos.y.data(), hostPos.y, bytes);
+    std::memcpy(pos.z.data(), hostPos.z, bytes);
+    std::memcpy(vel.x.data(), hostVel.x, bytes);
+    std::memcpy(vel.y.data(), hostVel.y, bytes);
+    std::memcpy(vel.z.data(), hostVel.z, bytes);
+  }
+
+  void StreamingSolver::step(const SimParam &params, int wg_size) {
+    const size_t numTiles = (n + tile - 1) / tile;
+    const size_t poolTiles = sources.size();
+    InteractionConstants k = makeInteractionConstants(params);
+
+    // sourceFree[b] completes once the forces from source buffer b have
+    // been summed, targetFree[t] once target buffer t has been copied back
+    std::vector<sycl::event> sourceFree(poolTiles);
+    sycl::event targetFree[2];
+
+    size_t job = 0;
+    for (size_t t = 0; t < numTiles; t++) {
+      Target &target = targets[t % 2];
+      size_t targetBegin = t * tile;
+      size_t targetCount = std::min(tile, n - targetBegin);
+
+      // h2d is in order, so targetIn also covers the velocities
+      copy(h2d, target.vel, 0, hostVel, targetBegin, targetCount,
+          {targetFree[t % 2]});
+      sycl::event targetIn = copy(h2d, target.pos, 0, hostPos, targetBegin,
+          targetCount, {targetFree[t % 2]});
+
+      for (size_t s = 0; s < numTiles; s++, job++) {
+        ParticleData_d &source = sources[job % poolTiles];
+        size_t sourceBegin = s * tile;
+        size_t sourceCount = std::min(tile, n - sourceBegin);
+        sycl::event sourceIn = copy(h2d, source, 0, hostPos, sourceBegin,
+            sourceCount, {sourceFree[job % poolTiles]});
+        sourceFree[job % poolTiles] = submitTileForce(compute, params,
+            target.pos, targetBegin, targetCount, source, sourceBegin,
+            sourceCount, target.force, s == 0, wg_size,
+            {targetIn, sourceIn});
+      }
+
+      sycl::event integrated = submitTileIntegrate(compute, target.pos,
+          target.posNext, target.vel, target.force, targetCount, k,
+          wg_size);
+      copy(d2h, hostVel, targetBegin, target.vel, 0, targetCount,
+          {integrated});
+      targetFree[t % 2] = copy(d2h, hostPosNext, targetBegin,
+          target.posNext, 0, targetCount, {integrated});
+    }
+
+    h2d.wait();
+    compute.wait();
+    d2h.wait();
+    std::swap(hostPos, hostPosNext);
+  }
+
+}  // namespace simulation
@@ -0,0 +1 @@
+../src/sweep_args.cpp
\ No newline at end of file
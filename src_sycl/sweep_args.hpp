@@ -0,0 +1 @@
+../src/sweep_args.hpp
\ No newline at end of file
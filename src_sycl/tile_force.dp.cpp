@@ -0,0 +1,90 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "tile_force.dp.hpp"
+
+namespace simulation {
+
+  template <CalculationMethod ct, typename accum_t>
+  class tile_force_kernel;
+
+  template <CalculationMethod ct, typename accum_t>
+  sycl::event submit_tile(sycl::queue &q, ParticleData_d pos,
+      size_t targetOffset, size_t targetCount, ParticleData_d tile,
+      size_t tileOffset, size_t tileCount, ParticleData_d force, bool first,
+      coords_t distEps, int wg_size, const std::vector<sycl::event> &deps) {
+    int nblocks = (targetCount + wg_size - 1) / wg_size;
+    return q.submit([&](sycl::handler &cgh) {
+        cgh.depends_on(deps);
+        cgh.parallel_for<tile_force_kernel<ct, accum_t>>(
+            sycl::nd_range<1>(
+              sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
+              sycl::range<1>(wg_size)),
+            [=](sycl::nd_item<1> item_ct1) {
+            int id = item_ct1.get_global_id(0);
+            if (id >= int(targetCount)) return;
+            int self = int(targetOffset) + id - int(tileOffset);
+
+            accum_t acc;
+            vec3 p(pos.x[id], pos.y[id], pos.z[id]);
+            for (int i = 0; i < int(tileCount); i++) {
+              vec3 r = vec3(tile.x[i], tile.y[i], tile.z[i]) - p;
+              coords_t dist_sqr = dot(r, r) + distEps;
+              coords_t inv_dist_cube =
+                sycl::rsqrt(dist_sqr * dist_sqr * dist_sqr);
+              if constexpr (ct == CalculationMethod::BRANCH) {
+                if (i == self) continue;
+                acc.add(r * inv_dist_cube);
+              } else {
+                acc.add(r * inv_dist_cube * (i != self));
+              }
+            }
+
+            vec3 f = acc.get();
+            if (!first) f += vec3(force.x[id], force.y[id], force.z[id]);
+            force.x[id] = f.x;
+            force.y[id] = f.y;
+            force.z[id] = f.z;
+            });
+    });
+  }
+
+  sycl::event submitTileForce(sycl::queue &q, const SimParam &params,
+      ParticleData_d pos, size_t targetOffset, size_t targetCount,
+      ParticleData_d tile, size_t tileOffset, size_t tileCount,
+      ParticleData_d force, bool first, int wg_size,
+      const std::vector<sycl::event> &deps) {
+    sycl::event e;
+    dispatchAccumulator(params.accumMethod, [&](auto accum) {
+        using accum_t = decltype(accum);
+        auto submit = params.calcMethod == CalculationMethod::BRANCH ?
+          submit_tile<CalculationMethod::BRANCH, accum_t> :
+          submit_tile<CalculationMethod::PREDICATED, accum_t>;
+        e = submit(q, pos, targetOffset, targetCount, tile, tileOffset,
+            tileCount, force, first, params.distEps, wg_size, deps);
+        });
+    return e;
+  }
+
+  sycl::event submitTileIntegrate(sycl::queue &q, ParticleData_d pos,
+      ParticleData_d posNext, ParticleData_d vel, ParticleData_d force,
+      size_t count, const InteractionConstants &k, int wg_size,
+      const std::vector<sycl::event> &deps) {
+    int nblocks = (count + wg_size - 1) / wg_size;
+    return q.submit([&](sycl::handler &cgh) {
+        cgh.depends_on(deps);
+        cgh.parallel_for(
+            sycl::nd_range<1>(
+              sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
+              sycl::range<1>(wg_size)),
+            [=](sycl::nd_item<1> item_ct1) {
+            int id = item_ct1.get_global_id(0);
+            if (id >= int(count)) return;
+            integrate(pos, posNext, vel, k, id,
+                vec3(force.x[id], force.y[id], force.z[id]));
+            });
+    });
+  }
+
+}  // namespace simulation
@@ -0,0 +1,39 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#pragma once
+
+#include <sycl/sycl.hpp>
+
+#include <vector>
+
+#include "simulator.dp.hpp"
+
+/*
+   Solver::DIRECT split into tiles, for decompositions where no device
+   holds every position at once (RingPass, StreamingSolver). Forces from
+   each source tile are summed into a force buffer, then the targets are
+   integrated in one pass.
+ */
+
+namespace simulation {
+
+  // Force on targetCount particles of pos (starting at particle
+  // targetOffset), from the tileCount particles of tile (starting at
+  // particle tileOffset). With first set the force buffer is overwritten,
+  // otherwise it is added to.
+  sycl::event submitTileForce(sycl::queue &q, const SimParam &params,
+      ParticleData_d pos, size_t targetOffset, size_t targetCount,
+      ParticleData_d tile, size_t tileOffset, size_t tileCount,
+      ParticleData_d force, bool first, int wg_size,
+      const std::vector<sycl::event> &deps = {});
+
+  // Integrates count particles given the summed force on each, writing
+  // the new positions to posNext
+  sycl::event submitTileIntegrate(sycl::queue &q, ParticleData_d pos,
+      ParticleData_d posNext, ParticleData_d vel, ParticleData_d force,
+      size_t count, const InteractionConstants &k, int wg_size,
+      const std::vector<sycl::event> &deps = {});
+
+}  // namespace simulation
@@ -0,0 +1 @@
+../src/trace_writer.cpp
\ No newline at end of file
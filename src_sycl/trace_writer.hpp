@@ -0,0 +1 @@
+../src/trace_writer.hpp
\ No newline at end of file
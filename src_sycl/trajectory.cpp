@@ -0,0 +1 @@
+../src/trajectory.cpp
\ No newline at end of file
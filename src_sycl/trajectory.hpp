@@ -0,0 +1 @@
+../src/trajectory.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/transport.cpp
\ No newline at end of file
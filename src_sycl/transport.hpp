@@ -0,0 +1 @@
+../src/transport.hpp
\ No newline at end of file
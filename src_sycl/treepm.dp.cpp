@@ -0,0 +1,518 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+#include "treepm.dp.hpp"
+#include "morton.dp.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace simulation {
+
+  namespace {
+    // Short range forces are dropped beyond this many split scales
+    constexpr coords_t CUTOFF_SCALES = 4.5;
+    // Depth of the tree walk stack. Nodes that would overflow it are
+    // accepted as they are, rather than opened.
+    constexpr int STACK_SIZE = 64;
+
+    using atomic_float = sycl::atomic_ref<float, sycl::memory_order::relaxed,
+          sycl::memory_scope::device,
+          sycl::access::address_space::global_space>;
+
+    // Position wrapped into [0, box)
+    inline coords_t wrap(coords_t x, coords_t box) {
+      return x - box * sycl::floor(x / box);
+    }
+
+    // Displacement to the nearest periodic image
+    inline coords_t nearestImage(coords_t d, coords_t box) {
+      return d - box * sycl::round(d / box);
+    }
+
+    inline Complex operator+(const Complex &a, const Complex &b) {
+      return {a.re + b.re, a.im + b.im};
+    }
+
+    inline Complex operator-(const Complex &a, const Complex &b) {
+      return {a.re - b.re, a.im - b.im};
+    }
+
+    inline Complex operator*(const Complex &a, const Complex &b) {
+      return {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re};
+    }
+
+    inline coords_t sinc(coords_t x) {
+      return x == 0 ? coords_t(1) : sycl::sin(x) / x;
+    }
+
+    // Length of the common prefix of the keys of sorted leaves i & j, or -1
+    // if j is out of range. Equal keys are told apart by their index.
+    inline int commonPrefix(const uint32_t *keys, int n, int i, int j) {
+      if (j < 0 || j >= n) return -1;
+      uint32_t a = keys[i];
+      uint32_t b = keys[j];
+      if (a == b) return 32 + int(sycl::clz(uint32_t(i ^ j)));
+      return int(sycl::clz(a ^ b));
+    }
+
+    // Fraction of the Newtonian force at distance r left to the short range
+    // part, given 1 / 2rs
+    inline coords_t shortRangeFactor(coords_t r, coords_t inv2rs) {
+      coords_t u = r * inv2rs;
+      return sycl::erfc(u) +
+        coords_t(1.1283791670955126) * u * sycl::exp(-u * u);
+    }
+
+    // Squared distance from p to the nearest periodic image of the box
+    // [lo, hi], zero if p is inside it
+    inline coords_t boxDistSqr(const vec3 &p, const vec3 &lo, const vec3 &hi,
+        coords_t box) {
+      coords_t c[3] = {(lo.x + hi.x) / 2 - p.x, (lo.y + hi.y) / 2 - p.y,
+        (lo.z + hi.z) / 2 - p.z};
+      coords_t h[3] = {(hi.x - lo.x) / 2, (hi.y - lo.y) / 2,
+        (hi.z - lo.z) / 2};
+      coords_t d2 = 0;
+      for (int a = 0; a < 3; a++) {
+        coords_t d = sycl::fmax(
+            sycl::fabs(nearestImage(c[a], box)) - h[a], coords_t(0));
+        d2 += d * d;
+      }
+      return d2;
+    }
+  }  // namespace
+
+  template <typename accum_t>
+  class treepm_interaction_kernel;
+
+  TreePM::TreePM(sycl::queue &q_, const SimParam &params)
+    : q(q_), n(params.numParticles), grid(params.pmGrid),
+    boxSize(params.boxSize),
+    splitScale(params.pmSplit * params.boxSize / params.pmGrid),
+    sorter(q_, params.numParticles), meshForce(size_t(params.pmGrid) *
+        params.pmGrid * params.pmGrid),
+    nodes{static_cast<int>(params.numParticles), nullptr, nullptr, nullptr,
+      nullptr, nullptr, nullptr, ParticleData_d(2 * n - 1),
+      ParticleData_d(2 * n - 1), ParticleData_d(2 * n - 1)} {
+      if (grid < 2 || (grid & (grid - 1)) != 0) {
+        throw std::invalid_argument("PM grid must be a power of two");
+      }
+      if (!(boxSize > 0) || !(splitScale > 0)) {
+        throw std::invalid_argument("Box size & PM split must be positive");
+      }
+      while ((1 << logGrid) < grid) logGrid++;
+
+      const size_t cells = size_t(grid) * grid * grid;
+      mesh = sycl::malloc_device<Complex>(cells, q);
+
+      // exp(-2 pi i k / grid) for the first half of the roots of unity
+      std::vector<Complex> w(grid / 2);
+      for (int k = 0; k < grid / 2; k++) {
+        double angle = -2.0 * 3.14159265358979323846 * k / grid;
+        w[k] = {float(std::cos(angle)), float(std::sin(angle))};
+      }
+      twiddles = sycl::malloc_device<Complex>(w.size(), q);
+      q.memcpy(twiddles, w.data(), w.size() * sizeof(Complex)).wait();
+
+      const size_t numNodes = 2 * n - 1;
+      nodes.left = sycl::malloc_device<int>(n, q);
+      nodes.right = sycl::malloc_device<int>(n, q);
+      nodes.parent = sycl::malloc_device<int>(numNodes, q);
+      nodes.flags = sycl::malloc_device<int>(n, q);
+      nodes.order = sycl::malloc_device<uint32_t>(n, q);
+      nodes.mass = sycl::malloc_device<coords_t>(numNodes, q);
+      keys = sycl::malloc_device<uint32_t>(n, q);
+    }
+
+  TreePM::~TreePM() {
+    q.wait();
+    sycl::free(mesh, q);
+    sycl::free(twiddles, q);
+    for (auto p : {meshForce, nodes.com, nodes.lo, nodes.hi}) {
+      sycl::free(p.x, q);
+      sycl::free(p.y, q);
+      sycl::free(p.z, q);
+    }
+    sycl::free(nodes.left, q);
+    sycl::free(nodes.right, q);
+    sycl::free(nodes.parent, q);
+    sycl::free(nodes.flags, q);
+    sycl::free(nodes.order, q);
+    sycl::free(nodes.mass, q);
+    sycl::free(keys, q);
+  }
+
+  void TreePM::fft(bool inverse) {
+    const int ng = grid;
+    const int logNg = logGrid;
+    auto mesh_d = mesh;
+    auto tw = twiddles;
+    const float sign = inverse ? -1.0f : 1.0f;
+
+    // Each work item transforms one line of the mesh along the axis
+    for (int axis = 0; axis < 3; axis++) {
+      q.parallel_for(sycl::range<1>(size_t(ng) * ng), [=](sycl::id<1> idx) {
+          size_t l = idx[0];
+          size_t a = l % ng;
+          size_t b = l / ng;
+          size_t base, stride;
+          if (axis == 0) {
+            base = l * ng;
+            stride = 1;
+          } else if (axis == 1) {
+            base = b * ng * ng + a;
+            stride = ng;
+          } else {
+            base = b * ng + a;
+            stride = size_t(ng) * ng;
+          }
+          Complex *line = mesh_d + base;
+
+          // Bit reversal permutation, then iterative radix-2 butterflies
+          for (int i = 0; i < ng; i++) {
+            int j = 0;
+            for (int bit = 0; bit < logNg; bit++) {
+              j |= ((i >> bit) & 1) << (logNg - 1 - bit);
+            }
+            if (i < j) {
+              Complex t = line[i * stride];
+              line[i * stride] = line[j * stride];
+              line[j * stride] = t;
+            }
+          }
+          for (int len = 2; len <= ng; len <<= 1) {
+            int half = len >> 1;
+            int twStep = ng / len;
+            for (int i = 0; i < ng; i += len) {
+              for (int k = 0; k < half; k++) {
+                Complex w = tw[k * twStep];
+                w.im *= sign;
+                Complex u = line[(i + k) * stride];
+                Complex v = line[(i + k + half) * stride] * w;
+                line[(i + k) * stride] = u + v;
+                line[(i + k + half) * stride] = u - v;
+              }
+            }
+          }
+          });
+    }
+  }
+
+  void TreePM::computeMeshForce(const ParticleData_d &pos) {
+    const int ng = grid;
+    const size_t cells = size_t(ng) * ng * ng;
+    const coords_t box = boxSize;
+    const coords_t cellSize = box / ng;
+    const coords_t invCellSize = ng / box;
+    auto mesh_d = mesh;
+    auto p = pos;
+
+    // Cloud-in-cell mass assignment, with cell centres at (i + 0.5) * size
+    q.memset(mesh, 0, cells * sizeof(Complex));
+    q.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx) {
+        size_t i = idx[0];
+        coords_t u[3] = {wrap(p.x[i], box) * invCellSize - coords_t(0.5),
+          wrap(p.y[i], box) * invCellSize - coords_t(0.5),
+          wrap(p.z[i], box) * invCellSize - coords_t(0.5)};
+        int c[3];
+        coords_t f[3];
+        for (int a = 0; a < 3; a++) {
+          coords_t fl = sycl::floor(u[a]);
+          c[a] = int(fl);
+          f[a] = u[a] - fl;
+        }
+        for (int dz = 0; dz < 2; dz++) {
+          for (int dy = 0; dy < 2; dy++) {
+            for (int dx = 0; dx < 2; dx++) {
+              coords_t w = (dx ? f[0] : 1 - f[0]) * (dy ? f[1] : 1 - f[1]) *
+                (dz ? f[2] : 1 - f[2]);
+              int x = (c[0] + dx) & (ng - 1);
+              int y = (c[1] + dy) & (ng - 1);
+              int z = (c[2] + dz) & (ng - 1);
+              atomic_float(mesh_d[(size_t(z) * ng + y) * ng + x].re)
+                .fetch_add(w);
+            }
+          }
+        }
+        });
+
+    fft(false);
+
+    // Long range Green's function -4 pi / k^2 * exp(-k^2 rs^2), deconvolved
+    // by the CIC window of both the assignment & the interpolation. 1 / box^3
+    // folds in the cell volume (density from counts) & the inverse FFT
+    // normalisation.
+    const coords_t kFund = 2 * PI / box;
+    const coords_t rs2 = splitScale * splitScale;
+    const coords_t norm = 1 / (box * box * box);
+    q.parallel_for(sycl::range<3>(ng, ng, ng), [=](sycl::id<3> idx) {
+        int z = idx[0];
+        int y = idx[1];
+        int x = idx[2];
+        size_t c = (size_t(z) * ng + y) * ng + x;
+        if (c == 0) {
+          mesh_d[0] = {0, 0};
+          return;
+        }
+        coords_t kx = kFund * (x <= ng / 2 ? x : x - ng);
+        coords_t ky = kFund * (y <= ng / 2 ? y : y - ng);
+        coords_t kz = kFund * (z <= ng / 2 ? z : z - ng);
+        coords_t k2 = kx * kx + ky * ky + kz * kz;
+        coords_t s = sinc(kx * cellSize / 2) * sinc(ky * cellSize / 2) *
+          sinc(kz * cellSize / 2);
+        coords_t window = s * s;
+        coords_t g = -4 * PI / k2 * sycl::exp(-k2 * rs2) * norm /
+          (window * window);
+        mesh_d[c].re *= g;
+        mesh_d[c].im *= g;
+        });
+
+    fft(true);
+
+    // Acceleration -grad(phi), by fourth order central differences
+    auto force = meshForce;
+    const coords_t c1 = coords_t(2) / (3 * cellSize);
+    const coords_t c2 = coords_t(1) / (12 * cellSize);
+    q.parallel_for(sycl::range<3>(ng, ng, ng), [=](sycl::id<3> idx) {
+        int z = idx[0];
+        int y = idx[1];
+        int x = idx[2];
+        auto phi = [=](int xx, int yy, int zz) {
+          return mesh_d[(size_t(zz & (ng - 1)) * ng + (yy & (ng - 1))) * ng +
+            (xx & (ng - 1))].re;
+        };
+        size_t c = (size_t(z) * ng + y) * ng + x;
+        force.x[c] = -(c1 * (phi(x + 1, y, z) - phi(x - 1, y, z)) -
+            c2 * (phi(x + 2, y, z) - phi(x - 2, y, z)));
+        force.y[c] = -(c1 * (phi(x, y + 1, z) - phi(x, y - 1, z)) -
+            c2 * (phi(x, y + 2, z) - phi(x, y - 2, z)));
+        force.z[c] = -(c1 * (phi(x, y, z + 1) - phi(x, y, z - 1)) -
+            c2 * (phi(x, y, z + 2) - phi(x, y, z - 2)));
+        });
+  }
+
+  void TreePM::buildTree(const ParticleData_d &pos) {
+    const int count = n;
+    const int leafBase = count - 1;
+    const coords_t box = boxSize;
+    const coords_t invBox = 1 / boxSize;
+    auto p = pos;
+    auto t = nodes;
+    auto keys_d = keys;
+
+    q.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx) {
+        size_t i = idx[0];
+        keys_d[i] = mortonKey(wrap(p.x[i], box) * invBox,
+            wrap(p.y[i], box) * invBox, wrap(p.z[i], box) * invBox);
+        t.order[i] = i;
+        });
+    sorter.sort(keys, nodes.order, n, 3 * MORTON_BITS);
+
+    // Internal nodes (Karras 2012): node i covers the range of leaves
+    // sharing its longest common key prefix with a neighbour, split where
+    // the next bit changes
+    q.memset(nodes.parent, 0xFF, sizeof(int));
+    if (count > 1) {
+      q.parallel_for(sycl::range<1>(count - 1), [=](sycl::id<1> idx) {
+          int i = idx[0];
+          int d = commonPrefix(keys_d, count, i, i + 1) >
+            commonPrefix(keys_d, count, i, i - 1) ? 1 : -1;
+
+          // Far end of the range, by exponential then binary search
+          int minPrefix = commonPrefix(keys_d, count, i, i - d);
+          int lMax = 2;
+          while (commonPrefix(keys_d, count, i, i + lMax * d) > minPrefix) {
+            lMax *= 2;
+          }
+          int l = 0;
+          for (int step = lMax / 2; step >= 1; step /= 2) {
+            if (commonPrefix(keys_d, count, i, i + (l + step) * d) >
+                minPrefix) {
+              l += step;
+            }
+          }
+          int j = i + l * d;
+
+          // Split position, by binary search
+          int nodePrefix = commonPrefix(keys_d, count, i, j);
+          int s = 0;
+          int step = l;
+          do {
+            step = (step + 1) >> 1;
+            if (commonPrefix(keys_d, count, i, i + (s + step) * d) >
+                nodePrefix) {
+              s += step;
+            }
+          } while (step > 1);
+          int split = i + s * d + sycl::min(d, 0);
+
+          int left = sycl::min(i, j) == split ? leafBase + split : split;
+          int right = sycl::max(i, j) == split + 1 ? leafBase + split + 1 :
+            split + 1;
+          t.left[i] = left;
+          t.right[i] = right;
+          t.parent[left] = i;
+          t.parent[right] = i;
+          });
+      q.memset(nodes.flags, 0, (count - 1) * sizeof(int));
+    }
+
+    // Mass, centre of mass & bounds, from the leaves up. The second child
+    // to reach a node combines both, so each node is visited once.
+    q.parallel_for(sycl::range<1>(n), [=](sycl::id<1> idx) {
+        int node = leafBase + int(idx[0]);
+        uint32_t i = t.order[idx[0]];
+        coords_t x = wrap(p.x[i], box);
+        coords_t y = wrap(p.y[i], box);
+        coords_t z = wrap(p.z[i], box);
+        t.mass[node] = 1;
+        t.com.x[node] = t.lo.x[node] = t.hi.x[node] = x;
+        t.com.y[node] = t.lo.y[node] = t.hi.y[node] = y;
+        t.com.z[node] = t.lo.z[node] = t.hi.z[node] = z;
+
+        int parent = t.parent[node];
+        while (parent >= 0) {
+          sycl::atomic_ref<int, sycl::memory_order::acq_rel,
+            sycl::memory_scope::device,
+            sycl::access::address_space::global_space>
+              done(t.flags[parent]);
+          if (done.fetch_add(1) == 0) break;
+
+          int a = t.left[parent];
+          int b = t.right[parent];
+          coords_t ma = t.mass[a];
+          coords_t mb = t.mass[b];
+          coords_t m = ma + mb;
+          t.mass[parent] = m;
+          t.com.x[parent] = (ma * t.com.x[a] + mb * t.com.x[b]) / m;
+          t.com.y[parent] = (ma * t.com.y[a] + mb * t.com.y[b]) / m;
+          t.com.z[parent] = (ma * t.com.z[a] + mb * t.com.z[b]) / m;
+          t.lo.x[parent] = sycl::fmin(t.lo.x[a], t.lo.x[b]);
+          t.lo.y[parent] = sycl::fmin(t.lo.y[a], t.lo.y[b]);
+          t.lo.z[parent] = sycl::fmin(t.lo.z[a], t.lo.z[b]);
+          t.hi.x[parent] = sycl::fmax(t.hi.x[a], t.hi.x[b]);
+          t.hi.y[parent] = sycl::fmax(t.hi.y[a], t.hi.y[b]);
+          t.hi.z[parent] = sycl::fmax(t.hi.z[a], t.hi.z[b]);
+          node = parent;
+          parent = t.parent[node];
+        }
+        });
+  }
+
+  /* Tree walk for the short range force, plus the long range force
+     interpolated from the mesh with the same CIC weights used for the
+     assignment.
+   */
+  template <typename accum_t>
+    void treepm_interaction(ParticleData_d pPos, ParticleData_d pNextPos,
+        ParticleData_d pVel, InteractionConstants k, TreeNodes t,
+        ParticleData_d meshForce, int ng, coords_t box, coords_t inv2rs,
+        coords_t cutoffSqr, coords_t thetaSqr,
+        const sycl::nd_item<1> &item_ct1) {
+      int id = item_ct1.get_global_id(0);
+      if (id >= k.numParticles) return;
+
+      accum_t force;
+      vec3 pos(wrap(pPos.x[id], box), wrap(pPos.y[id], box),
+          wrap(pPos.z[id], box));
+
+      int stack[STACK_SIZE];
+      int top = 0;
+      stack[top++] = 0;
+      while (top > 0) {
+        int node = stack[--top];
+        bool leaf = node >= t.numLeaves - 1;
+        if (leaf && t.order[node - (t.numLeaves - 1)] == uint32_t(id)) {
+          continue;
+        }
+
+        vec3 lo(t.lo.x[node], t.lo.y[node], t.lo.z[node]);
+        vec3 hi(t.hi.x[node], t.hi.y[node], t.hi.z[node]);
+        coords_t boxSqr = boxDistSqr(pos, lo, hi, box);
+        if (boxSqr >= cutoffSqr) continue;
+
+        vec3 r(nearestImage(t.com.x[node] - pos.x, box),
+            nearestImage(t.com.y[node] - pos.y, box),
+            nearestImage(t.com.z[node] - pos.z, box));
+        coords_t r_sqr = dot(r, r);
+        vec3 size = hi - lo;
+        coords_t sizeMax = sycl::fmax(size.x, sycl::fmax(size.y, size.z));
+        bool accept = leaf || (boxSqr > 0 &&
+            sizeMax * sizeMax < thetaSqr * r_sqr) || top + 2 > STACK_SIZE;
+
+        if (accept) {
+          coords_t dist_sqr = r_sqr + k.distEps;
+          coords_t scale = t.mass[node] *
+            shortRangeFactor(sycl::sqrt(r_sqr), inv2rs) *
+            sycl::rsqrt(dist_sqr * dist_sqr * dist_sqr);
+          force.add(r * scale);
+        } else {
+          stack[top++] = t.left[node];
+          stack[top++] = t.right[node];
+        }
+      }
+
+      // Long range part
+      const coords_t invCellSize = ng / box;
+      coords_t u[3] = {pos.x * invCellSize - coords_t(0.5),
+        pos.y * invCellSize - coords_t(0.5),
+        pos.z * invCellSize - coords_t(0.5)};
+      int c[3];
+      coords_t f[3];
+      for (int a = 0; a < 3; a++) {
+        coords_t fl = sycl::floor(u[a]);
+        c[a] = int(fl);
+        f[a] = u[a] - fl;
+      }
+      vec3 longRange;
+      for (int dz = 0; dz < 2; dz++) {
+        for (int dy = 0; dy < 2; dy++) {
+          for (int dx = 0; dx < 2; dx++) {
+            coords_t w = (dx ? f[0] : 1 - f[0]) * (dy ? f[1] : 1 - f[1]) *
+              (dz ? f[2] : 1 - f[2]);
+            size_t cell = (size_t((c[2] + dz) & (ng - 1)) * ng +
+                ((c[1] + dy) & (ng - 1))) * ng + ((c[0] + dx) & (ng - 1));
+            longRange += vec3(meshForce.x[cell], meshForce.y[cell],
+                meshForce.z[cell]) * w;
+          }
+        }
+      }
+      force.add(longRange);
+
+      integrate(pPos, pNextPos, pVel, k, id, force.get());
+    }
+
+  void TreePM::step(ParticleData_d pos_d, ParticleData_d pos_next_d,
+      ParticleData_d vel_d, const SimParam &params, int nblocks,
+      int wg_size) {
+    computeMeshForce(pos_d);
+    buildTree(pos_d);
+
+    InteractionConstants k = makeInteractionConstants(params);
+    TreeNodes t = nodes;
+    ParticleData_d mf = meshForce;
+    int ng = grid;
+    coords_t box = boxSize;
+    coords_t inv2rs = 1 / (2 * splitScale);
+    coords_t cutoff = CUTOFF_SCALES * splitScale;
+    coords_t cutoffSqr = cutoff * cutoff;
+    coords_t thetaSqr = params.treeTheta * params.treeTheta;
+    dispatchAccumulator(params.accumMethod, [&](auto accum) {
+        using accum_t = decltype(accum);
+        q.submit([&](sycl::handler &cgh) {
+            cgh.parallel_for<treepm_interaction_kernel<accum_t>>(
+                sycl::nd_range<1>(
+                  sycl::range<1>(nblocks) * sycl::range<1>(wg_size),
+                  sycl::range<1>(wg_size)),
+                [=](sycl::nd_item<1> item_ct1) {
+                treepm_interaction<accum_t>(pos_d, pos_next_d, vel_d, k, t,
+                    mf, ng, box, inv2rs, cutoffSqr, thetaSqr, item_ct1);
+                });
+        });
+        });
+  }
+
+}  // namespace simulation
@@ -0,0 +1,27 @@
+// Copyright (C) 2022 Codeplay Software Limited
+// This work is licensed under the terms of the MIT license.
+// For a copy, see https://opensource.org/licenses/MIT.
+
+// Checks the kernel variants against a double precision direct sum on the
+// host. See ValidateOptions for the arguments.
+
+#include "validation.hpp"
+#include "simulator.dp.hpp"
+
+using namespace simulation;
+
+int main(int argc, char **argv) {
+   return runValidation(argc, argv,
+                        [](const SimParam &params, int steps,
+                           HostState &initial, HostState &after) {
+                           DiskGalaxySimulator nbodySim(params);
+                           initial.assign(nbodySim.getParticlePos(),
+                                          nbodySim.getParticleVel());
+                           for (int i = 0; i < steps; i++) {
+                              nbodySim.stepSim();
+                           }
+                           after.assign(nbodySim.getParticlePos(),
+                                        nbodySim.getParticleVel());
+                           return *nbodySim.getDeviceName();
+                        });
+}
@@ -0,0 +1 @@
+../src/validation.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../src/validation.hpp
\ No newline at end of file